@@ -0,0 +1,228 @@
+﻿#define _CRT_SECURE_NO_WARNINGS 1
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lab_db.h"
+
+// ===== ЗАМЕР ПРИЕМА СТРОК ИЗ НЕСКОЛЬКИХ ПОТОКОВ =====
+
+// ingest_bench [строк] [повторов]: для 1, 2, 4, 8 и 16 производителей строки делятся
+// поровну, каждый поток пишет свою долю через ldb_produce, а поток-владелец в цикле
+// вызывает ldb_ingest_drain, пока все производители не закроются. Время - от запуска
+// потоков до последнего drain; печатается медиана повторов. После каждого прогона
+// проверяется, что пришли все строки и строки каждого производителя идут в порядке
+// ldb_produce. Масштабирование имеет смысл смотреть только на машине с несколькими
+// ядрами: число ядер печатается в первой строке.
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <process.h>
+typedef HANDLE thread_t;
+#else
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+typedef pthread_t thread_t;
+#endif
+
+#define MAX_PRODUCERS 16
+#define MAX_REPEATS 15
+
+typedef struct {
+    LdbDatabase* db;
+    int id;
+    int rows;
+    volatile long* done;
+    int failed;
+} Producer;
+
+static long done_add(volatile long* value) {
+#ifdef _WIN32
+    return InterlockedIncrement(value);
+#else
+    return __atomic_add_fetch(value, 1, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static long done_load(volatile long* value) {
+#ifdef _WIN32
+    return InterlockedCompareExchange(value, 0, 0);
+#else
+    return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static double now_seconds() {
+#ifdef _WIN32
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+static int cpu_count() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    return (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+}
+
+// pid = номер производителя * rows + номер строки: по нему проверяется порядок
+static void produce_rows(Producer* producer) {
+    LdbProducer* handle = ldb_producer_open(producer->db);
+    char name[64];
+    if (handle == NULL) producer->failed = 1;
+    for (int i = 0; handle && i < producer->rows; i++) {
+        LdbRow row;
+        memset(&row, 0, sizeof(row));
+        // Каждое четвертое имя длинное - не помещается в запись
+        if (i % 4 == 0) sprintf(name, "a_rather_long_process_name_%d_%d", producer->id, i);
+        else sprintf(name, "proc_%d", i % 1000);
+        row.pid = producer->id * producer->rows + i;
+        row.name = name;
+        row.priority = i % 40;
+        row.kern_tm.second = (unsigned short)(i % 60);
+        row.file_tm.minute = (unsigned short)(i % 60);
+        row.cpu_usage = i % 10000;
+        row.status = LDB_RUNNING;
+        if (ldb_produce(handle, &row) != LDB_OK) {
+            producer->failed = 1;
+            break;
+        }
+    }
+    if (handle) ldb_producer_close(handle);
+    done_add(producer->done);
+}
+
+#ifdef _WIN32
+static unsigned __stdcall producer_main(void* arg) {
+    produce_rows((Producer*)arg);
+    return 0;
+}
+#else
+static void* producer_main(void* arg) {
+    produce_rows((Producer*)arg);
+    return NULL;
+}
+#endif
+
+static int thread_start(thread_t* thread, Producer* producer) {
+#ifdef _WIN32
+    *thread = (HANDLE)_beginthreadex(NULL, 0, producer_main, producer, 0, NULL);
+    return *thread != 0;
+#else
+    return pthread_create(thread, NULL, producer_main, producer) == 0;
+#endif
+}
+
+static void thread_join(thread_t thread) {
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+}
+
+// Все строки на месте, у каждого производителя номера строк возрастают
+static int check_order(LdbDatabase* db, int producers, int per_producer) {
+    int next[MAX_PRODUCERS] = { 0 };
+    LdbStatement* stmt;
+    if (ldb_prepare(db, "select pid", &stmt) != LDB_OK) return 0;
+    LdbRow row;
+    LdbResult result;
+    int total = 0;
+    int ok = 1;
+    while ((result = ldb_step(stmt, &row)) == LDB_ROW) {
+        int id = row.pid / per_producer;
+        if (id < 0 || id >= producers || row.pid % per_producer != next[id]) ok = 0;
+        else next[id]++;
+        total++;
+    }
+    ldb_finalize(stmt);
+    return ok && result == LDB_DONE && total == producers * per_producer;
+}
+
+// Один прогон; возвращает строк в секунду, 0 - ошибка
+static double run(int producers, int per_producer) {
+    LdbDatabase* db = ldb_open();
+    if (db == NULL) return 0;
+    volatile long done = 0;
+    Producer workers[MAX_PRODUCERS];
+    thread_t threads[MAX_PRODUCERS];
+    int started = 0;
+    int inserted = 0;
+    int ok = 1;
+
+    double start = now_seconds();
+    for (int i = 0; i < producers; i++) {
+        workers[i].db = db;
+        workers[i].id = i;
+        workers[i].rows = per_producer;
+        workers[i].done = &done;
+        workers[i].failed = 0;
+        if (!thread_start(&threads[i], &workers[i])) {
+            ok = 0;
+            break;
+        }
+        started++;
+    }
+    while (done_load(&done) < started) {
+        int count = 0;
+        if (ldb_ingest_drain(db, &count) != LDB_OK) ok = 0;
+        inserted += count;
+    }
+    for (int i = 0; i < started; i++) thread_join(threads[i]);
+    int count = 0;
+    if (ldb_ingest_drain(db, &count) != LDB_OK) ok = 0;
+    inserted += count;
+    double seconds = now_seconds() - start;
+
+    for (int i = 0; i < started; i++) {
+        if (workers[i].failed) ok = 0;
+    }
+    if (ok && (inserted != producers * per_producer || !check_order(db, producers, per_producer))) ok = 0;
+    ldb_close(db);
+    return ok && seconds > 0 ? inserted / seconds : 0;
+}
+
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char** argv) {
+    int rows = argc > 1 ? atoi(argv[1]) : 1600000;
+    int repeats = argc > 2 ? atoi(argv[2]) : 3;
+    if (rows < MAX_PRODUCERS || repeats < 1 || repeats > MAX_REPEATS) {
+        fprintf(stderr, "usage: ingest_bench [rows >= %d] [repeats 1..%d]\n", MAX_PRODUCERS, MAX_REPEATS);
+        return 2;
+    }
+    printf("cpus=%d rows=%d repeats=%d\n", cpu_count(), rows, repeats);
+    for (int producers = 1; producers <= MAX_PRODUCERS; producers *= 2) {
+        int per_producer = rows / producers;
+        double rates[MAX_REPEATS];
+        for (int r = 0; r < repeats; r++) {
+            rates[r] = run(producers, per_producer);
+            if (rates[r] == 0) {
+                printf("producers=%d: failed\n", producers);
+                return 1;
+            }
+        }
+        qsort(rates, repeats, sizeof(double), compare_double);
+        printf("producers=%2d rows/s=%.0f (min %.0f, max %.0f)\n",
+            producers, rates[repeats / 2], rates[0], rates[repeats - 1]);
+    }
+    return 0;
+}
@@ -1,9 +1,289 @@
 ﻿#define _CRT_SECURE_NO_WARNINGS 1
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <limits.h>
+#include "lab_db.h"
+
+// ===== ПОТОКИ И АТОМАРНЫЕ ОПЕРАЦИИ =====
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <process.h>
+#define strtok_r strtok_s
+#define file_seek _fseeki64
+#define THREAD_LOCAL __declspec(thread)
+typedef HANDLE thread_t;
+typedef SRWLOCK mutex_t;
+typedef CONDITION_VARIABLE cond_t;
+#else
+#include <pthread.h>
+#define file_seek fseeko
+#define THREAD_LOCAL _Thread_local
+typedef pthread_t thread_t;
+typedef pthread_mutex_t mutex_t;
+typedef pthread_cond_t cond_t;
+#endif
+
+typedef struct {
+    void (*func)(void*);
+    void* arg;
+} ThreadStart;
+
+// Возвращает новое значение
+static long atomic_add(volatile long* value, long delta) {
+#ifdef _WIN32
+    return InterlockedExchangeAdd(value, delta) + delta;
+#else
+    return __atomic_add_fetch(value, delta, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static long atomic_load(volatile long* value) {
+#ifdef _WIN32
+    return InterlockedCompareExchange(value, 0, 0);
+#else
+    return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// Указатели для очередей без блокировок
+static void* atomic_exchange_ptr(void* volatile* target, void* value) {
+#ifdef _WIN32
+    return InterlockedExchangePointer(target, value);
+#else
+    return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static void* atomic_load_ptr(void* volatile* target) {
+#ifdef _WIN32
+    return InterlockedCompareExchangePointer(target, NULL, NULL);
+#else
+    return __atomic_load_n(target, __ATOMIC_SEQ_CST);
+#endif
+}
+
+#ifdef _WIN32
+static unsigned __stdcall thread_trampoline(void* arg) {
+    ThreadStart* start = (ThreadStart*)arg;
+    start->func(start->arg);
+    return 0;
+}
+#else
+static void* thread_trampoline(void* arg) {
+    ThreadStart* start = (ThreadStart*)arg;
+    start->func(start->arg);
+    return NULL;
+}
+#endif
+
+// start должен жить до thread_join
+static int thread_start(thread_t* thread, ThreadStart* start) {
+#ifdef _WIN32
+    *thread = (HANDLE)_beginthreadex(NULL, 0, thread_trampoline, start, 0, NULL);
+    return *thread != 0;
+#else
+    return pthread_create(thread, NULL, thread_trampoline, start) == 0;
+#endif
+}
+
+static void thread_join(thread_t thread) {
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+}
+
+#ifdef _WIN32
+static void mutex_init(mutex_t* m) { InitializeSRWLock(m); }
+static void mutex_destroy(mutex_t* m) { (void)m; }
+static void mutex_lock(mutex_t* m) { AcquireSRWLockExclusive(m); }
+static void mutex_unlock(mutex_t* m) { ReleaseSRWLockExclusive(m); }
+static void cond_init(cond_t* c) { InitializeConditionVariable(c); }
+static void cond_destroy(cond_t* c) { (void)c; }
+static void cond_wait(cond_t* c, mutex_t* m) { SleepConditionVariableSRW(c, m, INFINITE, 0); }
+static void cond_signal(cond_t* c) { WakeConditionVariable(c); }
+static void cond_broadcast(cond_t* c) { WakeAllConditionVariable(c); }
+#else
+static void mutex_init(mutex_t* m) { pthread_mutex_init(m, NULL); }
+static void mutex_destroy(mutex_t* m) { pthread_mutex_destroy(m); }
+static void mutex_lock(mutex_t* m) { pthread_mutex_lock(m); }
+static void mutex_unlock(mutex_t* m) { pthread_mutex_unlock(m); }
+static void cond_init(cond_t* c) { pthread_cond_init(c, NULL); }
+static void cond_destroy(cond_t* c) { pthread_cond_destroy(c); }
+static void cond_wait(cond_t* c, mutex_t* m) { pthread_cond_wait(c, m); }
+static void cond_signal(cond_t* c) { pthread_cond_signal(c); }
+static void cond_broadcast(cond_t* c) { pthread_cond_broadcast(c); }
+#endif
+
+// ===== РАЗДЕЛЯЕМАЯ ПАМЯТЬ =====
+
+// Именованный сегмент, видимый другим процессам: POSIX shm_open + mmap, в Windows -
+// отображение файла подкачки. Имя передается без префикса ("/" или "Local\")
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define SHARED_NAME_SIZE 96
+
+typedef struct {
+    void* data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE handle;
+#endif
+} SharedMem;
+
+// 0 - имя не помещается в SHARED_NAME_SIZE: обрезать нельзя, иначе два разных имени
+// попадут в один сегмент
+static int shared_path(char* path, const char* name) {
+#ifdef _WIN32
+    int len = snprintf(path, SHARED_NAME_SIZE, "Local\\%s", name);
+#else
+    int len = snprintf(path, SHARED_NAME_SIZE, "/%s", name);
+#endif
+    return len > 0 && len < SHARED_NAME_SIZE;
+}
+
+// Создает сегмент для записи (старый с тем же именем заменяется); 0 - ошибка
+static int shared_create(SharedMem* mem, const char* name, size_t size) {
+    char path[SHARED_NAME_SIZE];
+    if (!shared_path(path, name)) return 0;
+    mem->size = size;
+#ifdef _WIN32
+    mem->handle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+        (DWORD)((unsigned long long)size >> 32), (DWORD)size, path);
+    if (mem->handle == NULL) return 0;
+    mem->data = MapViewOfFile(mem->handle, FILE_MAP_WRITE, 0, 0, size);
+    if (mem->data == NULL) {
+        CloseHandle(mem->handle);
+        return 0;
+    }
+#else
+    shm_unlink(path);
+    int fd = shm_open(path, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) return 0;
+    if (ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        shm_unlink(path);
+        return 0;
+    }
+    mem->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem->data == MAP_FAILED) {
+        shm_unlink(path);
+        mem->data = NULL;
+        return 0;
+    }
+#endif
+    return 1;
+}
+
+// Подключает существующий сегмент только для чтения; 0 - сегмента нет
+static int shared_open(SharedMem* mem, const char* name) {
+    char path[SHARED_NAME_SIZE];
+    if (!shared_path(path, name)) return 0;
+#ifdef _WIN32
+    mem->handle = OpenFileMappingA(FILE_MAP_READ, FALSE, path);
+    if (mem->handle == NULL) return 0;
+    mem->data = MapViewOfFile(mem->handle, FILE_MAP_READ, 0, 0, 0);
+    MEMORY_BASIC_INFORMATION info;
+    if (mem->data == NULL || VirtualQuery(mem->data, &info, sizeof(info)) == 0) {
+        if (mem->data) UnmapViewOfFile(mem->data);
+        CloseHandle(mem->handle);
+        return 0;
+    }
+    mem->size = info.RegionSize;
+#else
+    int fd = shm_open(path, O_RDONLY, 0);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    mem->size = (size_t)st.st_size;
+    mem->data = mmap(NULL, mem->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem->data == MAP_FAILED) {
+        mem->data = NULL;
+        return 0;
+    }
+#endif
+    return 1;
+}
+
+static void shared_close(SharedMem* mem) {
+    if (mem->data == NULL) return;
+#ifdef _WIN32
+    UnmapViewOfFile(mem->data);
+    CloseHandle(mem->handle);
+#else
+    munmap(mem->data, mem->size);
+#endif
+    mem->data = NULL;
+}
+
+// Убирает имя; уже подключенные процессы продолжают видеть сегмент.
+// В Windows сегмент исчезает вместе с последним дескриптором
+static void shared_remove(const char* name) {
+#ifdef _WIN32
+    (void)name;
+#else
+    char path[SHARED_NAME_SIZE];
+    if (shared_path(path, name)) shm_unlink(path);
+#endif
+}
+
+// Отображает обычный файл только для чтения (закрывается shared_close); 0 - ошибка или пустой файл
+static int file_map(SharedMem* mem, const char* path) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return 0;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return 0;
+    }
+    mem->size = (size_t)size.QuadPart;
+    // Отображение держит файл открытым само
+    mem->handle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (mem->handle == NULL) return 0;
+    mem->data = MapViewOfFile(mem->handle, FILE_MAP_READ, 0, 0, 0);
+    if (mem->data == NULL) {
+        CloseHandle(mem->handle);
+        return 0;
+    }
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    mem->size = (size_t)st.st_size;
+    mem->data = mmap(NULL, mem->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mem->data == MAP_FAILED) {
+        mem->data = NULL;
+        return 0;
+    }
+#endif
+    return 1;
+}
 
 // ===== КАСТОМНЫЕ ТИПЫ =====
 
@@ -16,7 +296,7 @@ typedef enum {
     SLEEPING
 } Status;
 
-const char* status_names[] = {
+static const char* status_names[] = {
     "running",
     "ready",
     "paused",
@@ -31,9 +311,26 @@ typedef struct {
     unsigned short second;
 } Time;
 
+// Короткое имя (до NAME_INLINE_SIZE - 1 байт) лежит прямо в записи,
+// длинное - в куче строк (name_new) и разделяется строками
+#define NAME_INLINE_SIZE 24
+
+// NAME_REL - только в реплике: строка лежит в том же сегменте разделяемой памяти
+typedef enum { NAME_NONE, NAME_INLINE, NAME_HEAP, NAME_REF, NAME_REL } NameKind;
+
+typedef struct {
+    union {
+        char text[NAME_INLINE_SIZE];    // с завершающим нулем
+        char* heap;                     // NAME_HEAP - своя ссылка, NAME_REF - чужая строка
+        long long rel;                  // NAME_REL - смещение строки от начала ProcessName
+    } data;
+    unsigned char kind;
+} ProcessName;
+
 typedef struct Process {
     int pid;
-    char* name;
+    unsigned char pool;     // 0 - общая куча, иначе номер пула шарда + 1 (row_store)
+    ProcessName name;
     int priority;
     Time kern_tm;
     Time file_tm;
@@ -42,1536 +339,8667 @@ typedef struct Process {
     struct Process* next;
 } Process;
 
+typedef struct {
+    char field_name[50];
+    int order; // 0 - asc, 1 - desc
+} SortField;
+
+// Структура для сортировки
+typedef struct {
+    Process* proc;
+    int index;
+} SortItem;
+
+static void free_process(Process* proc);
+static int parse_sort_fields(const char* str, SortField* fields, int* count);
+static int compare_for_sort(Process* a, Process* b, SortField* fields, int count);
+static int compare_for_sort_stable(SortItem* a, SortItem* b, SortField* fields, int count);
+static void quicksort_stable(SortItem* arr, int left, int right, SortField* fields, int count);
+static int compare_processes(Process* a, Process* b, char** fields, int count);
+static unsigned int hash_process_fields(Process* proc, char** fields, int count);
+static int is_known_field(const char* name);
+static int packed_row_count();
+static Process* packed_last_row();
+static void bloom_add(int pid);
+static void bloom_forget(int rows);
+static void bloom_clear();
+
+// Новое значение поля для update и insert, разобранное один раз
+typedef struct {
+    char field[50];
+    int int_value;      // pid, priority, cpu_usage, status
+    Time time_value;    // kern_tm, file_tm
+    char* str_value;    // name (разделяемая строка)
+} FieldValue;
+
+static void field_value_assign(FieldValue* value, Process** rows, int count);
+
 // ===== ГЛОБАЛЬНЫЕ ПЕРЕМЕННЫЕ =====
 
-Process* head = NULL;
-int process_count = 0;
+static Process* head = NULL;
+static int process_count = 0;
 
 // ===== СЧЕТЧИКИ ПАМЯТИ =====
 
-int malloc_count = 0;
-int calloc_count = 0;
-int realloc_count = 0;
-int free_count = 0;
+// Счетчики атомарные: читающие команды могут выполняться в других потоках
+static volatile long malloc_count = 0;
+static volatile long calloc_count = 0;
+static volatile long realloc_count = 0;
+static volatile long free_count = 0;
+static long read_allocs = 0;      // выделения во время select/count/aggregate
 
 // ===== ФУНКЦИИ ПАМЯТИ =====
 
-void* my_malloc(size_t size) {
-    malloc_count++;
+static void* my_malloc(size_t size) {
+    atomic_add(&malloc_count, 1);
     return malloc(size);
 }
 
-void* my_calloc(size_t count, size_t size) {
-    calloc_count++;
+static void* my_calloc(size_t count, size_t size) {
+    atomic_add(&calloc_count, 1);
     return calloc(count, size);
 }
 
-void* my_realloc(void* ptr, size_t new_size) {
+static void* my_realloc(void* ptr, size_t new_size) {
     if (ptr == NULL) {
-        malloc_count++;
+        atomic_add(&malloc_count, 1);
         return malloc(new_size);
     }
-    realloc_count++;
+    atomic_add(&realloc_count, 1);
     return realloc(ptr, new_size);
 }
 
-void my_free(void* ptr) {
+static void my_free(void* ptr) {
     if (ptr != NULL) {
-        free_count++;
+        atomic_add(&free_count, 1);
         free(ptr);
     }
 }
 
-// ===== РАБОТА СО СПИСКОМ =====
+// ===== ВРЕМЕННАЯ ПАМЯТЬ КОМАНДЫ =====
 
-Process* creation_process() {
-    Process* new_proc = (Process*)my_malloc(sizeof(Process));
-    if (new_proc == NULL) return NULL;
-    memset(new_proc, 0, sizeof(Process));
-    new_proc->status = RUNNING;
-    return new_proc;
-}
+// Все временные буферы команды (копии аргументов, условия, списки полей, рабочие
+// массивы) берутся из арены и не освобождаются по одному: после команды арена
+// откатывается к отметке. Блоки арены остаются у потока, поэтому в установившемся
+// режиме команды не обращаются к malloc. У каждого потока своя арена.
 
-void free_process(Process* proc) {
-    if (proc == NULL) return;
-    if (proc->name != NULL) my_free(proc->name);
-    my_free(proc);
-}
+#define SCRATCH_CHUNK_SIZE (256 * 1024)
+#define SCRATCH_MAX_CHUNKS 32
 
-void append_process(Process* new_proc) {
-    if (new_proc == NULL) return;
-    if (head == NULL) {
-        head = new_proc;
+typedef struct {
+    char* chunks[SCRATCH_MAX_CHUNKS];
+    size_t sizes[SCRATCH_MAX_CHUNKS];
+    int chunk_count;
+    int current;        // блок, из которого идет выделение
+    size_t used;        // занято в текущем блоке
+} ScratchArena;
+
+typedef struct {
+    int chunk;
+    size_t used;
+} ScratchMark;
+
+static THREAD_LOCAL ScratchArena scratch;
+
+static void* scratch_alloc(size_t size) {
+    size = (size + 15) & ~(size_t)15;
+    if (size == 0) size = 16;
+    if (scratch.current < scratch.chunk_count && scratch.used + size <= scratch.sizes[scratch.current]) {
+        void* ptr = scratch.chunks[scratch.current] + scratch.used;
+        scratch.used += size;
+        return ptr;
     }
-    else {
-        Process* current = head;
-        while (current->next != NULL) current = current->next;
-        current->next = new_proc;
+
+    // Текущий блок кончился: переходим к следующему, при необходимости заводя его
+    int next = scratch.chunk_count == 0 ? 0 : scratch.current + 1;
+    if (next >= SCRATCH_MAX_CHUNKS) return NULL;
+    if (next < scratch.chunk_count && scratch.sizes[next] < size) {
+        my_free(scratch.chunks[next]);
+        scratch.chunks[next] = NULL;
+        scratch.sizes[next] = 0;
     }
-    process_count++;
+    if (next == scratch.chunk_count || scratch.chunks[next] == NULL) {
+        size_t chunk_size = (size_t)SCRATCH_CHUNK_SIZE << (next < 8 ? next : 8);
+        if (chunk_size < size) chunk_size = size;
+        char* chunk = (char*)my_malloc(chunk_size);
+        if (chunk == NULL) return NULL;
+        scratch.chunks[next] = chunk;
+        scratch.sizes[next] = chunk_size;
+        if (next == scratch.chunk_count) scratch.chunk_count++;
+    }
+    scratch.current = next;
+    scratch.used = size;
+    return scratch.chunks[next];
 }
 
-Process* get_process_index(int index) {
-    if (index < 0 || index >= process_count || head == NULL) return NULL;
-    Process* current = head;
-    for (int i = 0; i < index; i++) current = current->next;
-    return current;
+static ScratchMark scratch_mark() {
+    ScratchMark mark;
+    mark.chunk = scratch.current;
+    mark.used = scratch.used;
+    return mark;
 }
 
-int delete_process(int index) {
-    if (index < 0 || index >= process_count || head == NULL) return 0;
-    Process* to_delete = NULL;
-    if (index == 0) {
-        to_delete = head;
-        head = head->next;
-    }
-    else {
-        Process* prev = head;
-        for (int i = 0; i < index - 1; i++) prev = prev->next;
-        to_delete = prev->next;
-        prev->next = to_delete->next;
-    }
-    free_process(to_delete);
-    process_count--;
-    return 1;
+// Освобождает все, что выделено после отметки
+static void scratch_reset(ScratchMark mark) {
+    scratch.current = mark.chunk;
+    scratch.used = mark.used;
 }
 
-void clear_allproc() {
-    while (head != NULL) {
-        Process* temp = head;
-        head = head->next;
-        free_process(temp);
-    }
-    process_count = 0;
+// Заводит первый блок заранее, чтобы первая команда не платила за него
+static void scratch_warm() {
+    if (scratch.chunk_count > 0) return;
+    ScratchMark mark = scratch_mark();
+    scratch_alloc(1);
+    scratch_reset(mark);
 }
 
-// ===== ВЫВОД ОШИБОК =====
-
-void print_incorrect(FILE* output, const char* command) {
-    fprintf(output, "incorrect:'");
-    int count = 0;
-    while (command[count] != '\0' && count < 20) {
-        fprintf(output, "%c", command[count]);
-        count++;
-    }
-    fprintf(output, "'\n");
+// Возвращает блоки арены потока системе
+static void scratch_release() {
+    for (int i = 0; i < scratch.chunk_count; i++) my_free(scratch.chunks[i]);
+    memset(&scratch, 0, sizeof(scratch));
 }
 
-// ===== ПАРСИНГ =====
+// ===== РАЗДЕЛЯЕМЫЕ ИМЕНА =====
 
-int pars_valid_int(const char* str) {
-    if (str == NULL || *str == '\0') return 0;
-    if (*str == '-') str++;
-    if (*str == '\0') return 0;
-    while (*str) {
-        if (!isdigit((unsigned char)*str)) return 0;
-        str++;
-    }
-    return 1;
+// Имя строки хранится со счетчиком ссылок перед символами: update одного значения
+// на много строк и копии строк для снимков не копируют текст, а разделяют его
+typedef struct {
+    volatile long refs;
+} NameHeader;
+
+static char* name_new(const char* str, size_t len) {
+    NameHeader* header = (NameHeader*)my_malloc(sizeof(NameHeader) + len + 1);
+    if (header == NULL) return NULL;
+    header->refs = 1;
+    char* name = (char*)(header + 1);
+    memcpy(name, str, len);
+    name[len] = '\0';
+    return name;
 }
 
+static char* name_share(char* name) {
+    if (name != NULL) atomic_add(&((NameHeader*)name - 1)->refs, 1);
+    return name;
+}
 
-int diapozon_int(const char* str, int* rez) {
-    if (!pars_valid_int(str)) return 0;
+static void name_release(char* name) {
+    if (name == NULL) return;
+    NameHeader* header = (NameHeader*)name - 1;
+    if (atomic_add(&header->refs, -1) == 0) my_free(header);
+}
 
-    const char* p = str;
-    int sign = 1;
-    long long val = 0;
+static const char* name_text(const ProcessName* name) {
+    if (name->kind == NAME_INLINE) return name->data.text;
+    if (name->kind == NAME_NONE) return NULL;
+    if (name->kind == NAME_REL) return (const char*)name + name->data.rel;
+    return name->data.heap;
+}
 
-    // Определяем знак
-    if (*p == '-') {
-        sign = -1;
-        p++;
+static void name_clear(ProcessName* name) {
+    if (name->kind == NAME_HEAP) name_release(name->data.heap);
+    name->kind = NAME_NONE;
+}
+
+// Присваивает имя из разделяемой строки str длиной len: короткое копируется в запись
+static void name_assign_shared(ProcessName* name, char* str, size_t len) {
+    name_clear(name);
+    if (len < NAME_INLINE_SIZE) {
+        memcpy(name->data.text, str, len + 1);
+        name->kind = NAME_INLINE;
+    }
+    else {
+        name->data.heap = name_share(str);
+        name->kind = NAME_HEAP;
     }
+}
 
-    // Парсим цифры
-    while (*p) {
-        if (!isdigit(*p)) return 0;
-        // Проверяем переполнение
-        if (val > 2147483647LL) return 0;
-        val = val * 10 + (*p - '0');
-        p++;
+// Присваивает имя из обычной строки; 0 - не хватило памяти на длинное имя
+static int name_assign(ProcessName* name, const char* str, size_t len) {
+    name_clear(name);
+    if (len < NAME_INLINE_SIZE) {
+        memcpy(name->data.text, str, len);
+        name->data.text[len] = '\0';
+        name->kind = NAME_INLINE;
+        return 1;
     }
+    name->data.heap = name_new(str, len);
+    if (name->data.heap == NULL) return 0;
+    name->kind = NAME_HEAP;
+    return 1;
+}
 
-    val *= sign;
+// Копия записи держит свою ссылку на длинное имя
+static void name_copied(ProcessName* name) {
+    if (name->kind == NAME_HEAP) name_share(name->data.heap);
+}
 
-    // Проверяем диапазон int
-    if (val < -2147483647LL - 1 || val > 2147483647LL) return 0;
+// ===== СЧЕТЧИКИ СТАТУСОВ И ПРИОРИТЕТОВ =====
 
-    *rez = (int)val;
-    return 1;
+// Поддерживаются при каждой вставке, изменении и удалении процесса,
+// чтобы count по статусу или приоритету не требовал прохода по списку
+
+typedef struct {
+    int priority;
+    int count;
+    int used;
+} PriorityCount;
+
+static int status_counts[6] = { 0 };
+static PriorityCount* priority_counts = NULL; // открытая адресация, размер - степень двойки
+static int priority_capacity = 0;
+static int priority_used = 0;
+
+static unsigned int hash_int(int value) {
+    unsigned int h = (unsigned int)value;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
 }
 
-char* pars_str(const char* str) {
-    if (str == NULL || *str != '"') return NULL;
+static PriorityCount* priority_slot(PriorityCount* table, int capacity, int priority) {
+    unsigned int mask = (unsigned int)capacity - 1;
+    unsigned int i = hash_int(priority) & mask;
+    while (table[i].used && table[i].priority != priority) i = (i + 1) & mask;
+    return &table[i];
+}
 
-    str++;
-    char* rez = (char*)my_malloc(strlen(str) + 1);
-    if (rez == NULL) return NULL;
+static int priority_count_get(int priority) {
+    if (priority_counts == NULL) return 0;
+    return priority_slot(priority_counts, priority_capacity, priority)->count;
+}
 
-    int i = 0;
-    while (*str) {
-        if (*str == '\\') {
-            str++;
-            if (*str == '"' || *str == '\\') {
-                rez[i++] = *str;
-                str++;
-            }
-            else {
-                rez[i++] = '\\';
-                if (*str) rez[i++] = *str;
-                str++;
-            }
-        }
-        else if (*str == '"') {
-            str++;
-            break;
-        }
-        else {
-            rez[i++] = *str;
-            str++;
+static int priority_counts_grow() {
+    int new_capacity = priority_capacity ? priority_capacity * 2 : 16;
+    PriorityCount* table = (PriorityCount*)my_calloc(new_capacity, sizeof(PriorityCount));
+    if (table == NULL) return 0;
+
+    // Обнулившиеся приоритеты при перестройке выбрасываются
+    int used = 0;
+    for (int i = 0; i < priority_capacity; i++) {
+        if (priority_counts[i].used && priority_counts[i].count > 0) {
+            *priority_slot(table, new_capacity, priority_counts[i].priority) = priority_counts[i];
+            used++;
         }
     }
+    my_free(priority_counts);
+    priority_counts = table;
+    priority_capacity = new_capacity;
+    priority_used = used;
+    return 1;
+}
 
-    rez[i] = '\0';
-    return rez;
+static void counters_add(Process* proc) {
+    status_counts[proc->status]++;
+    if ((priority_used + 1) * 4 > priority_capacity * 3 && !priority_counts_grow()) return;
+    PriorityCount* slot = priority_slot(priority_counts, priority_capacity, proc->priority);
+    if (!slot->used) {
+        slot->used = 1;
+        slot->priority = proc->priority;
+        slot->count = 0;
+        priority_used++;
+    }
+    slot->count++;
 }
 
-int pars_time(const char* str, Time* t) {
-    if (str == NULL || *str != '\'') return 0;
-    str++;
-    int h, m, s;
-    if (sscanf(str, "%d:%d:%d", &h, &m, &s) != 3) return 0;
-    if (h < 0 || h > 23 || m < 0 || m > 59 || s < 0 || s > 59) return 0;
-    const char* p = str;
-    while (*p && *p != '\'') p++;
-    if (*p != '\'') return 0;
-    t->hour = h;
-    t->minute = m;
-    t->second = s;
+static void counters_remove(Process* proc) {
+    status_counts[proc->status]--;
+    if (priority_counts == NULL) return;
+    PriorityCount* slot = priority_slot(priority_counts, priority_capacity, proc->priority);
+    if (slot->used) slot->count--;
+}
+
+static void counters_clear() {
+    for (int i = 0; i < 6; i++) status_counts[i] = 0;
+    my_free(priority_counts);
+    priority_counts = NULL;
+    priority_capacity = 0;
+    priority_used = 0;
+}
+
+// ===== СОСТОЯНИЕ СОРТИРОВКИ =====
+
+// Ключи, по которым список сейчас физически упорядочен (0 - порядок не известен).
+// sorted_rows повторяет список в виде массива для бинарного поиска; после удалений
+// порядок сохраняется, и массив просто перестраивается при следующем обращении.
+static SortField sort_state[100];
+static int sort_state_count = 0;
+static Process** sorted_rows = NULL;
+static int sorted_rows_capacity = 0;
+static int sorted_rows_valid = 0;
+static int sorted_insert_mode = 0;
+
+// Буфер sorted_rows сохраняется, чтобы следующее обращение не выделяло память заново
+static void sort_state_reset() {
+    sorted_rows_valid = 0;
+    sort_state_count = 0;
+}
+
+static int sorted_rows_reserve(int capacity) {
+    if (capacity <= sorted_rows_capacity) return 1;
+    int new_capacity = sorted_rows_capacity ? sorted_rows_capacity : 16;
+    while (new_capacity < capacity) new_capacity *= 2;
+    Process** rows = (Process**)my_realloc(sorted_rows, new_capacity * sizeof(Process*));
+    if (rows == NULL) return 0;
+    sorted_rows = rows;
+    sorted_rows_capacity = new_capacity;
     return 1;
 }
 
-// ИСПРАВЛЕНО: заменяем long long на long для VS2010
-int pars_decimal(const char* str, int* rez) {
-    if (str == NULL || rez == NULL) return 0;
+// Возвращает 1, если sorted_rows соответствует списку
+static int sorted_rows_ensure() {
+    if (sort_state_count == 0) return 0;
+    if (sorted_rows_valid) return 1;
+    if (!sorted_rows_reserve(process_count)) return 0;
+    int i = 0;
+    for (Process* curr = head; curr; curr = curr->next) sorted_rows[i++] = curr;
+    sorted_rows_valid = 1;
+    return 1;
+}
 
-    // Пропускаем начальные пробелы
-    while (*str == ' ') str++;
+static int is_sort_key(const char* field) {
+    for (int i = 0; i < sort_state_count; i++) {
+        if (strcmp(sort_state[i].field_name, field) == 0) return 1;
+    }
+    return 0;
+}
 
-    int sign = 1;
-    if (*str == '-') {
-        sign = -1;
-        str++;
+// Первая позиция, куда можно вставить proc, не нарушая порядок (после равных)
+static int sorted_upper_bound(Process* proc) {
+    int lo = 0, hi = process_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (compare_for_sort(sorted_rows[mid], proc, sort_state, sort_state_count) <= 0) lo = mid + 1;
+        else hi = mid;
     }
+    return lo;
+}
 
-    // Проверка на пустую строку после знака
-    if (*str == '\0') return 0;
+// ===== КАРТЫ ЗОН (MIN/MAX ПО БЛОКАМ) =====
 
-    // ВОЗВРАЩАЕМ long long
-    long long int_part = 0;
-    int int_digits = 0;
-    long long frac_part = 0;
-    int frac_digits = 0;
-    int has_decimal_point = 0;
+// Список делится на блоки по ZONE_BLOCK_SIZE подряд идущих процессов. Для каждого блока
+// хранятся min/max числовых полей и времени, что позволяет пропускать блоки при проходе.
+// После удаления границы остаются консервативными (min/max не сужаются).
 
-    // Парсим целую часть
-    while (*str && isdigit((unsigned char)*str)) {
-        // Проверка на переполнение на лету
-        if (int_part > 999) return 0; // Больше 3 цифр
-        int_part = int_part * 10 + (*str - '0');
-        int_digits++;
-        str++;
-    }
+#define ZONE_BLOCK_SIZE 128
 
-    // Проверка: если после цифр идет не точка и не конец строки - ошибка
-    if (*str != '\0' && *str != '.') return 0;
+typedef enum {
+    ZONE_PID,
+    ZONE_PRIORITY,
+    ZONE_CPU_USAGE,
+    ZONE_KERN_TM,
+    ZONE_FILE_TM,
+    ZONE_FIELDS
+} ZoneField;
+
+static const char* zone_field_names[] = {
+    "pid",
+    "priority",
+    "cpu_usage",
+    "kern_tm",
+    "file_tm"
+};
 
-    // Парсим дробную часть, если есть точка
-    if (*str == '.') {
-        has_decimal_point = 1;
-        str++;
-        // Считываем до двух цифр дробной части
-        while (*str && isdigit((unsigned char)*str) && frac_digits < 2) {
-            frac_part = frac_part * 10 + (*str - '0');
-            frac_digits++;
-            str++;
-        }
-        // Если после дробной части есть еще цифры (больше двух) - ошибка
-        if (*str && isdigit((unsigned char)*str)) return 0;
+static int zone_field_id(const char* name) {
+    for (int f = 0; f < ZONE_FIELDS; f++) {
+        if (strcmp(name, zone_field_names[f]) == 0) return f;
     }
+    return -1;
+}
 
-    // Проверяем, что после числа нет мусора
-    while (*str == ' ') str++;
-    if (*str != '\0') return 0;
+typedef struct {
+    Process* first;
+    int count;
+    int min[ZONE_FIELDS];
+    int max[ZONE_FIELDS];
+} ZoneBlock;
+
+static ZoneBlock* zone_blocks = NULL;
+static int zone_block_count = 0;
+static int zone_block_capacity = 0;
+static int zone_maps_valid = 1;      // пустая таблица - пустые карты; дальше они ведутся при вставках
+static int blocks_skipped = 0;
+
+static int time_to_seconds(Time t) {
+    return t.hour * 3600 + t.minute * 60 + t.second;
+}
 
-    // Валидация в соответствии с decimal(3,2)
-    if (int_digits > 3) return 0;
+static void zone_values(Process* proc, int* values) {
+    values[ZONE_PID] = proc->pid;
+    values[ZONE_PRIORITY] = proc->priority;
+    values[ZONE_CPU_USAGE] = proc->cpu_usage;
+    values[ZONE_KERN_TM] = time_to_seconds(proc->kern_tm);
+    values[ZONE_FILE_TM] = time_to_seconds(proc->file_tm);
+}
 
-    // Нормализуем дробную часть до двух цифр
-    if (frac_digits == 1) {
-        frac_part *= 10;
-    }
-    else if (frac_digits == 0) {
-        if (has_decimal_point) {
-            frac_part = 0;
-        }
-        else {
-            frac_part = 0;
-        }
+static void zone_widen(ZoneBlock* block, Process* proc) {
+    int values[ZONE_FIELDS];
+    zone_values(proc, values);
+    for (int f = 0; f < ZONE_FIELDS; f++) {
+        if (block->count == 0 || values[f] < block->min[f]) block->min[f] = values[f];
+        if (block->count == 0 || values[f] > block->max[f]) block->max[f] = values[f];
     }
+}
 
-    // Финальная проверка на диапазон (макс 999.99)
-    if (int_part > 999) return 0;
-    if (int_part == 999 && frac_part > 99) return 0;
+// Память блоков сохраняется для следующего построения
+static void zone_maps_invalidate() {
+    zone_block_count = 0;
+    zone_maps_valid = 0;
+}
 
-    long long value = int_part * 100 + frac_part;
-    value *= sign;
+static ZoneBlock* zone_new_block() {
+    if (zone_block_count == zone_block_capacity) {
+        int new_capacity = zone_block_capacity ? zone_block_capacity * 2 : 16;
+        ZoneBlock* blocks = (ZoneBlock*)my_realloc(zone_blocks, new_capacity * sizeof(ZoneBlock));
+        if (blocks == NULL) return NULL;
+        zone_blocks = blocks;
+        zone_block_capacity = new_capacity;
+    }
+    ZoneBlock* block = &zone_blocks[zone_block_count++];
+    block->first = NULL;
+    block->count = 0;
+    return block;
+}
 
-    // ИСПРАВЛЕНО: используем LL для long long
-    if (value < -2147483647LL - 1 || value > 2147483647LL) return 0;
+// Вызывается после добавления процесса в конец списка
+static void zone_append(Process* proc) {
+    if (!zone_maps_valid) return;
+    ZoneBlock* block = zone_block_count > 0 ? &zone_blocks[zone_block_count - 1] : NULL;
+    if (block == NULL || block->count >= ZONE_BLOCK_SIZE) {
+        block = zone_new_block();
+        if (block == NULL) {
+            zone_maps_invalidate();
+            return;
+        }
+        block->first = proc;
+    }
+    zone_widen(block, proc);
+    block->count++;
+}
 
-    *rez = (int)value;
+// Строит карты зон по списку, если они были сброшены
+static int zone_maps_ensure() {
+    if (zone_maps_valid) return 1;
+    zone_maps_valid = 1;
+    for (Process* curr = head; curr; curr = curr->next) {
+        zone_append(curr);
+        if (!zone_maps_valid) return 0;
+    }
     return 1;
 }
 
-int pars_status(const char* str, Status* status) {
-    if (str == NULL || *str != '\'') return 0;
-    str++;
-    char name[20];
-    int i = 0;
-    while (*str && *str != '\'' && i < 19) {
-        name[i++] = *str;
-        str++;
+// Вызывается до удаления процесса с номером index из списка
+static void zone_remove(int index, Process* proc) {
+    if (!zone_maps_valid) return;
+    int b = 0;
+    while (b < zone_block_count && index >= zone_blocks[b].count) {
+        index -= zone_blocks[b].count;
+        b++;
     }
-    name[i] = '\0';
-    if (*str != '\'') return 0;
-    for (int j = 0; j < 6; j++) {
-        if (strcmp(name, status_names[j]) == 0) {
-            *status = (Status)j;
-            return 1;
-        }
+    if (b == zone_block_count) {
+        zone_maps_invalidate();
+        return;
+    }
+    ZoneBlock* block = &zone_blocks[b];
+    block->count--;
+    if (block->count == 0) {
+        memmove(block, block + 1, (zone_block_count - b - 1) * sizeof(ZoneBlock));
+        zone_block_count--;
+    }
+    else if (block->first == proc) {
+        block->first = proc->next;
     }
-    return 0;
 }
 
-// ===== ВЫВОД =====
+// ===== ШАРДЫ: РАСПРЕДЕЛЕНИЕ СТРОК =====
+
+// В режиме shards N строки делятся по хешу pid на N шардов. Это не разбиение хранения:
+// таблица по-прежнему один список (head, process_count), и вставка, удаление, sort и uniq
+// меняют его в главном потоке. Шард - это массив указателей на свои строки в порядке
+// списка вместе с их позициями; по нему поток шарда параллельно отбирает строки
+// (select, count, delete, update), присваивает значения в update, считает хеши для uniq
+// и сортирует свою часть для sort, а главный поток сливает результаты в порядок списка.
+// Добавление в конец продолжает раскладку, остальные изменения порядка сбрасывают ее,
+// и она перестраивается одним проходом перед следующей командой в режиме шардов.
 
-void print_int(FILE* out, int value) {
-    fprintf(out, "%d", value);
+#define MAX_SHARDS 64
+
+typedef struct {
+    int id;
+    thread_t thread;
+    ThreadStart start;
+    // Строки шарда
+    Process** rows;
+    int* positions;
+    int count;
+    int capacity;
+    // Результаты последнего задания; память шарда переиспользуется между командами
+    Process** matches;
+    int* match_positions;
+    int match_count;
+    SortItem* items;
+    unsigned int* hashes;
+    int result_capacity;
+    int failed;
+} Shard;
+
+static Shard shards[MAX_SHARDS];
+static int shard_count = 0;
+static int shards_valid = 0;
+
+static int shard_of(Process* proc) {
+    return (int)(hash_int(proc->pid) % (unsigned int)shard_count);
 }
 
-void print_str(FILE* out, const char* str) {
-    fprintf(out, "\"");
-    for (const char* p = str; *p; p++) {
-        if (*p == '"' || *p == '\\') fprintf(out, "\\%c", *p);
-        else fprintf(out, "%c", *p);
+static int shard_push(Shard* shard, Process* proc, int position) {
+    if (shard->count == shard->capacity) {
+        int new_capacity = shard->capacity ? shard->capacity * 2 : 64;
+        Process** rows = (Process**)my_realloc(shard->rows, new_capacity * sizeof(Process*));
+        if (rows == NULL) return 0;
+        shard->rows = rows;
+        int* positions = (int*)my_realloc(shard->positions, new_capacity * sizeof(int));
+        if (positions == NULL) return 0;
+        shard->positions = positions;
+        shard->capacity = new_capacity;
     }
-    fprintf(out, "\"");
+    shard->rows[shard->count] = proc;
+    shard->positions[shard->count] = position;
+    shard->count++;
+    return 1;
 }
 
-void print_time(FILE* out, Time t) {
-    fprintf(out, "'%02d:%02d:%02d'", t.hour, t.minute, t.second);
+static void shards_invalidate() {
+    shards_valid = 0;
 }
 
-void print_decimal(FILE* out, int value) {
-    if (value < 0) {
-        fprintf(out, "-");
-        value = -value;
-    }
-    fprintf(out, "%d.%02d", value / 100, value % 100);
+// Вызывается после добавления процесса в конец списка (process_count еще не увеличен)
+static void shards_append(Process* proc) {
+    if (shard_count == 0 || !shards_valid) return;
+    if (!shard_push(&shards[shard_of(proc)], proc, process_count)) shards_valid = 0;
 }
 
-void print_status(FILE* out, Status status) {
-    fprintf(out, "'%s'", status_names[status]);
+static int shards_ensure() {
+    if (shards_valid) return 1;
+    for (int i = 0; i < shard_count; i++) shards[i].count = 0;
+    int position = 0;
+    for (Process* curr = head; curr; curr = curr->next) {
+        if (!shard_push(&shards[shard_of(curr)], curr, position++)) return 0;
+    }
+    shards_valid = 1;
+    return 1;
 }
 
-// ===== СРАВНЕНИЕ =====
+// ===== ШАРДЫ: ПАМЯТЬ СТРОК =====
 
-int compare_int(int a, int b) {
-    if (a < b) return -1;
-    if (a > b) return 1;
-    return 0;
-}
+// В режиме шардов вставка берет запись из пула того шарда, которому достанется строка.
+// Пул задает только размещение в памяти: строки шарда лежат в его собственных блоках,
+// поэтому потоки шардов, которые параллельно меняют строки в update, не делят кэш-линии,
+// а вставка не обращается к malloc на каждую строку. Выделяет и освобождает записи
+// только главный поток, и строка все равно связана в общий список. Запись помнит свой
+// пул и возвращается в него, даже если после update pid или смены числа шардов строка
+// принадлежит другому шарду. Пулы живут дольше потоков шардов; строки от производителей
+// ldb_produce создаются в их потоках и остаются в общей куче.
 
-int compare_str(const char* a, const char* b) {
-    if (a == NULL && b == NULL) return 0;
-    if (a == NULL) return -1;
-    if (b == NULL) return 1;
-    return strcmp(a, b);
-}
+#define ROW_SLAB_ROWS 256
 
-int compare_time(Time a, Time b) {
-    if (a.hour != b.hour) return a.hour < b.hour ? -1 : 1;
-    if (a.minute != b.minute) return a.minute < b.minute ? -1 : 1;
-    if (a.second != b.second) return a.second < b.second ? -1 : 1;
-    return 0;
-}
+typedef struct RowSlab {
+    struct RowSlab* next;
+    Process rows[ROW_SLAB_ROWS];
+} RowSlab;
 
-int compare_decimal(int a, int b) {
-    return compare_int(a, b);
+typedef struct {
+    RowSlab* slabs;
+    Process* free_rows;     // свободные записи, связанные через next
+    int live;               // выданные и еще не возвращенные записи
+} RowPool;
+
+static RowPool row_pools[MAX_SHARDS];
+
+static Process* row_pool_take(int pool) {
+    RowPool* rows = &row_pools[pool];
+    if (rows->free_rows == NULL) {
+        RowSlab* slab = (RowSlab*)my_malloc(sizeof(RowSlab));
+        if (slab == NULL) return NULL;
+        slab->next = rows->slabs;
+        rows->slabs = slab;
+        for (int i = ROW_SLAB_ROWS - 1; i >= 0; i--) {
+            slab->rows[i].next = rows->free_rows;
+            rows->free_rows = &slab->rows[i];
+        }
+    }
+    Process* proc = rows->free_rows;
+    rows->free_rows = proc->next;
+    rows->live++;
+    return proc;
 }
 
-int compare_status(Status a, Status b) {
-    return compare_int(a, b);
+static void row_pool_give(Process* proc) {
+    RowPool* rows = &row_pools[proc->pool - 1];
+    proc->next = rows->free_rows;
+    rows->free_rows = proc;
+    rows->live--;
 }
 
-// ===== РАБОТА СО СПИСКАМИ ЗНАЧЕНИЙ =====
-
-int is_value_in_list(const char* list_str, const char* value) {
-    if (list_str == NULL || *list_str != '[') return 0;
-    const char* p = list_str + 1;
-    while (*p == ' ') p++;
-    if (*p == ']') return 0;
-    while (*p && *p != ']') {
-        while (*p == ' ') p++;
-        if (*p != '\'') { p++; continue; }
-        p++;
-        char item[20] = { 0 };
-        int i = 0;
-        while (*p && *p != '\'' && i < 19) item[i++] = *p++;
-        if (*p != '\'') break;
-        p++;
-        if (strcmp(value, item) == 0) return 1;
-        while (*p == ' ' || *p == ',') p++;
+// Блоки пула возвращаются в кучу, только когда из него не выдано ни одной записи
+static void row_pools_release() {
+    for (int i = 0; i < MAX_SHARDS; i++) {
+        if (row_pools[i].live > 0) continue;
+        while (row_pools[i].slabs) {
+            RowSlab* next = row_pools[i].slabs->next;
+            my_free(row_pools[i].slabs);
+            row_pools[i].slabs = next;
+        }
+        row_pools[i].free_rows = NULL;
     }
-    return 0;
 }
 
-// ===== СТРУКТУРА УСЛОВИЯ =====
+// Копия разобранной строки в постоянной памяти: в режиме шардов - в пуле ее шарда
+static Process* row_store(Process* parsed) {
+    int pool = shard_count > 1 ? shard_of(parsed) : -1;
+    Process* proc = pool >= 0 ? row_pool_take(pool) : (Process*)my_malloc(sizeof(Process));
+    if (proc == NULL) return NULL;
+    *proc = *parsed;
+    proc->pool = (unsigned char)(pool + 1);
+    return proc;
+}
 
-typedef struct Condition {
-    char field_name[50];
-    char oper[10];
-    char value_str[256];
-} Condition;
+// ===== ИНДЕКС ПО ИМЕНИ =====
 
-// ===== ПАРСИНГ УСЛОВИЯ =====
+// Строки таблицы в порядке списка (номер в массиве - позиция в списке) с двумя
+// способами поиска по имени: хеш-таблица для равенства (цепочки позиций с одним
+// бакетом) и массив позиций, упорядоченный по (имя, позиция), для сравнений и префиксов.
+// Добавление в конец ведет индекс сразу: хеш обновляется, а позиция попадает в
+// неотсортированный хвост упорядоченного массива, который вливается в него при
+// следующем поиске по диапазону. Остальные изменения порядка и имен сбрасывают индекс,
+// и он перестраивается в тех же буферах при следующем поиске.
 
-int parse_condition(const char* str, Condition* cond) {
-    if (!str || !cond) return 0;
+typedef struct {
+    Process** rows;
+    unsigned int* hashes;
+    int* chain;         // предыдущая позиция в том же бакете или -1
+    int* order;         // [0, sorted) упорядочены по имени, [sorted, count) - хвост
+    int* order_tmp;
+    int count;
+    int sorted;
+    int capacity;
+    int* buckets;       // последняя позиция бакета или -1
+    int bucket_count;   // степень двойки, не меньше 2 * capacity
+    int valid;
+} NameIndex;
+
+static NameIndex name_index = { NULL, NULL, NULL, NULL, NULL, 0, 0, 0, NULL, 0, 1 };
+
+// FNV-1a
+static unsigned int hash_str(const char* str) {
+    unsigned int h = 2166136261u;
+    for (const unsigned char* p = (const unsigned char*)str; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
 
-    char* temp = (char*)my_malloc(strlen(str) + 1);
-    if (!temp) return 0;
-    strcpy(temp, str);
+static const char* name_index_key(int position) {
+    const char* name = name_text(&name_index.rows[position]->name);
+    return name ? name : "";
+}
 
-    char* op_start = temp;
-    while (*op_start && !strchr("=!<>/", *op_start)) op_start++;
+static void name_index_invalidate() {
+    name_index.valid = 0;
+}
 
-    if (*op_start == '\0') {
-        my_free(temp);
-        return 0;
+static void name_index_clear_buckets() {
+    for (int i = 0; i < name_index.bucket_count; i++) name_index.buckets[i] = -1;
+}
+
+static int name_index_reserve(int capacity) {
+    NameIndex* ix = &name_index;
+    if (capacity <= ix->capacity) return 1;
+    int new_capacity = ix->capacity ? ix->capacity : 64;
+    while (new_capacity < capacity) new_capacity *= 2;
+
+    Process** rows = (Process**)my_realloc(ix->rows, new_capacity * sizeof(Process*));
+    if (rows == NULL) return 0;
+    ix->rows = rows;
+    unsigned int* hashes = (unsigned int*)my_realloc(ix->hashes, new_capacity * sizeof(unsigned int));
+    if (hashes == NULL) return 0;
+    ix->hashes = hashes;
+    int* chain = (int*)my_realloc(ix->chain, new_capacity * sizeof(int));
+    if (chain == NULL) return 0;
+    ix->chain = chain;
+    int* order = (int*)my_realloc(ix->order, new_capacity * sizeof(int));
+    if (order == NULL) return 0;
+    ix->order = order;
+    int* order_tmp = (int*)my_realloc(ix->order_tmp, new_capacity * sizeof(int));
+    if (order_tmp == NULL) return 0;
+    ix->order_tmp = order_tmp;
+    int* buckets = (int*)my_realloc(ix->buckets, 2 * new_capacity * sizeof(int));
+    if (buckets == NULL) return 0;
+    ix->buckets = buckets;
+    ix->capacity = new_capacity;
+
+    // Бакетов стало больше - цепочки раскладываются заново
+    ix->bucket_count = 2 * new_capacity;
+    name_index_clear_buckets();
+    for (int i = 0; i < ix->count; i++) {
+        int b = (int)(ix->hashes[i] & (unsigned int)(ix->bucket_count - 1));
+        ix->chain[i] = ix->buckets[b];
+        ix->buckets[b] = i;
     }
+    return 1;
+}
 
-    // ИСПРАВЛЕНО: явное приведение для предупреждения C4244
-    ptrdiff_t diff = op_start - temp;
-    int field_len = (int)diff;
-    strncpy(cond->field_name, temp, field_len);
-    cond->field_name[field_len] = '\0';
+// Добавляет строку с позицией name_index.count
+static int name_index_push(Process* proc) {
+    NameIndex* ix = &name_index;
+    if (!name_index_reserve(ix->count + 1)) return 0;
+    int position = ix->count++;
+    ix->rows[position] = proc;
+    const char* name = name_text(&proc->name);
+    ix->hashes[position] = hash_str(name ? name : "");
+    int b = (int)(ix->hashes[position] & (unsigned int)(ix->bucket_count - 1));
+    ix->chain[position] = ix->buckets[b];
+    ix->buckets[b] = position;
+    ix->order[position] = position;
+    return 1;
+}
 
-    char* end = cond->field_name + strlen(cond->field_name) - 1;
-    while (end >= cond->field_name && (*end == ' ' || *end == '\t')) *end-- = '\0';
+// Вызывается после добавления процесса в конец списка
+static void name_index_append(Process* proc) {
+    if (!name_index.valid) return;
+    if (!name_index_push(proc)) name_index.valid = 0;
+}
 
-    char* op = op_start;
-    char* val_start = NULL;
+// Пустая таблица: индекс пуст и действителен, буферы сохраняются
+static void name_index_clear() {
+    name_index.count = 0;
+    name_index.sorted = 0;
+    name_index_clear_buckets();
+    name_index.valid = 1;
+}
 
-    if (strncmp(op, "<=", 2) == 0) {
-        strcpy(cond->oper, "<=");
-        val_start = op + 2;
-    }
-    else if (strncmp(op, ">=", 2) == 0) {
-        strcpy(cond->oper, ">=");
-        val_start = op + 2;
-    }
-    else if (strncmp(op, "!=", 2) == 0) {
-        strcpy(cond->oper, "!=");
-        val_start = op + 2;
-    }
-    else if (strncmp(op, "==", 2) == 0) {
-        strcpy(cond->oper, "=");
-        val_start = op + 2;
-    }
-    else if (*op == '/') {
-        op++;
-        char* slash = strchr(op, '/');
-        if (!slash) {
-            my_free(temp);
-            return 0;
-        }
-        *slash = '\0';
-        strcpy(cond->oper, op);
-        val_start = slash + 1;
-    }
-    else {
-        if (*op == '=') {
-            strcpy(cond->oper, "=");
-            val_start = op + 1;
-        }
-        else if (*op == '<') {
-            strcpy(cond->oper, "<");
-            val_start = op + 1;
-        }
-        else if (*op == '>') {
-            strcpy(cond->oper, ">");
-            val_start = op + 1;
-        }
-        else {
-            my_free(temp);
+static int name_index_ensure() {
+    if (name_index.valid) return 1;
+    name_index_clear();
+    for (Process* curr = head; curr; curr = curr->next) {
+        if (!name_index_push(curr)) {
+            name_index.valid = 0;
             return 0;
         }
     }
-
-    while (*val_start == ' ' || *val_start == '\t') val_start++;
-    strcpy(cond->value_str, val_start);
-
-    my_free(temp);
     return 1;
 }
 
-// ===== ПРОВЕРКА УСЛОВИЙ =====
+static void name_index_free() {
+    NameIndex* ix = &name_index;
+    my_free(ix->rows);
+    my_free(ix->hashes);
+    my_free(ix->chain);
+    my_free(ix->order);
+    my_free(ix->order_tmp);
+    my_free(ix->buckets);
+    memset(ix, 0, sizeof(NameIndex));
+    ix->valid = 1;
+}
 
-int check_condition(Process* proc, Condition* cond) {
-    if (!proc || !cond) return 0;
+// ===== ВЕРСИИ ТАБЛИЦЫ И СНИМКИ =====
 
-    if (strcmp(cond->field_name, "pid") == 0) {
-        int val;
-        if (!diapozon_int(cond->value_str, &val)) return 0;
-        int cmp = compare_int(proc->pid, val);
-        if (strcmp(cond->oper, "=") == 0) return cmp == 0;
-        if (strcmp(cond->oper, "!=") == 0) return cmp != 0;
-        if (strcmp(cond->oper, "<") == 0) return cmp < 0;
-        if (strcmp(cond->oper, ">") == 0) return cmp > 0;
-        if (strcmp(cond->oper, "<=") == 0) return cmp <= 0;
-        if (strcmp(cond->oper, ">=") == 0) return cmp >= 0;
-        return 0;
-    }
+// Каждая мутация увеличивает table_version. Читатель закрепляет неизменяемый снимок -
+// массив указателей на строки своей версии. Пока снимки закреплены, писатель не меняет
+// строки на месте (update работает с копией) и не освобождает удаленные строки, а
+// откладывает их до момента, когда не останется снимков, в которых они видны.
+// Список снимков и отложенные строки меняет только основной поток, читатели лишь
+// уменьшают refs.
 
-    if (strcmp(cond->field_name, "name") == 0) {
-        char* val = pars_str(cond->value_str);
-        if (!val) return 0;
-        if (!proc->name) { my_free(val); return 0; }
-        int cmp = compare_str(proc->name, val);
-        my_free(val);
-        if (strcmp(cond->oper, "=") == 0) return cmp == 0;
-        if (strcmp(cond->oper, "!=") == 0) return cmp != 0;
-        if (strcmp(cond->oper, "<") == 0) return cmp < 0;
-        if (strcmp(cond->oper, ">") == 0) return cmp > 0;
-        if (strcmp(cond->oper, "<=") == 0) return cmp <= 0;
-        if (strcmp(cond->oper, ">=") == 0) return cmp >= 0;
-        return 0;
-    }
+typedef struct TableSnapshot {
+    long version;
+    int count;
+    Process** rows;
+    volatile long refs;
+    struct TableSnapshot* next;
+} TableSnapshot;
 
-    if (strcmp(cond->field_name, "priority") == 0) {
-        int val;
-        if (!diapozon_int(cond->value_str, &val)) return 0;
-        int cmp = compare_int(proc->priority, val);
-        if (strcmp(cond->oper, "=") == 0) return cmp == 0;
-        if (strcmp(cond->oper, "!=") == 0) return cmp != 0;
-        if (strcmp(cond->oper, "<") == 0) return cmp < 0;
-        if (strcmp(cond->oper, ">") == 0) return cmp > 0;
-        if (strcmp(cond->oper, "<=") == 0) return cmp <= 0;
-        if (strcmp(cond->oper, ">=") == 0) return cmp >= 0;
-        return 0;
-    }
+typedef struct {
+    Process* proc;
+    long version;       // последняя версия, в которой строка была видна
+} RetiredRow;
+
+static long table_version = 0;
+static long table_rewrites = 0;            // мутации, кроме добавления в конец и переноса строк
+static long table_moves = 0;               // переносы строк между списком и сжатыми блоками
+static TableSnapshot* snapshots = NULL;    // от новых к старым
+static RetiredRow* retired_rows = NULL;
+static int retired_count = 0;
+static int retired_capacity = 0;
+static THREAD_LOCAL TableSnapshot* reader_snapshot = NULL; // снимок, на котором работает текущий поток
+
+static void table_changed() {
+    table_version++;
+    table_rewrites++;
+}
 
-    if (strcmp(cond->field_name, "kern_tm") == 0) {
-        Time val;
-        if (!pars_time(cond->value_str, &val)) return 0;
-        int cmp = compare_time(proc->kern_tm, val);
-        if (strcmp(cond->oper, "=") == 0) return cmp == 0;
-        if (strcmp(cond->oper, "!=") == 0) return cmp != 0;
-        if (strcmp(cond->oper, "<") == 0) return cmp < 0;
-        if (strcmp(cond->oper, ">") == 0) return cmp > 0;
-        if (strcmp(cond->oper, "<=") == 0) return cmp <= 0;
-        if (strcmp(cond->oper, ">=") == 0) return cmp >= 0;
-        return 0;
-    }
+// Строка добавлена в конец: прежние строки и их порядок не изменились
+static void table_extended() {
+    table_version++;
+}
 
-    if (strcmp(cond->field_name, "file_tm") == 0) {
-        Time val;
-        if (!pars_time(cond->value_str, &val)) return 0;
-        int cmp = compare_time(proc->file_tm, val);
-        if (strcmp(cond->oper, "=") == 0) return cmp == 0;
-        if (strcmp(cond->oper, "!=") == 0) return cmp != 0;
-        if (strcmp(cond->oper, "<") == 0) return cmp < 0;
-        if (strcmp(cond->oper, ">") == 0) return cmp > 0;
-        if (strcmp(cond->oper, "<=") == 0) return cmp <= 0;
-        if (strcmp(cond->oper, ">=") == 0) return cmp >= 0;
-        return 0;
+// Строки перенесены между списком и сжатыми блоками: меняется хранение, а не таблица
+static void table_moved() {
+    table_version++;
+    table_moves++;
+}
+
+static TableSnapshot* snapshot_acquire() {
+    if (snapshots != NULL && snapshots->version == table_version) {
+        atomic_add(&snapshots->refs, 1);
+        return snapshots;
     }
 
-    if (strcmp(cond->field_name, "cpu_usage") == 0) {
-        int val;
-        if (!pars_decimal(cond->value_str, &val)) return 0;
-        int cmp = compare_decimal(proc->cpu_usage, val);
-        if (strcmp(cond->oper, "=") == 0) return cmp == 0;
-        if (strcmp(cond->oper, "!=") == 0) return cmp != 0;
-        if (strcmp(cond->oper, "<") == 0) return cmp < 0;
-        if (strcmp(cond->oper, ">") == 0) return cmp > 0;
-        if (strcmp(cond->oper, "<=") == 0) return cmp <= 0;
-        if (strcmp(cond->oper, ">=") == 0) return cmp >= 0;
-        return 0;
+    TableSnapshot* snap = (TableSnapshot*)my_malloc(sizeof(TableSnapshot));
+    if (snap == NULL) return NULL;
+    snap->rows = (Process**)my_malloc((process_count > 0 ? process_count : 1) * sizeof(Process*));
+    if (snap->rows == NULL) {
+        my_free(snap);
+        return NULL;
     }
+    int i = 0;
+    for (Process* curr = head; curr; curr = curr->next) snap->rows[i++] = curr;
+    snap->count = process_count;
+    snap->version = table_version;
+    snap->refs = 1;
+    snap->next = snapshots;
+    snapshots = snap;
+    return snap;
+}
 
-    if (strcmp(cond->field_name, "status") == 0) {
-        if (strcmp(cond->oper, "in") == 0) {
-            return is_value_in_list(cond->value_str, status_names[proc->status]);
+static void snapshot_release(TableSnapshot* snap) {
+    atomic_add(&snap->refs, -1);
+}
+
+// Освобождает незакрепленные снимки и строки, которых не видит ни один оставшийся снимок
+static void reclaim_snapshots() {
+    TableSnapshot** link = &snapshots;
+    long oldest = table_version;
+    while (*link) {
+        TableSnapshot* snap = *link;
+        if (atomic_load(&snap->refs) == 0) {
+            *link = snap->next;
+            my_free(snap->rows);
+            my_free(snap);
         }
-        if (strcmp(cond->oper, "not_in") == 0) {
-            return !is_value_in_list(cond->value_str, status_names[proc->status]);
+        else {
+            if (snap->version < oldest) oldest = snap->version;
+            link = &snap->next;
         }
-        Status val;
-        if (!pars_status(cond->value_str, &val)) return 0;
-        if (strcmp(cond->oper, "=") == 0) return proc->status == val;
-        if (strcmp(cond->oper, "!=") == 0) return proc->status != val;
-        return 0;
     }
 
-    return 0;
+    int kept = 0;
+    for (int i = 0; i < retired_count; i++) {
+        if (snapshots == NULL || retired_rows[i].version < oldest) free_process(retired_rows[i].proc);
+        else retired_rows[kept++] = retired_rows[i];
+    }
+    retired_count = kept;
+    if (retired_count == 0) {
+        my_free(retired_rows);
+        retired_rows = NULL;
+        retired_capacity = 0;
+    }
 }
 
-int check_all_conditions(Process* proc, Condition* conditions, int cond_count) {
+// Строка уже исключена из списка; освобождается сразу или после ухода снимков
+static void retire_process(Process* proc) {
+    if (snapshots == NULL) {
+        free_process(proc);
+        return;
+    }
+    if (retired_count == retired_capacity) {
+        int new_capacity = retired_capacity ? retired_capacity * 2 : 64;
+        RetiredRow* rows = (RetiredRow*)my_realloc(retired_rows, new_capacity * sizeof(RetiredRow));
+        if (rows == NULL) return; // лучше утечка, чем освобождение строки, которую читают
+        retired_rows = rows;
+        retired_capacity = new_capacity;
+    }
+    retired_rows[retired_count].proc = proc;
+    retired_rows[retired_count].version = table_version;
+    retired_count++;
+}
+
+static int table_row_count() {
+    return reader_snapshot ? reader_snapshot->count : process_count + packed_row_count();
+}
+
+// ===== РАБОТА СО СПИСКОМ =====
+
+static Process* creation_process() {
+    Process* new_proc = (Process*)my_malloc(sizeof(Process));
+    if (new_proc == NULL) return NULL;
+    memset(new_proc, 0, sizeof(Process));
+    new_proc->status = RUNNING;
+    return new_proc;
+}
+
+static void free_process(Process* proc) {
+    if (proc == NULL) return;
+    name_clear(&proc->name);
+    if (proc->pool) row_pool_give(proc);
+    else my_free(proc);
+}
+
+static Process* clone_process(Process* proc) {
+    Process* copy = row_store(proc);
+    if (copy == NULL) return NULL;
+    copy->next = NULL;
+    name_copied(&copy->name);
+    return copy;
+}
+
+// tail - известная последняя строка списка (NULL - найти проходом)
+static void append_process_after(Process* tail, Process* new_proc) {
+    if (new_proc == NULL) return;
+    if (sort_state_count > 0) {
+        // Добавление в конец сохраняет порядок, только если новая строка не меньше последней
+        // (при пустом списке - последней из сжатых блоков)
+        if (!sorted_rows_ensure() || !sorted_rows_reserve(process_count + 1) ||
+            (process_count > 0 &&
+                compare_for_sort(sorted_rows[process_count - 1], new_proc, sort_state, sort_state_count) > 0) ||
+            (process_count == 0 && packed_last_row() != NULL &&
+                compare_for_sort(packed_last_row(), new_proc, sort_state, sort_state_count) > 0)) {
+            sort_state_reset();
+        }
+        else {
+            sorted_rows[process_count] = new_proc;
+        }
+    }
+    if (head == NULL) {
+        head = new_proc;
+    }
+    else {
+        Process* current = tail ? tail : head;
+        while (current->next != NULL) current = current->next;
+        current->next = new_proc;
+    }
+    counters_add(new_proc);
+    zone_append(new_proc);
+    shards_append(new_proc);
+    name_index_append(new_proc);
+    bloom_add(new_proc->pid);
+    table_extended();
+    process_count++;
+}
+
+static void append_process(Process* new_proc) {
+    append_process_after(NULL, new_proc);
+}
+
+// Вставка с сохранением текущего порядка сортировки (режим sorted_insert)
+static void add_process(Process* new_proc) {
+    if (new_proc == NULL) return;
+    if (!sorted_insert_mode || sort_state_count == 0 || !sorted_rows_ensure() ||
+        !sorted_rows_reserve(process_count + 1)) {
+        append_process(new_proc);
+        return;
+    }
+
+    int pos = sorted_upper_bound(new_proc);
+    if (pos == 0) {
+        new_proc->next = head;
+        head = new_proc;
+    }
+    else {
+        new_proc->next = sorted_rows[pos - 1]->next;
+        sorted_rows[pos - 1]->next = new_proc;
+    }
+    memmove(sorted_rows + pos + 1, sorted_rows + pos, (process_count - pos) * sizeof(Process*));
+    sorted_rows[pos] = new_proc;
+    counters_add(new_proc);
+    bloom_add(new_proc->pid);
+    // Границы блоков сдвигаются - карты зон и шарды перестроятся при следующем проходе
+    zone_maps_invalidate();
+    shards_invalidate();
+    name_index_invalidate();
+    table_changed();
+    process_count++;
+}
+
+static Process* get_process_index(int index) {
+    if (index < 0 || index >= process_count || head == NULL) return NULL;
+    Process* current = head;
+    for (int i = 0; i < index; i++) current = current->next;
+    return current;
+}
+
+static int delete_process(int index) {
+    if (index < 0 || index >= process_count || head == NULL) return 0;
+    Process* to_delete = NULL;
+    if (index == 0) {
+        to_delete = head;
+        head = head->next;
+    }
+    else {
+        Process* prev = head;
+        for (int i = 0; i < index - 1; i++) prev = prev->next;
+        to_delete = prev->next;
+        prev->next = to_delete->next;
+    }
+    zone_remove(index, to_delete);
+    counters_remove(to_delete);
+    bloom_forget(1);
+    sorted_rows_valid = 0;
+    shards_invalidate();
+    name_index_invalidate();
+    retire_process(to_delete);
+    table_changed();
+    process_count--;
+    return 1;
+}
+
+static void clear_allproc() {
+    while (head != NULL) {
+        Process* temp = head;
+        head = head->next;
+        retire_process(temp);
+    }
+    table_changed();
+    counters_clear();
+    zone_maps_invalidate();
+    shards_invalidate();
+    name_index_clear();
+    bloom_clear();
+    // Пустая таблица упорядочена по любым ключам, поэтому sort_state сохраняется
+    sorted_rows_valid = 0;
+    process_count = 0;
+}
+
+// ===== СЖАТОЕ ХРАНЕНИЕ =====
+
+// В режиме compress on строки таблицы, кроме последних (меньше PACK_BLOCK_ROWS), хранятся
+// сжатыми блоками по PACK_BLOCK_ROWS строк. Каждая колонка блока записана как смещения от
+// минимума блока (frame of reference) минимальным числом бит; время - в секундах, имя -
+// номером в словаре имен. Логически таблица - это строки блоков, за которыми идет список.
+// Счетчики статусов и приоритетов описывают всю таблицу; карты зон, шарды, индекс по имени
+// и sorted_rows - только список. select без order_by и count просматривают блоки напрямую,
+// delete и update переписывают их по одному блоку (packed_rewrite). Остальные команды
+// (uniq, sort, aggregate, analyze, export, import, select с order_by, подготовленные select)
+// сначала разворачивают блоки обратно в список (packed_expand); с буферным пулом это
+// разрешено, только если развернутые строки помещаются в его бюджет.
+
+#define PACK_BLOCK_ROWS 1024
+
+// Первые колонки совпадают с полями карт зон: min/max блока - это его ZoneBlock
+typedef enum {
+    PACK_PID = ZONE_PID,
+    PACK_PRIORITY = ZONE_PRIORITY,
+    PACK_CPU_USAGE = ZONE_CPU_USAGE,
+    PACK_KERN_TM = ZONE_KERN_TM,
+    PACK_FILE_TM = ZONE_FILE_TM,
+    PACK_STATUS = ZONE_FIELDS,
+    PACK_NAME,
+    PACK_COLUMNS
+} PackColumn;
+
+typedef struct {
+    int count;
+    ZoneBlock zone;                     // first не используется
+    int base[PACK_COLUMNS];             // минимум колонки в блоке
+    unsigned char bits[PACK_COLUMNS];   // ширина смещения в битах (0 - все значения равны)
+    int offset[PACK_COLUMNS];           // начало колонки в words, в битах
+    unsigned int* words;                // NULL - блок вытеснен в файл подкачки
+    int word_count;
+    long long file_offset;              // место в файле подкачки, -1 - только в памяти
+    unsigned char referenced;           // бит обращения для CLOCK
+} PackedBlock;
+
+// Словарь имен сжатых строк; номер 0 - строка без имени
+typedef struct {
+    char** names;       // разделяемые строки (name_new)
+    int count;
+    int capacity;
+    int* buckets;       // номер + 1, 0 - пусто
+    int bucket_count;
+} NameDict;
+
+typedef struct {
+    PackedBlock* blocks;
+    int block_count;
+    int block_capacity;
+    int rows;
+    NameDict dict;
+    Process last;       // копия последней сжатой строки (имя - ссылка в словарь)
+} PackedTable;
+
+static PackedTable packed_table = { 0 };
+static int compress_mode = 0;
+
+static int packed_row_count() {
+    return packed_table.rows;
+}
+
+// Последняя строка блоков - для проверки порядка при добавлении в пустой список
+static Process* packed_last_row() {
+    return packed_table.rows > 0 ? &packed_table.last : NULL;
+}
+
+// Буферный пул (ниже): слова блока читаются только после packed_load
+static int packed_load(PackedBlock* block);
+static void pool_file_reset();
+static void pool_block_added(PackedBlock* block);
+static void pool_block_replaced(PackedBlock* block, const PackedBlock* fresh);
+static void pool_block_removed(PackedBlock* block);
+
+// --- упаковка битов ---
+
+static void pack_put(unsigned int* words, long pos, unsigned int value, int bits) {
+    long w = pos >> 5;
+    int s = (int)(pos & 31);
+    words[w] |= value << s;
+    if (s + bits > 32) words[w + 1] |= value >> (32 - s);
+}
+
+static unsigned int pack_get(const unsigned int* words, long pos, int bits) {
+    long w = pos >> 5;
+    int s = (int)(pos & 31);
+    unsigned long long v = words[w] >> s;
+    if (s + bits > 32) v |= (unsigned long long)words[w + 1] << (32 - s);
+    return bits == 32 ? (unsigned int)v : (unsigned int)v & ((1u << bits) - 1);
+}
+
+static int pack_width(unsigned int range) {
+    int bits = 0;
+    while (bits < 32 && (range >> bits) != 0) bits++;
+    return bits;
+}
+
+// --- словарь имен ---
+
+// Номер имени в словаре (добавляет новое); -1 - не хватило памяти
+static int name_dict_id(NameDict* dict, const char* name) {
+    if (name == NULL) return 0;
+    if (dict->count == 0) {
+        // Номер 0 занят строкой без имени
+        dict->names = (char**)my_malloc(64 * sizeof(char*));
+        if (dict->names == NULL) return -1;
+        dict->names[0] = NULL;
+        dict->count = 1;
+        dict->capacity = 64;
+    }
+    if ((dict->count + 1) * 2 > dict->bucket_count) {
+        int new_count = dict->bucket_count ? dict->bucket_count * 2 : 128;
+        int* buckets = (int*)my_calloc(new_count, sizeof(int));
+        if (buckets == NULL) return -1;
+        for (int id = 1; id < dict->count; id++) {
+            unsigned int b = hash_str(dict->names[id]) & (new_count - 1);
+            while (buckets[b] != 0) b = (b + 1) & (new_count - 1);
+            buckets[b] = id + 1;
+        }
+        my_free(dict->buckets);
+        dict->buckets = buckets;
+        dict->bucket_count = new_count;
+    }
+
+    unsigned int b = hash_str(name) & (dict->bucket_count - 1);
+    while (dict->buckets[b] != 0) {
+        int id = dict->buckets[b] - 1;
+        if (strcmp(dict->names[id], name) == 0) return id;
+        b = (b + 1) & (dict->bucket_count - 1);
+    }
+
+    if (dict->count == dict->capacity) {
+        char** names = (char**)my_realloc(dict->names, dict->capacity * 2 * sizeof(char*));
+        if (names == NULL) return -1;
+        dict->names = names;
+        dict->capacity *= 2;
+    }
+    char* copy = name_new(name, strlen(name));
+    if (copy == NULL) return -1;
+    dict->names[dict->count] = copy;
+    dict->buckets[b] = dict->count + 1;
+    return dict->count++;
+}
+
+static void name_dict_clear(NameDict* dict) {
+    for (int id = 1; id < dict->count; id++) name_release(dict->names[id]);
+    my_free(dict->names);
+    my_free(dict->buckets);
+    memset(dict, 0, sizeof(NameDict));
+}
+
+// --- блоки ---
+
+static void packed_values(Process* proc, int name_id, int* values) {
+    zone_values(proc, values);
+    values[PACK_STATUS] = (int)proc->status;
+    values[PACK_NAME] = name_id;
+}
+
+// Строка с именем-ссылкой в словарь: живет, пока живут блоки
+static void packed_set_column(Process* proc, int column, int value) {
+    switch (column) {
+    case PACK_PID: proc->pid = value; break;
+    case PACK_PRIORITY: proc->priority = value; break;
+    case PACK_CPU_USAGE: proc->cpu_usage = value; break;
+    case PACK_KERN_TM:
+    case PACK_FILE_TM: {
+        Time t;
+        t.hour = (unsigned short)(value / 3600);
+        t.minute = (unsigned short)(value / 60 % 60);
+        t.second = (unsigned short)(value % 60);
+        if (column == PACK_KERN_TM) proc->kern_tm = t;
+        else proc->file_tm = t;
+        break;
+    }
+    case PACK_STATUS: proc->status = (Status)value; break;
+    default:
+        proc->name.data.heap = packed_table.dict.names[value];
+        proc->name.kind = value == 0 ? NAME_NONE : NAME_REF;
+        break;
+    }
+}
+
+static int packed_get(const PackedBlock* block, int column, int row) {
+    if (block->bits[column] == 0) return block->base[column];
+    unsigned int delta = pack_get(block->words, block->offset[column] + (long)row * block->bits[column],
+        block->bits[column]);
+    return (int)((unsigned int)block->base[column] + delta);
+}
+
+// Разжимает колонку column строк [0, count) блока в rows
+static void packed_decode_column(const PackedBlock* block, int column, Process* rows) {
+    for (int i = 0; i < block->count; i++) packed_set_column(&rows[i], column, packed_get(block, column, i));
+}
+
+// Сжимает count строк цепочки next, начиная с first, в block (без места в пуле);
+// 0 - не хватило памяти
+static int packed_encode(PackedBlock* block, Process* first, int count) {
+    PackedTable* table = &packed_table;
+    int* values = (int*)scratch_alloc((size_t)count * PACK_COLUMNS * sizeof(int));
+    if (values == NULL) return 0;
+    int mn[PACK_COLUMNS], mx[PACK_COLUMNS];
+    Process* curr = first;
+    for (int i = 0; i < count; i++, curr = curr->next) {
+        int name_id = name_dict_id(&table->dict, name_text(&curr->name));
+        if (name_id < 0) return 0;
+        int* row = values + (size_t)i * PACK_COLUMNS;
+        packed_values(curr, name_id, row);
+        for (int c = 0; c < PACK_COLUMNS; c++) {
+            if (i == 0 || row[c] < mn[c]) mn[c] = row[c];
+            if (i == 0 || row[c] > mx[c]) mx[c] = row[c];
+        }
+    }
+
+    long total_bits = 0;
+    for (int c = 0; c < PACK_COLUMNS; c++) {
+        block->base[c] = mn[c];
+        block->bits[c] = (unsigned char)pack_width((unsigned int)mx[c] - (unsigned int)mn[c]);
+        block->offset[c] = (int)total_bits;
+        total_bits += (long)count * block->bits[c];
+    }
+    block->word_count = (int)(total_bits / 32 + 1);
+    block->words = (unsigned int*)my_calloc(block->word_count, sizeof(unsigned int));
+    if (block->words == NULL) return 0;
+    for (int i = 0; i < count; i++) {
+        int* row = values + (size_t)i * PACK_COLUMNS;
+        for (int c = 0; c < PACK_COLUMNS; c++) {
+            if (block->bits[c] == 0) continue;
+            pack_put(block->words, block->offset[c] + (long)i * block->bits[c],
+                (unsigned int)row[c] - (unsigned int)mn[c], block->bits[c]);
+        }
+    }
+    block->count = count;
+    block->zone.first = NULL;
+    block->zone.count = count;
+    for (int f = 0; f < ZONE_FIELDS; f++) {
+        block->zone.min[f] = mn[f];
+        block->zone.max[f] = mx[f];
+    }
+    return 1;
+}
+
+// Сжимает первые count строк списка в новый блок; 0 - не хватило памяти
+static int packed_add_block(Process* first, int count) {
+    PackedTable* table = &packed_table;
+    if (table->block_count == table->block_capacity) {
+        int new_capacity = table->block_capacity ? table->block_capacity * 2 : 16;
+        PackedBlock* blocks = (PackedBlock*)my_realloc(table->blocks, new_capacity * sizeof(PackedBlock));
+        if (blocks == NULL) return 0;
+        table->blocks = blocks;
+        table->block_capacity = new_capacity;
+    }
+
+    PackedBlock* block = &table->blocks[table->block_count];
+    if (!packed_encode(block, first, count)) return 0;
+    table->block_count++;
+    table->rows += count;
+    pool_block_added(block);
+    return 1;
+}
+
+// Копия последней строки блоков для append_process; 0 - блок не удалось прочитать
+static int packed_set_last() {
+    if (packed_table.block_count == 0) return 1;
+    PackedBlock* block = &packed_table.blocks[packed_table.block_count - 1];
+    if (!packed_load(block)) return 0;
+    for (int c = 0; c < PACK_COLUMNS; c++) packed_set_column(&packed_table.last, c, packed_get(block, c, block->count - 1));
+    packed_table.last.next = NULL;
+    return 1;
+}
+
+// Границы и позиции списка сдвигаются: все, что построено по списку, перестраивается
+static void packed_list_changed() {
+    zone_maps_invalidate();
+    shards_invalidate();
+    name_index_invalidate();
+    sorted_rows_valid = 0;
+    table_moved();
+}
+
+// Переносит полные блоки строк из начала списка в сжатые блоки
+static void packed_compact() {
+    int moved = 0;
+    while (process_count >= PACK_BLOCK_ROWS) {
+        ScratchMark mark = scratch_mark();
+        int added = packed_add_block(head, PACK_BLOCK_ROWS);
+        scratch_reset(mark);
+        if (!added) break;
+
+        // Новый блок только что записан и еще в памяти
+        packed_set_last();
+
+        for (int i = 0; i < PACK_BLOCK_ROWS; i++) {
+            Process* row = head;
+            head = head->next;
+            retire_process(row);
+        }
+        process_count -= PACK_BLOCK_ROWS;
+        moved = 1;
+    }
+    if (moved) packed_list_changed();
+}
+
+static void packed_clear() {
+    for (int b = packed_table.block_count - 1; b >= 0; b--) pool_block_removed(&packed_table.blocks[b]);
+    my_free(packed_table.blocks);
+    name_dict_clear(&packed_table.dict);
+    memset(&packed_table, 0, sizeof(PackedTable));
+    pool_file_reset();
+}
+
+// Разворачивает блоки обратно в начало списка, с последнего блока к первому.
+// 0 - не хватило памяти (оставшиеся блоки по-прежнему предшествуют списку)
+static int packed_expand() {
+    if (packed_table.block_count == 0) return 1;
+    int ok = 1;
+    while (packed_table.block_count > 0) {
+        PackedBlock* block = &packed_table.blocks[packed_table.block_count - 1];
+        if (!packed_load(block)) {
+            ok = 0;
+            break;
+        }
+        Process* first = NULL;
+        Process* last = NULL;
+        for (int i = 0; i < block->count && ok; i++) {
+            Process* proc = creation_process();
+            if (proc == NULL) {
+                ok = 0;
+                break;
+            }
+            for (int c = 0; c < PACK_NAME; c++) packed_set_column(proc, c, packed_get(block, c, i));
+            char* name = packed_table.dict.names[packed_get(block, PACK_NAME, i)];
+            if (name != NULL) name_assign_shared(&proc->name, name, strlen(name));
+            if (last) last->next = proc;
+            else first = proc;
+            last = proc;
+        }
+        if (!ok) {
+            while (first) {
+                Process* next = first->next;
+                free_process(first);
+                first = next;
+            }
+            break;
+        }
+        last->next = head;
+        head = first;
+        process_count += block->count;
+        packed_table.rows -= block->count;
+        pool_block_removed(block);
+        packed_table.block_count--;
+    }
+    if (packed_table.block_count == 0) packed_clear();
+    packed_list_changed();
+    return ok;
+}
+
+// ===== БУФЕРНЫЙ ПУЛ СЖАТЫХ БЛОКОВ =====
+
+// Командой pool <КБ> сжатые блоки выносятся в файл подкачки, а в памяти остаются только
+// недавно использованные, суммарно не больше заданного объема. Блок не меняется после
+// записи, поэтому вытеснение просто освобождает его память; delete и update не меняют блок,
+// а заменяют его новым (pool_block_replaced). Замещение - CLOCK: стрелка снимает бит
+// обращения и вытесняет блок, к которому с прошлого прохода не обращались.
+
+typedef struct {
+    FILE* file;             // NULL - пул выключен, блоки целиком в памяти
+    long long file_end;
+    long long budget;       // байт
+    long long resident;     // байт блоков в памяти
+    int hand;
+} BufferPool;
+
+static BufferPool buffer_pool = { 0 };
+static long pool_hits = 0;
+static long pool_misses = 0;
+static long pool_evictions = 0;
+
+static long long packed_block_bytes(PackedBlock* block) {
+    return (long long)block->word_count * sizeof(unsigned int);
+}
+
+// Вытесняет блоки, пока объем в памяти больше бюджета; keep не вытесняется
+static void pool_evict(PackedBlock* keep) {
+    int steps = 2 * packed_table.block_count + 1;
+    while (buffer_pool.resident > buffer_pool.budget && steps-- > 0) {
+        if (buffer_pool.hand >= packed_table.block_count) buffer_pool.hand = 0;
+        PackedBlock* block = &packed_table.blocks[buffer_pool.hand++];
+        if (block == keep || block->words == NULL || block->file_offset < 0) continue;
+        if (block->referenced) {
+            block->referenced = 0;
+            continue;
+        }
+        my_free(block->words);
+        block->words = NULL;
+        buffer_pool.resident -= packed_block_bytes(block);
+        pool_evictions++;
+    }
+}
+
+// Записывает блок в файл подкачки с позиции offset; 0 - ошибка записи (блок остается в памяти)
+static int pool_write_at(PackedBlock* block, long long offset) {
+    if (file_seek(buffer_pool.file, offset, SEEK_SET) != 0 ||
+        fwrite(block->words, sizeof(unsigned int), block->word_count, buffer_pool.file) != (size_t)block->word_count) {
+        return 0;
+    }
+    block->file_offset = offset;
+    return 1;
+}
+
+// Записывает блок в конец файла подкачки
+static int pool_write(PackedBlock* block) {
+    if (!pool_write_at(block, buffer_pool.file_end)) return 0;
+    buffer_pool.file_end += packed_block_bytes(block);
+    return 1;
+}
+
+// Делает слова блока доступными; 0 - не хватило памяти или ошибка чтения
+static int packed_load(PackedBlock* block) {
+    if (block->words != NULL) {
+        if (buffer_pool.file) pool_hits++;
+        block->referenced = 1;
+        return 1;
+    }
+    pool_misses++;
+    block->words = (unsigned int*)my_malloc(packed_block_bytes(block));
+    if (block->words == NULL) return 0;
+    if (file_seek(buffer_pool.file, block->file_offset, SEEK_SET) != 0 ||
+        fread(block->words, sizeof(unsigned int), block->word_count, buffer_pool.file) != (size_t)block->word_count) {
+        my_free(block->words);
+        block->words = NULL;
+        return 0;
+    }
+    buffer_pool.resident += packed_block_bytes(block);
+    block->referenced = 1;
+    pool_evict(block);
+    return 1;
+}
+
+// Новый блок (последний в packed_table) сразу пишется в файл
+static void pool_block_added(PackedBlock* block) {
+    block->file_offset = -1;
+    block->referenced = 1;
+    if (buffer_pool.file == NULL) return;
+    buffer_pool.resident += packed_block_bytes(block);
+    if (pool_write(block)) pool_evict(block);
+}
+
+// Блок, сжатый заново после delete/update, пишется на прежнее место в файле, если
+// помещается в него, иначе в конец файла
+static void pool_block_replaced(PackedBlock* block, const PackedBlock* fresh) {
+    long long slot = block->file_offset;
+    long long slot_bytes = packed_block_bytes(block);
+    if (block->words != NULL) {
+        my_free(block->words);
+        if (buffer_pool.file) buffer_pool.resident -= slot_bytes;
+    }
+    *block = *fresh;
+    block->file_offset = -1;
+    block->referenced = 1;
+    if (buffer_pool.file == NULL) return;
+    buffer_pool.resident += packed_block_bytes(block);
+    int written = slot >= 0 && packed_block_bytes(block) <= slot_bytes ? pool_write_at(block, slot) : pool_write(block);
+    if (written) pool_evict(block);
+}
+
+// Место блока в файле освобождается, только если блок лежит в конце файла: блоки
+// снимаются с конца таблицы, но переписанный блок мог уйти в конец файла
+static void pool_block_removed(PackedBlock* block) {
+    if (block->words != NULL) {
+        my_free(block->words);
+        block->words = NULL;
+        if (buffer_pool.file) buffer_pool.resident -= packed_block_bytes(block);
+    }
+    if (block->file_offset >= 0 && block->file_offset + packed_block_bytes(block) == buffer_pool.file_end) {
+        buffer_pool.file_end = block->file_offset;
+    }
+}
+
+// Блоков не осталось: файл подкачки снова пишется с начала
+static void pool_file_reset() {
+    buffer_pool.file_end = 0;
+    buffer_pool.resident = 0;
+    buffer_pool.hand = 0;
+}
+
+// Включает пул или меняет бюджет; 0 - не удалось создать файл подкачки
+static int pool_start(long long budget) {
+    buffer_pool.budget = budget;
+    if (buffer_pool.file == NULL) {
+        buffer_pool.file = tmpfile();
+        if (buffer_pool.file == NULL) return 0;
+        buffer_pool.file_end = 0;
+        buffer_pool.resident = 0;
+        buffer_pool.hand = 0;
+        for (int b = 0; b < packed_table.block_count; b++) {
+            PackedBlock* block = &packed_table.blocks[b];
+            buffer_pool.resident += packed_block_bytes(block);
+            pool_write(block);
+        }
+    }
+    pool_evict(NULL);
+    return 1;
+}
+
+// Возвращает все блоки в память и закрывает файл; 0 - блоки не удалось прочитать
+static int pool_stop() {
+    if (buffer_pool.file == NULL) return 1;
+    long long budget = buffer_pool.budget;
+    buffer_pool.budget = LLONG_MAX;
+    for (int b = 0; b < packed_table.block_count; b++) {
+        if (!packed_load(&packed_table.blocks[b])) {
+            buffer_pool.budget = budget;
+            return 0;
+        }
+    }
+    for (int b = 0; b < packed_table.block_count; b++) packed_table.blocks[b].file_offset = -1;
+    fclose(buffer_pool.file);
+    memset(&buffer_pool, 0, sizeof(BufferPool));
+    return 1;
+}
+
+// packed_expand для команд, которым нужен список. С пулом развернутые строки должны
+// поместиться в его бюджет, иначе команда отвергается, а не обходит пул
+static int packed_expand_in_budget() {
+    if (buffer_pool.file != NULL && (long long)packed_table.rows * (long long)sizeof(Process) > buffer_pool.budget) {
+        return 0;
+    }
+    return packed_expand();
+}
+
+// ===== ВЫВОД ОШИБОК =====
+
+static void print_incorrect(FILE* output, const char* command) {
+    fprintf(output, "incorrect:'");
+    int count = 0;
+    while (command[count] != '\0' && count < 20) {
+        fprintf(output, "%c", command[count]);
+        count++;
+    }
+    fprintf(output, "'\n");
+}
+
+// ===== ПАРСИНГ =====
+
+// Функции разбора работают с отрезком [str, end), чтобы лексер insert мог разбирать
+// значения прямо в строке команды, не копируя их; обычные версии - обертки над ними
+
+static int diapozon_int_span(const char* p, const char* end, int* rez) {
+    int sign = 1;
+    long long val = 0;
+
+    // Определяем знак
+    if (p < end && *p == '-') {
+        sign = -1;
+        p++;
+    }
+    if (p == end) return 0;
+
+    // Парсим цифры
+    for (; p < end; p++) {
+        if (!isdigit((unsigned char)*p)) return 0;
+        // Проверяем переполнение
+        if (val > 2147483647LL) return 0;
+        val = val * 10 + (*p - '0');
+    }
+
+    val *= sign;
+
+    // Проверяем диапазон int
+    if (val < -2147483647LL - 1 || val > 2147483647LL) return 0;
+
+    *rez = (int)val;
+    return 1;
+}
+
+static int diapozon_int(const char* str, int* rez) {
+    if (str == NULL) return 0;
+    return diapozon_int_span(str, str + strlen(str), rez);
+}
+
+// Разбирает строку в кавычках в rez (не длиннее str); 0 - это не строка
+static int pars_str_into(const char* str, char* rez) {
+    if (str == NULL || *str != '"') return 0;
+
+    str++;
+    int i = 0;
+    while (*str) {
+        if (*str == '\\') {
+            str++;
+            if (*str == '"' || *str == '\\') {
+                rez[i++] = *str;
+                str++;
+            }
+            else {
+                // \ в самом конце строки остается как есть, дальше конца не читаем
+                rez[i++] = '\\';
+                if (*str) rez[i++] = *str++;
+            }
+        }
+        else if (*str == '"') {
+            str++;
+            break;
+        }
+        else {
+            rez[i++] = *str;
+            str++;
+        }
+    }
+
+    rez[i] = '\0';
+    return 1;
+}
+
+static char* pars_str(const char* str) {
+    if (str == NULL || *str != '"') return NULL;
+    char* rez = (char*)my_malloc(strlen(str));
+    if (rez == NULL) return NULL;
+    pars_str_into(str, rez);
+    return rez;
+}
+
+// Как pars_str, но результат - разделяемое имя (освобождается name_release)
+static char* pars_name(const char* str) {
+    if (str == NULL || *str != '"') return NULL;
+    ScratchMark mark = scratch_mark();
+    char* text = (char*)scratch_alloc(strlen(str));
+    char* name = NULL;
+    if (text != NULL) {
+        pars_str_into(str, text);
+        name = name_new(text, strlen(text));
+    }
+    scratch_reset(mark);
+    return name;
+}
+
+// Число как его читает %d в sscanf: пробелы, знак, хотя бы одна цифра. Переполнение
+// как у прежнего sscanf: насыщение в long long и усечение до int
+static int pars_time_part(const char** str, const char* end, int* rez) {
+    const char* p = *str;
+    while (p < end && isspace((unsigned char)*p)) p++;
+    int negative = 0;
+    if (p < end && (*p == '+' || *p == '-')) {
+        negative = *p == '-';
+        p++;
+    }
+    if (p == end || !isdigit((unsigned char)*p)) return 0;
+    unsigned long long val = 0;
+    const unsigned long long limit = negative ? (unsigned long long)LLONG_MAX + 1 : (unsigned long long)LLONG_MAX;
+    while (p < end && isdigit((unsigned char)*p)) {
+        unsigned int digit = (unsigned int)(*p - '0');
+        val = val > (limit - digit) / 10 ? limit : val * 10 + digit;
+        p++;
+    }
+    if (negative) val = 0 - val;
+    *rez = (int)(unsigned int)val;
+    *str = p;
+    return 1;
+}
+
+// 'ЧЧ:ММ:СС' - те же правила, что у прежнего sscanf("%d:%d:%d"), без его накладных расходов
+static int pars_time_span(const char* str, const char* end, Time* t) {
+    if (str == end || *str != '\'') return 0;
+    str++;
+    const char* p = str;
+    int h, m, s;
+    if (!pars_time_part(&p, end, &h) || p == end || *p++ != ':' ||
+        !pars_time_part(&p, end, &m) || p == end || *p++ != ':' ||
+        !pars_time_part(&p, end, &s)) {
+        return 0;
+    }
+    if (h < 0 || h > 23 || m < 0 || m > 59 || s < 0 || s > 59) return 0;
+    if (memchr(str, '\'', end - str) == NULL) return 0;
+    t->hour = h;
+    t->minute = m;
+    t->second = s;
+    return 1;
+}
+
+static int pars_time(const char* str, Time* t) {
+    if (str == NULL) return 0;
+    return pars_time_span(str, str + strlen(str), t);
+}
+
+// ИСПРАВЛЕНО: заменяем long long на long для VS2010
+static int pars_decimal_span(const char* str, const char* end, int* rez) {
+    // Пропускаем начальные пробелы
+    while (str < end && *str == ' ') str++;
+
+    int sign = 1;
+    if (str < end && *str == '-') {
+        sign = -1;
+        str++;
+    }
+
+    // Проверка на пустую строку после знака
+    if (str == end) return 0;
+
+    // ВОЗВРАЩАЕМ long long
+    long long int_part = 0;
+    int int_digits = 0;
+    long long frac_part = 0;
+    int frac_digits = 0;
+    int has_decimal_point = 0;
+
+    // Парсим целую часть
+    while (str < end && isdigit((unsigned char)*str)) {
+        // Проверка на переполнение на лету
+        if (int_part > 999) return 0; // Больше 3 цифр
+        int_part = int_part * 10 + (*str - '0');
+        int_digits++;
+        str++;
+    }
+
+    // Проверка: если после цифр идет не точка и не конец строки - ошибка
+    if (str < end && *str != '.') return 0;
+
+    // Парсим дробную часть, если есть точка
+    if (str < end && *str == '.') {
+        has_decimal_point = 1;
+        str++;
+        // Считываем до двух цифр дробной части
+        while (str < end && isdigit((unsigned char)*str) && frac_digits < 2) {
+            frac_part = frac_part * 10 + (*str - '0');
+            frac_digits++;
+            str++;
+        }
+        // Если после дробной части есть еще цифры (больше двух) - ошибка
+        if (str < end && isdigit((unsigned char)*str)) return 0;
+    }
+
+    // Проверяем, что после числа нет мусора
+    while (str < end && *str == ' ') str++;
+    if (str != end) return 0;
+
+    // Валидация в соответствии с decimal(3,2)
+    if (int_digits > 3) return 0;
+
+    // Нормализуем дробную часть до двух цифр
+    if (frac_digits == 1) {
+        frac_part *= 10;
+    }
+    else if (frac_digits == 0) {
+        if (has_decimal_point) {
+            frac_part = 0;
+        }
+        else {
+            frac_part = 0;
+        }
+    }
+
+    // Финальная проверка на диапазон (макс 999.99)
+    if (int_part > 999) return 0;
+    if (int_part == 999 && frac_part > 99) return 0;
+
+    long long value = int_part * 100 + frac_part;
+    value *= sign;
+
+    // ИСПРАВЛЕНО: используем LL для long long
+    if (value < -2147483647LL - 1 || value > 2147483647LL) return 0;
+
+    *rez = (int)value;
+    return 1;
+}
+
+static int pars_decimal(const char* str, int* rez) {
+    if (str == NULL || rez == NULL) return 0;
+    return pars_decimal_span(str, str + strlen(str), rez);
+}
+
+static int pars_status_span(const char* str, const char* end, Status* status) {
+    if (str == end || *str != '\'') return 0;
+    str++;
+    char name[20];
+    int i = 0;
+    while (str < end && *str != '\'' && i < 19) {
+        name[i++] = *str;
+        str++;
+    }
+    name[i] = '\0';
+    if (str == end || *str != '\'') return 0;
+    for (int j = 0; j < 6; j++) {
+        if (strcmp(name, status_names[j]) == 0) {
+            *status = (Status)j;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int pars_status(const char* str, Status* status) {
+    if (str == NULL) return 0;
+    return pars_status_span(str, str + strlen(str), status);
+}
+
+// ===== ВЫВОД =====
+
+// Строки результата собираются в буфере команды и пишутся в файл крупными кусками.
+// Перед выводом через fprintf в тот же файл буфер нужно сбросить (out_flush)
+
+#define OUT_BUFFER_SIZE 65536
+
+typedef struct {
+    FILE* file;
+    size_t len;
+    char data[OUT_BUFFER_SIZE];
+} OutBuffer;
+
+// Буфер в памяти команды; NULL - не хватило памяти
+static OutBuffer* out_begin(FILE* file) {
+    OutBuffer* out = (OutBuffer*)scratch_alloc(sizeof(OutBuffer));
+    if (out == NULL) return NULL;
+    out->file = file;
+    out->len = 0;
+    return out;
+}
+
+static void out_flush(OutBuffer* out) {
+    if (out->len > 0) fwrite(out->data, 1, out->len, out->file);
+    out->len = 0;
+}
+
+// Гарантирует место под n байт (n не больше размера буфера)
+static char* out_reserve(OutBuffer* out, size_t n) {
+    if (out->len + n > OUT_BUFFER_SIZE) out_flush(out);
+    return out->data + out->len;
+}
+
+static void out_write(OutBuffer* out, const char* data, size_t n) {
+    if (n > OUT_BUFFER_SIZE / 2) {
+        out_flush(out);
+        fwrite(data, 1, n, out->file);
+        return;
+    }
+    memcpy(out_reserve(out, n), data, n);
+    out->len += n;
+}
+
+static void out_char(OutBuffer* out, char c) {
+    *out_reserve(out, 1) = c;
+    out->len++;
+}
+
+static void out_int(OutBuffer* out, int value) {
+    char digits[12];
+    int n = 0;
+    unsigned int u = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    do {
+        digits[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u > 0);
+    char* p = out_reserve(out, n + 1);
+    if (value < 0) *p++ = '-';
+    while (n > 0) *p++ = digits[--n];
+    out->len = p - out->data;
+}
+
+static void out_two_digits(char* p, int value) {
+    p[0] = (char)('0' + value / 10 % 10);
+    p[1] = (char)('0' + value % 10);
+}
+
+static void out_time(OutBuffer* out, Time t) {
+    char* p = out_reserve(out, 10);
+    p[0] = '\'';
+    out_two_digits(p + 1, t.hour);
+    p[3] = ':';
+    out_two_digits(p + 4, t.minute);
+    p[6] = ':';
+    out_two_digits(p + 7, t.second);
+    p[9] = '\'';
+    out->len += 10;
+}
+
+static void out_decimal(OutBuffer* out, int value) {
+    if (value < 0) {
+        out_char(out, '-');
+        value = -value;
+    }
+    out_int(out, value / 100);
+    char* p = out_reserve(out, 3);
+    p[0] = '.';
+    out_two_digits(p + 1, value % 100);
+    out->len += 3;
+}
+
+static void out_status(OutBuffer* out, Status status) {
+    out_char(out, '\'');
+    out_write(out, status_names[status], strlen(status_names[status]));
+    out_char(out, '\'');
+}
+
+// Строка в кавычках с экранированием " и обратной косой черты
+static void out_str(OutBuffer* out, const char* str) {
+    out_char(out, '"');
+    const char* run = str;
+    for (const char* p = str; *p; p++) {
+        if (*p != '"' && *p != '\\') continue;
+        out_write(out, run, p - run);
+        char* e = out_reserve(out, 2);
+        e[0] = '\\';
+        e[1] = *p;
+        out->len += 2;
+        run = p + 1;
+    }
+    out_write(out, run, strlen(run));
+    out_char(out, '"');
+}
+
+static void print_time(FILE* out, Time t) {
+    fprintf(out, "'%02d:%02d:%02d'", t.hour, t.minute, t.second);
+}
+
+// ===== СРАВНЕНИЕ =====
+
+static int compare_int(int a, int b) {
+    if (a < b) return -1;
+    if (a > b) return 1;
+    return 0;
+}
+
+static int compare_str(const char* a, const char* b) {
+    if (a == NULL && b == NULL) return 0;
+    if (a == NULL) return -1;
+    if (b == NULL) return 1;
+    return strcmp(a, b);
+}
+
+static int compare_names(const ProcessName* a, const ProcessName* b) {
+    // Два коротких имени сравниваются без перехода по указателям
+    if (a->kind == NAME_INLINE && b->kind == NAME_INLINE) return strcmp(a->data.text, b->data.text);
+    return compare_str(name_text(a), name_text(b));
+}
+
+static int compare_time(Time a, Time b) {
+    if (a.hour != b.hour) return a.hour < b.hour ? -1 : 1;
+    if (a.minute != b.minute) return a.minute < b.minute ? -1 : 1;
+    if (a.second != b.second) return a.second < b.second ? -1 : 1;
+    return 0;
+}
+
+static int compare_decimal(int a, int b) {
+    return compare_int(a, b);
+}
+
+static int compare_status(Status a, Status b) {
+    return compare_int(a, b);
+}
+
+// ===== РАБОТА СО СПИСКАМИ ЗНАЧЕНИЙ =====
+
+// Список условия /in/ и /not_in/ разбирается один раз в множество значений поля.
+// Числа, время (в секундах) и статус хранятся как int, имена - как строки.
+// Короткий список - упорядоченный массив с бинарным поиском, длинный - хеш-таблица
+// с открытой адресацией. Элементы, которые не разбираются как значение поля,
+// не совпадают ни с одной строкой.
+
+#define VALUE_SET_SMALL 8
+
+typedef struct {
+    int is_str;
+    int count;              // различных значений
+    int slot_count;         // 0 - короткий список в [0, count)
+    int* ints;
+    char** strs;
+    unsigned char* used;    // занятые слоты хеш-таблицы
+} ValueSet;
+
+// Значение поля строки в виде ключа множества
+static int field_key(Process* proc, const char* field) {
+    if (strcmp(field, "pid") == 0) return proc->pid;
+    if (strcmp(field, "priority") == 0) return proc->priority;
+    if (strcmp(field, "cpu_usage") == 0) return proc->cpu_usage;
+    if (strcmp(field, "kern_tm") == 0) return time_to_seconds(proc->kern_tm);
+    if (strcmp(field, "file_tm") == 0) return time_to_seconds(proc->file_tm);
+    return (int)proc->status;
+}
+
+static int field_key_parse(const char* field, const char* text, int* key) {
+    if (strcmp(field, "pid") == 0 || strcmp(field, "priority") == 0) return diapozon_int(text, key);
+    if (strcmp(field, "cpu_usage") == 0) return pars_decimal(text, key);
+    if (strcmp(field, "kern_tm") == 0 || strcmp(field, "file_tm") == 0) {
+        Time t;
+        if (!pars_time(text, &t)) return 0;
+        *key = time_to_seconds(t);
+        return 1;
+    }
+    Status status;
+    if (!pars_status(text, &status)) return 0;
+    *key = (int)status;
+    return 1;
+}
+
+static int value_set_has_int(const ValueSet* set, int key) {
+    if (set->slot_count == 0) {
+        int lo = 0, hi = set->count;
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (set->ints[mid] == key) return 1;
+            if (set->ints[mid] < key) lo = mid + 1;
+            else hi = mid;
+        }
+        return 0;
+    }
+    unsigned int mask = (unsigned int)set->slot_count - 1;
+    for (unsigned int s = hash_int(key) & mask; set->used[s]; s = (s + 1) & mask) {
+        if (set->ints[s] == key) return 1;
+    }
+    return 0;
+}
+
+static int value_set_has_str(const ValueSet* set, const char* key) {
+    if (set->slot_count == 0) {
+        int lo = 0, hi = set->count;
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            int cmp = strcmp(set->strs[mid], key);
+            if (cmp == 0) return 1;
+            if (cmp < 0) lo = mid + 1;
+            else hi = mid;
+        }
+        return 0;
+    }
+    unsigned int mask = (unsigned int)set->slot_count - 1;
+    for (unsigned int s = hash_str(key) & mask; set->used[s]; s = (s + 1) & mask) {
+        if (strcmp(set->strs[s], key) == 0) return 1;
+    }
+    return 0;
+}
+
+// Значение с номером i для перебора: 0 - слот пуст
+static int value_set_slot(const ValueSet* set, int i) {
+    return set->slot_count == 0 ? i < set->count : set->used[i];
+}
+
+static int value_set_slots(const ValueSet* set) {
+    return set->slot_count == 0 ? set->count : set->slot_count;
+}
+
+// Добавляет значение; повторы пропускаются
+static void value_set_add(ValueSet* set, int key, char* str) {
+    if (set->slot_count == 0) {
+        // Вставка с сохранением порядка
+        int pos = set->count;
+        while (pos > 0) {
+            int cmp = set->is_str ? strcmp(set->strs[pos - 1], str) : compare_int(set->ints[pos - 1], key);
+            if (cmp == 0) return;
+            if (cmp < 0) break;
+            pos--;
+        }
+        for (int i = set->count; i > pos; i--) {
+            if (set->is_str) set->strs[i] = set->strs[i - 1];
+            else set->ints[i] = set->ints[i - 1];
+        }
+        if (set->is_str) set->strs[pos] = str;
+        else set->ints[pos] = key;
+        set->count++;
+        return;
+    }
+    if (set->is_str ? value_set_has_str(set, str) : value_set_has_int(set, key)) return;
+    unsigned int mask = (unsigned int)set->slot_count - 1;
+    unsigned int s = (set->is_str ? hash_str(str) : hash_int(key)) & mask;
+    while (set->used[s]) s = (s + 1) & mask;
+    set->used[s] = 1;
+    if (set->is_str) set->strs[s] = str;
+    else set->ints[s] = key;
+    set->count++;
+}
+
+// Конец элемента списка, начинающегося в p
+static const char* list_item_end(const char* p) {
+    if (*p == '"') {
+        p++;
+        while (*p && *p != '"') {
+            if (*p == '\\' && p[1]) p++;
+            p++;
+        }
+        return *p ? p + 1 : p;
+    }
+    if (*p == '\'') {
+        p++;
+        while (*p && *p != '\'') p++;
+        return *p ? p + 1 : p;
+    }
+    while (*p && *p != ',' && *p != ']' && *p != ' ') p++;
+    return p;
+}
+
+// Разбирает список [v1,v2,...] значений поля field в памяти команды. Строка, не
+// начинающаяся с '[', дает пустое множество. NULL - не хватило памяти
+static ValueSet* value_set_parse(const char* field, const char* list) {
+    ValueSet* set = (ValueSet*)scratch_alloc(sizeof(ValueSet));
+    if (set == NULL) return NULL;
+    memset(set, 0, sizeof(ValueSet));
+    set->is_str = strcmp(field, "name") == 0;
+    if (*list != '[') return set;
+
+    int max_items = 1;
+    for (const char* c = list; *c; c++) {
+        if (*c == ',' || *c == ' ') max_items++;
+    }
+    if (max_items > VALUE_SET_SMALL) {
+        set->slot_count = 16;
+        while (set->slot_count < 2 * max_items) set->slot_count *= 2;
+        set->used = (unsigned char*)scratch_alloc(set->slot_count);
+        if (set->used == NULL) return NULL;
+        memset(set->used, 0, set->slot_count);
+    }
+    int slots = set->slot_count ? set->slot_count : VALUE_SET_SMALL;
+    if (set->is_str) set->strs = (char**)scratch_alloc(slots * sizeof(char*));
+    else set->ints = (int*)scratch_alloc(slots * sizeof(int));
+    if (set->strs == NULL && set->ints == NULL) return NULL;
+
+    const char* p = list + 1;
+    while (*p && *p != ']') {
+        while (*p == ' ' || *p == ',') p++;
+        if (*p == '\0' || *p == ']') break;
+        const char* end = list_item_end(p);
+        size_t len = (size_t)(end - p);
+        char* item = (char*)scratch_alloc(len + 1);
+        if (item == NULL) return NULL;
+        memcpy(item, p, len);
+        item[len] = '\0';
+        p = end;
+
+        int key = 0;
+        if (set->is_str) {
+            if (pars_str_into(item, item)) value_set_add(set, 0, item);
+        }
+        else if (field_key_parse(field, item, &key)) value_set_add(set, key, NULL);
+    }
+    return set;
+}
+
+// Копия множества одним блоком my_malloc (для подготовленных запросов)
+static ValueSet* value_set_persist(const ValueSet* set) {
+    int slots = value_set_slots(set);
+    size_t size = sizeof(ValueSet) + slots * (sizeof(int) + sizeof(char*) + 1);
+    for (int i = 0; i < slots && set->is_str; i++) {
+        if (value_set_slot(set, i)) size += strlen(set->strs[i]) + 1;
+    }
+    char* block = (char*)my_malloc(size);
+    if (block == NULL) return NULL;
+    ValueSet* copy = (ValueSet*)block;
+    *copy = *set;
+    char** strs = (char**)(copy + 1);
+    int* ints = (int*)(strs + slots);
+    unsigned char* used = (unsigned char*)(ints + slots);
+    char* text = (char*)(used + slots);
+    copy->strs = set->is_str ? strs : NULL;
+    copy->ints = set->is_str ? NULL : ints;
+    copy->used = set->slot_count ? used : NULL;
+    if (set->slot_count) memcpy(used, set->used, slots);
+    for (int i = 0; i < slots; i++) {
+        if (!value_set_slot(set, i)) continue;
+        if (!set->is_str) {
+            ints[i] = set->ints[i];
+            continue;
+        }
+        strcpy(text, set->strs[i]);
+        strs[i] = text;
+        text += strlen(text) + 1;
+    }
+    return copy;
+}
+
+// ===== СТРУКТУРА УСЛОВИЯ =====
+
+typedef struct Condition {
+    char field_name[50];
+    char oper[10];
+    char value_str[256];
+    // Значение, разобранное один раз (typed = 0 - сравнение разбирает value_str само)
+    int typed;
+    int int_value;      // pid, priority, cpu_usage, status
+    Time time_value;    // kern_tm, file_tm
+    char str_value[256];
+    ValueSet* set;      // список /in/ и /not_in/
+} Condition;
+
+static int is_set_oper(const char* oper) {
+    return strcmp(oper, "in") == 0 || strcmp(oper, "not_in") == 0;
+}
+
+static int is_compare_oper(const char* oper) {
+    return strcmp(oper, "=") == 0 || strcmp(oper, "!=") == 0 || strcmp(oper, "<") == 0 ||
+        strcmp(oper, ">") == 0 || strcmp(oper, "<=") == 0 || strcmp(oper, ">=") == 0;
+}
+
+// Разбирает value_str в типизированное значение, чтобы не делать этого на каждой строке
+static void condition_prepare_value(Condition* cond) {
+    const char* field = cond->field_name;
+    cond->typed = 0;
+    if (cond->set != NULL) {
+        cond->typed = 1;
+        return;
+    }
+    if (strcmp(field, "name") == 0 && strcmp(cond->oper, "prefix") == 0) {
+        cond->typed = pars_str_into(cond->value_str, cond->str_value);
+        return;
+    }
+    if (!is_compare_oper(cond->oper)) return;
+    if (strcmp(field, "pid") == 0 || strcmp(field, "priority") == 0) {
+        cond->typed = diapozon_int(cond->value_str, &cond->int_value);
+    }
+    else if (strcmp(field, "cpu_usage") == 0) {
+        cond->typed = pars_decimal(cond->value_str, &cond->int_value);
+    }
+    else if (strcmp(field, "kern_tm") == 0 || strcmp(field, "file_tm") == 0) {
+        cond->typed = pars_time(cond->value_str, &cond->time_value);
+    }
+    else if (strcmp(field, "status") == 0) {
+        if (strcmp(cond->oper, "=") != 0 && strcmp(cond->oper, "!=") != 0) return;
+        Status status;
+        cond->typed = pars_status(cond->value_str, &status);
+        cond->int_value = (int)status;
+    }
+    else if (strcmp(field, "name") == 0) {
+        cond->typed = pars_str_into(cond->value_str, cond->str_value);
+    }
+}
+
+// ===== ПАРСИНГ УСЛОВИЯ =====
+
+static int parse_condition(const char* str, Condition* cond) {
+    if (!str || !cond) return 0;
+
+    char* temp = (char*)scratch_alloc(strlen(str) + 1);
+    if (!temp) return 0;
+    strcpy(temp, str);
+    cond->set = NULL;
+
+    char* op_start = temp;
+    while (*op_start && !strchr("=!<>/", *op_start)) op_start++;
+
+    if (*op_start == '\0') {
+        return 0;
+    }
+
+    // ИСПРАВЛЕНО: явное приведение для предупреждения C4244
+    ptrdiff_t diff = op_start - temp;
+    int field_len = (int)diff;
+    strncpy(cond->field_name, temp, field_len);
+    cond->field_name[field_len] = '\0';
+
+    char* end = cond->field_name + strlen(cond->field_name) - 1;
+    while (end >= cond->field_name && (*end == ' ' || *end == '\t')) *end-- = '\0';
+
+    char* op = op_start;
+    char* val_start = NULL;
+
+    if (strncmp(op, "<=", 2) == 0) {
+        strcpy(cond->oper, "<=");
+        val_start = op + 2;
+    }
+    else if (strncmp(op, ">=", 2) == 0) {
+        strcpy(cond->oper, ">=");
+        val_start = op + 2;
+    }
+    else if (strncmp(op, "!=", 2) == 0) {
+        strcpy(cond->oper, "!=");
+        val_start = op + 2;
+    }
+    else if (strncmp(op, "==", 2) == 0) {
+        strcpy(cond->oper, "=");
+        val_start = op + 2;
+    }
+    else if (*op == '/') {
+        op++;
+        char* slash = strchr(op, '/');
+        if (!slash) {
+            return 0;
+        }
+        *slash = '\0';
+        strcpy(cond->oper, op);
+        val_start = slash + 1;
+    }
+    else {
+        if (*op == '=') {
+            strcpy(cond->oper, "=");
+            val_start = op + 1;
+        }
+        else if (*op == '<') {
+            strcpy(cond->oper, "<");
+            val_start = op + 1;
+        }
+        else if (*op == '>') {
+            strcpy(cond->oper, ">");
+            val_start = op + 1;
+        }
+        else {
+            return 0;
+        }
+    }
+
+    while (*val_start == ' ' || *val_start == '\t') val_start++;
+    if (is_set_oper(cond->oper) && is_known_field(cond->field_name)) {
+        // Список любой длины разбирается сразу; в value_str остается только его начало
+        cond->set = value_set_parse(cond->field_name, val_start);
+        if (!cond->set) return 0;
+        strncpy(cond->value_str, val_start, sizeof(cond->value_str) - 1);
+        cond->value_str[sizeof(cond->value_str) - 1] = '\0';
+    }
+    else {
+        if (strlen(val_start) >= sizeof(cond->value_str)) return 0;
+        strcpy(cond->value_str, val_start);
+    }
+    condition_prepare_value(cond);
+
+    return 1;
+}
+
+// ===== ПРОВЕРКА УСЛОВИЙ =====
+
+static int oper_matches(const char* oper, int cmp) {
+    if (strcmp(oper, "=") == 0) return cmp == 0;
+    if (strcmp(oper, "!=") == 0) return cmp != 0;
+    if (strcmp(oper, "<") == 0) return cmp < 0;
+    if (strcmp(oper, ">") == 0) return cmp > 0;
+    if (strcmp(oper, "<=") == 0) return cmp <= 0;
+    if (strcmp(oper, ">=") == 0) return cmp >= 0;
+    return 0;
+}
+
+// Сравнение с заранее разобранным значением
+static int check_typed_condition(Process* proc, Condition* cond) {
+    const char* field = cond->field_name;
+    if (cond->set) {
+        int found;
+        if (cond->set->is_str) {
+            const char* name = name_text(&proc->name);
+            found = value_set_has_str(cond->set, name ? name : "");
+        }
+        else found = value_set_has_int(cond->set, field_key(proc, field));
+        return strcmp(cond->oper, "in") == 0 ? found : !found;
+    }
+    int cmp;
+    if (strcmp(field, "pid") == 0) cmp = compare_int(proc->pid, cond->int_value);
+    else if (strcmp(field, "priority") == 0) cmp = compare_int(proc->priority, cond->int_value);
+    else if (strcmp(field, "cpu_usage") == 0) cmp = compare_decimal(proc->cpu_usage, cond->int_value);
+    else if (strcmp(field, "kern_tm") == 0) cmp = compare_time(proc->kern_tm, cond->time_value);
+    else if (strcmp(field, "file_tm") == 0) cmp = compare_time(proc->file_tm, cond->time_value);
+    else if (strcmp(field, "status") == 0) cmp = (int)proc->status == cond->int_value ? 0 : 1;
+    else if (strcmp(field, "name") == 0) {
+        const char* name = name_text(&proc->name);
+        if (!name) return 0;
+        if (strcmp(cond->oper, "prefix") == 0) return strncmp(name, cond->str_value, strlen(cond->str_value)) == 0;
+        cmp = compare_str(name, cond->str_value);
+    }
+    else return 0;
+    return oper_matches(cond->oper, cmp);
+}
+
+static int check_condition(Process* proc, Condition* cond) {
+    if (!proc || !cond) return 0;
+    if (cond->typed) return check_typed_condition(proc, cond);
+
+    if (strcmp(cond->field_name, "pid") == 0) {
+        int val;
+        if (!diapozon_int(cond->value_str, &val)) return 0;
+        int cmp = compare_int(proc->pid, val);
+        if (strcmp(cond->oper, "=") == 0) return cmp == 0;
+        if (strcmp(cond->oper, "!=") == 0) return cmp != 0;
+        if (strcmp(cond->oper, "<") == 0) return cmp < 0;
+        if (strcmp(cond->oper, ">") == 0) return cmp > 0;
+        if (strcmp(cond->oper, "<=") == 0) return cmp <= 0;
+        if (strcmp(cond->oper, ">=") == 0) return cmp >= 0;
+        return 0;
+    }
+
+    if (strcmp(cond->field_name, "name") == 0) {
+        char* val = pars_str(cond->value_str);
+        if (!val) return 0;
+        const char* name = name_text(&proc->name);
+        if (!name) { my_free(val); return 0; }
+        int cmp = compare_str(name, val);
+        my_free(val);
+        if (strcmp(cond->oper, "=") == 0) return cmp == 0;
+        if (strcmp(cond->oper, "!=") == 0) return cmp != 0;
+        if (strcmp(cond->oper, "<") == 0) return cmp < 0;
+        if (strcmp(cond->oper, ">") == 0) return cmp > 0;
+        if (strcmp(cond->oper, "<=") == 0) return cmp <= 0;
+        if (strcmp(cond->oper, ">=") == 0) return cmp >= 0;
+        return 0;
+    }
+
+    if (strcmp(cond->field_name, "priority") == 0) {
+        int val;
+        if (!diapozon_int(cond->value_str, &val)) return 0;
+        int cmp = compare_int(proc->priority, val);
+        if (strcmp(cond->oper, "=") == 0) return cmp == 0;
+        if (strcmp(cond->oper, "!=") == 0) return cmp != 0;
+        if (strcmp(cond->oper, "<") == 0) return cmp < 0;
+        if (strcmp(cond->oper, ">") == 0) return cmp > 0;
+        if (strcmp(cond->oper, "<=") == 0) return cmp <= 0;
+        if (strcmp(cond->oper, ">=") == 0) return cmp >= 0;
+        return 0;
+    }
+
+    if (strcmp(cond->field_name, "kern_tm") == 0) {
+        Time val;
+        if (!pars_time(cond->value_str, &val)) return 0;
+        int cmp = compare_time(proc->kern_tm, val);
+        if (strcmp(cond->oper, "=") == 0) return cmp == 0;
+        if (strcmp(cond->oper, "!=") == 0) return cmp != 0;
+        if (strcmp(cond->oper, "<") == 0) return cmp < 0;
+        if (strcmp(cond->oper, ">") == 0) return cmp > 0;
+        if (strcmp(cond->oper, "<=") == 0) return cmp <= 0;
+        if (strcmp(cond->oper, ">=") == 0) return cmp >= 0;
+        return 0;
+    }
+
+    if (strcmp(cond->field_name, "file_tm") == 0) {
+        Time val;
+        if (!pars_time(cond->value_str, &val)) return 0;
+        int cmp = compare_time(proc->file_tm, val);
+        if (strcmp(cond->oper, "=") == 0) return cmp == 0;
+        if (strcmp(cond->oper, "!=") == 0) return cmp != 0;
+        if (strcmp(cond->oper, "<") == 0) return cmp < 0;
+        if (strcmp(cond->oper, ">") == 0) return cmp > 0;
+        if (strcmp(cond->oper, "<=") == 0) return cmp <= 0;
+        if (strcmp(cond->oper, ">=") == 0) return cmp >= 0;
+        return 0;
+    }
+
+    if (strcmp(cond->field_name, "cpu_usage") == 0) {
+        int val;
+        if (!pars_decimal(cond->value_str, &val)) return 0;
+        int cmp = compare_decimal(proc->cpu_usage, val);
+        if (strcmp(cond->oper, "=") == 0) return cmp == 0;
+        if (strcmp(cond->oper, "!=") == 0) return cmp != 0;
+        if (strcmp(cond->oper, "<") == 0) return cmp < 0;
+        if (strcmp(cond->oper, ">") == 0) return cmp > 0;
+        if (strcmp(cond->oper, "<=") == 0) return cmp <= 0;
+        if (strcmp(cond->oper, ">=") == 0) return cmp >= 0;
+        return 0;
+    }
+
+    if (strcmp(cond->field_name, "status") == 0) {
+        Status val;
+        if (!pars_status(cond->value_str, &val)) return 0;
+        if (strcmp(cond->oper, "=") == 0) return proc->status == val;
+        if (strcmp(cond->oper, "!=") == 0) return proc->status != val;
+        return 0;
+    }
+
+    return 0;
+}
+
+static int check_all_conditions(Process* proc, Condition* conditions, int cond_count) {
     if (!conditions || cond_count == 0) return 1;
     for (int i = 0; i < cond_count; i++) {
-        if (!check_condition(proc, &conditions[i])) return 0;
+        if (!check_condition(proc, &conditions[i])) return 0;
+    }
+    return 1;
+}
+
+// ===== ФИЛЬТР БЛУМА ПО PID =====
+
+// Блочный фильтр Блума по pid всех строк таблицы (вместе со сжатыми блоками): все биты
+// ключа лежат в одном блоке из 64 байт. Условие pid=X с отсутствующим в фильтре ключом
+// не может подойти ни одной строке, и select/count/update/delete отвечают без прохода.
+// Удаления и изменения pid из фильтра не вычеркиваются, а копятся в removed; когда они
+// составляют половину ключей или ключей больше расчетного, фильтр строится заново
+// при следующей проверке.
+
+#define BLOOM_BLOCK_WORDS 16    // 512 бит
+#define BLOOM_BITS_PER_KEY 10
+#define BLOOM_PROBES 6
+
+typedef struct {
+    unsigned int* words;
+    int block_count;    // степень двойки
+    int capacity;       // ключей, на которые рассчитан размер
+    int keys;           // добавлено с последнего построения
+    int removed;        // строк удалено или изменено с последнего построения
+    long long ones;     // установленных бит
+    int valid;
+} BloomFilter;
+
+static BloomFilter pid_bloom = { NULL, 0, 0, 0, 0, 0, 0 };
+static long bloom_checks = 0;
+static long bloom_skips = 0;
+static double bloom_fpr = 0;   // оценка доли ложных срабатываний при последней проверке
+
+static unsigned long long bloom_mix(unsigned long long x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// Блок ключа и BLOOM_PROBES номеров бит в нем (по 9 бит хеша на номер)
+static unsigned int* bloom_block(BloomFilter* bloom, int pid, unsigned long long* probes) {
+    unsigned long long h = bloom_mix((unsigned long long)(unsigned int)pid);
+    *probes = bloom_mix(h + 0x9e3779b97f4a7c15ULL);
+    return bloom->words + (size_t)((unsigned int)(h >> 32) & (bloom->block_count - 1)) * BLOOM_BLOCK_WORDS;
+}
+
+static void bloom_insert(BloomFilter* bloom, int pid) {
+    unsigned long long probes;
+    unsigned int* block = bloom_block(bloom, pid, &probes);
+    for (int i = 0; i < BLOOM_PROBES; i++, probes >>= 9) {
+        unsigned int bit = (unsigned int)(probes & 511);
+        unsigned int mask = 1u << (bit & 31);
+        if (!(block[bit >> 5] & mask)) bloom->ones++;
+        block[bit >> 5] |= mask;
+    }
+}
+
+static int bloom_may_contain(BloomFilter* bloom, int pid) {
+    unsigned long long probes;
+    unsigned int* block = bloom_block(bloom, pid, &probes);
+    for (int i = 0; i < BLOOM_PROBES; i++, probes >>= 9) {
+        unsigned int bit = (unsigned int)(probes & 511);
+        if (!(block[bit >> 5] & (1u << (bit & 31)))) return 0;
+    }
+    return 1;
+}
+
+// Вызывается при появлении строки с этим pid (вставка, update pid)
+static void bloom_add(int pid) {
+    if (!pid_bloom.valid) return;
+    if (pid_bloom.keys >= pid_bloom.capacity) {
+        pid_bloom.valid = 0;
+        return;
+    }
+    bloom_insert(&pid_bloom, pid);
+    pid_bloom.keys++;
+}
+
+// rows строк удалено или сменило pid
+static void bloom_forget(int rows) {
+    pid_bloom.removed += rows;
+}
+
+static void bloom_clear() {
+    pid_bloom.valid = 0;
+}
+
+// Строит фильтр по списку и сжатым блокам; 0 - не хватило памяти
+static int bloom_ensure() {
+    BloomFilter* bloom = &pid_bloom;
+    if (bloom->valid && bloom->removed * 2 <= bloom->keys) return 1;
+
+    int rows = process_count + packed_row_count();
+    int capacity = rows < 512 ? 1024 : rows * 2;
+    int block_count = 1;
+    while ((long long)block_count * BLOOM_BLOCK_WORDS * 32 < (long long)capacity * BLOOM_BITS_PER_KEY) block_count *= 2;
+    if (block_count != bloom->block_count) {
+        unsigned int* words = (unsigned int*)my_malloc((size_t)block_count * BLOOM_BLOCK_WORDS * sizeof(unsigned int));
+        if (words == NULL) return 0;
+        my_free(bloom->words);
+        bloom->words = words;
+        bloom->block_count = block_count;
+    }
+    memset(bloom->words, 0, (size_t)block_count * BLOOM_BLOCK_WORDS * sizeof(unsigned int));
+    bloom->capacity = capacity;
+    bloom->ones = 0;
+    bloom->valid = 0;
+
+    for (int b = 0; b < packed_table.block_count; b++) {
+        PackedBlock* block = &packed_table.blocks[b];
+        if (!packed_load(block)) return 0;
+        for (int i = 0; i < block->count; i++) bloom_insert(bloom, packed_get(block, PACK_PID, i));
+    }
+    for (Process* curr = head; curr; curr = curr->next) bloom_insert(bloom, curr->pid);
+    bloom->keys = rows;
+    bloom->removed = 0;
+    bloom->valid = 1;
+    return 1;
+}
+
+static void bloom_free() {
+    my_free(pid_bloom.words);
+    memset(&pid_bloom, 0, sizeof(BloomFilter));
+}
+
+// 1 - среди условий есть pid=X, а X заведомо нет в таблице
+static int bloom_excludes(Condition* conditions, int cond_count) {
+    // Снимок читателя может содержать уже удаленные pid
+    if (reader_snapshot) return 0;
+    for (int i = 0; i < cond_count; i++) {
+        Condition* cond = &conditions[i];
+        if (!cond->typed || cond->set || strcmp(cond->field_name, "pid") != 0 || strcmp(cond->oper, "=") != 0) continue;
+        if (!bloom_ensure()) return 0;
+        bloom_checks++;
+        double fill = (double)pid_bloom.ones / ((double)pid_bloom.block_count * BLOOM_BLOCK_WORDS * 32);
+        bloom_fpr = 1;
+        for (int k = 0; k < BLOOM_PROBES; k++) bloom_fpr *= fill;
+        if (!bloom_may_contain(&pid_bloom, cond->int_value)) {
+            bloom_skips++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// ===== ДИАПАЗОН ПО ОТСОРТИРОВАННОЙ ТАБЛИЦЕ =====
+
+// Разбирает значение условия в поле probe. 0 - значение некорректно.
+static int fill_probe(Process* probe, Condition* cond) {
+    const char* field = cond->field_name;
+    if (strcmp(field, "pid") == 0) return diapozon_int(cond->value_str, &probe->pid);
+    if (strcmp(field, "name") == 0) {
+        // Строка уже разобрана в условии
+        if (!cond->typed) return 0;
+        probe->name.data.heap = cond->str_value;
+        probe->name.kind = NAME_REF;
+        return 1;
+    }
+    if (strcmp(field, "priority") == 0) return diapozon_int(cond->value_str, &probe->priority);
+    if (strcmp(field, "kern_tm") == 0) return pars_time(cond->value_str, &probe->kern_tm);
+    if (strcmp(field, "file_tm") == 0) return pars_time(cond->value_str, &probe->file_tm);
+    if (strcmp(field, "cpu_usage") == 0) return pars_decimal(cond->value_str, &probe->cpu_usage);
+    if (strcmp(field, "status") == 0) return pars_status(cond->value_str, &probe->status);
+    return 0;
+}
+
+// Первая позиция, где ключ (с учетом asc/desc) >= probe (strict = 0) или > probe (strict = 1)
+static int sorted_bound(Process* probe, SortField* key, int strict) {
+    int lo = 0, hi = process_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        int cmp = compare_for_sort(sorted_rows[mid], probe, key, 1);
+        if (cmp < 0 || (strict && cmp == 0)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Если таблица отсортирована и среди условий есть сравнения с ведущим ключом,
+// сужает проход до строк [*from, *to) бинарным поиском и возвращает первую из них.
+// Остальные условия по-прежнему проверяются для каждой строки отрезка.
+static Process* sorted_range(Condition* conditions, int cond_count, int* from_out, int* to_out) {
+    *from_out = 0;
+    *to_out = process_count;
+    if (cond_count == 0 || sort_state_count == 0) return head;
+
+    SortField* key = &sort_state[0];
+    int from = 0, to = process_count, narrowed = 0;
+    for (int i = 0; i < cond_count; i++) {
+        Condition* cond = &conditions[i];
+        const char* op = cond->oper;
+        if (strcmp(cond->field_name, key->field_name) != 0) continue;
+        if (strcmp(op, "=") != 0 && strcmp(op, "<") != 0 && strcmp(op, "<=") != 0 &&
+            strcmp(op, ">") != 0 && strcmp(op, ">=") != 0) continue;
+        if (strcmp(cond->field_name, "status") == 0 && strcmp(op, "=") != 0) continue;
+        if (!narrowed && !sorted_rows_ensure()) return head;
+
+        Process probe;
+        memset(&probe, 0, sizeof(Process));
+        if (!fill_probe(&probe, cond)) continue;
+        int lower = sorted_bound(&probe, key, 0);
+        int upper = sorted_bound(&probe, key, 1);
+
+        // При desc "меньше" по значению означает "дальше" по списку
+        int lo = 0, hi = process_count;
+        int desc = key->order == 1;
+        if (strcmp(op, "=") == 0) { lo = lower; hi = upper; }
+        else if (strcmp(op, "<") == 0) { if (desc) lo = upper; else hi = lower; }
+        else if (strcmp(op, "<=") == 0) { if (desc) lo = lower; else hi = upper; }
+        else if (strcmp(op, ">") == 0) { if (desc) hi = lower; else lo = upper; }
+        else { if (desc) hi = upper; else lo = lower; }
+
+        if (lo > from) from = lo;
+        if (hi < to) to = hi;
+        narrowed = 1;
+    }
+
+    if (!narrowed) return head;
+    if (from >= to) {
+        *from_out = *to_out = 0;
+        return NULL;
+    }
+    *from_out = from;
+    *to_out = to;
+    return sorted_rows[from];
+}
+
+// ===== ИНДЕКС ПО ИМЕНИ: ПОИСК =====
+
+static int position_less(int a, int b, int by_name) {
+    if (by_name) {
+        int cmp = strcmp(name_index_key(a), name_index_key(b));
+        if (cmp != 0) return cmp < 0;
+    }
+    return a < b;
+}
+
+// Сортировка слиянием снизу вверх; tmp - буфер на n элементов
+static void sort_positions(int* items, int* tmp, int n, int by_name) {
+    int* from = items;
+    int* to = tmp;
+    for (int width = 1; width < n; width *= 2) {
+        for (int left = 0; left < n; left += 2 * width) {
+            int mid = left + width < n ? left + width : n;
+            int right = left + 2 * width < n ? left + 2 * width : n;
+            int i = left, j = mid, k = left;
+            while (i < mid && j < right) to[k++] = position_less(from[j], from[i], by_name) ? from[j++] : from[i++];
+            while (i < mid) to[k++] = from[i++];
+            while (j < right) to[k++] = from[j++];
+        }
+        int* swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != items) memcpy(items, from, n * sizeof(int));
+}
+
+// Вливает хвост добавленных позиций в упорядоченную часть
+static void name_index_order_ensure() {
+    NameIndex* ix = &name_index;
+    if (ix->sorted == ix->count) return;
+    int tail = ix->count - ix->sorted;
+    sort_positions(ix->order + ix->sorted, ix->order_tmp, tail, 1);
+    int i = 0, j = ix->sorted, k = 0;
+    while (i < ix->sorted && j < ix->count) {
+        ix->order_tmp[k++] = position_less(ix->order[j], ix->order[i], 1) ? ix->order[j++] : ix->order[i++];
+    }
+    while (i < ix->sorted) ix->order_tmp[k++] = ix->order[i++];
+    while (j < ix->count) ix->order_tmp[k++] = ix->order[j++];
+    memcpy(ix->order, ix->order_tmp, ix->count * sizeof(int));
+    ix->sorted = ix->count;
+}
+
+// Первое место в order, где имя >= value (strict = 0), > value (strict = 1)
+// или, при prefix = 1, первое имя больше value, которое не начинается с value
+static int name_order_bound(const char* value, int strict, int prefix) {
+    size_t len = strlen(value);
+    int lo = 0, hi = name_index.count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        const char* key = name_index_key(name_index.order[mid]);
+        int cmp = strcmp(key, value);
+        int before = prefix ? (cmp < 0 || strncmp(key, value, len) == 0) : (cmp < 0 || (strict && cmp == 0));
+        if (before) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static int name_index_usable(Condition* cond) {
+    if (strcmp(cond->field_name, "name") != 0 || !cond->typed) return 0;
+    if (strcmp(cond->oper, "in") == 0 || strcmp(cond->oper, "prefix") == 0) return 1;
+    return is_compare_oper(cond->oper) && strcmp(cond->oper, "!=") != 0;
+}
+
+// Число строк с именем value; при out != NULL их позиции (от поздних к ранним) пишутся в out
+static int name_index_equal(const char* value, int* out) {
+    unsigned int h = hash_str(value);
+    int count = 0;
+    for (int p = name_index.buckets[h & (unsigned int)(name_index.bucket_count - 1)]; p >= 0; p = name_index.chain[p]) {
+        if (name_index.hashes[p] != h || strcmp(name_index_key(p), value) != 0) continue;
+        if (out) out[count] = p;
+        count++;
+    }
+    return count;
+}
+
+// Число строк, подходящих под условие по имени. Для сравнений и префикса
+// отрезок order - [*lo, *hi), для равенства и списка *lo = -1 (строки ищутся по хешу)
+static int name_index_estimate(Condition* cond, int* lo, int* hi) {
+    const char* value = cond->str_value;
+    const char* op = cond->oper;
+    if (cond->set) {
+        int count = 0;
+        for (int i = 0; i < value_set_slots(cond->set); i++) {
+            if (value_set_slot(cond->set, i)) count += name_index_equal(cond->set->strs[i], NULL);
+        }
+        *lo = -1;
+        *hi = -1;
+        return count;
+    }
+    if (strcmp(op, "=") == 0) {
+        *lo = -1;
+        *hi = -1;
+        return name_index_equal(value, NULL);
+    }
+    name_index_order_ensure();
+    *lo = 0;
+    *hi = name_index.count;
+    if (strcmp(op, "prefix") == 0) {
+        *lo = name_order_bound(value, 0, 0);
+        *hi = name_order_bound(value, 0, 1);
+    }
+    else if (strcmp(op, "<") == 0) *hi = name_order_bound(value, 0, 0);
+    else if (strcmp(op, "<=") == 0) *hi = name_order_bound(value, 1, 0);
+    else if (strcmp(op, ">") == 0) *lo = name_order_bound(value, 1, 0);
+    else *lo = name_order_bound(value, 0, 0);
+    return *hi > *lo ? *hi - *lo : 0;
+}
+
+// Позиции строк, подходящих под условие, по возрастанию в памяти команды; NULL - нет памяти
+static int* name_index_collect(Condition* cond, int lo, int count) {
+    int* positions = (int*)scratch_alloc((count + 1) * sizeof(int));
+    int* tmp = (int*)scratch_alloc((count + 1) * sizeof(int));
+    if (positions == NULL || tmp == NULL) return NULL;
+    if (lo < 0 && cond->set) {
+        int k = 0;
+        for (int i = 0; i < value_set_slots(cond->set); i++) {
+            if (value_set_slot(cond->set, i)) k += name_index_equal(cond->set->strs[i], positions + k);
+        }
+    }
+    else if (lo < 0) name_index_equal(cond->str_value, positions);
+    else memcpy(positions, name_index.order + lo, count * sizeof(int));
+    sort_positions(positions, tmp, count, 0);
+    return positions;
+}
+
+// ===== СТАТИСТИКА И ПОРЯДОК УСЛОВИЙ =====
+
+// Счетчики статусов и приоритетов ведутся при каждом изменении. Команда analyze
+// дополнительно собирает для числовых полей и времени число различных значений,
+// min/max и гистограмму равной ширины, а для имен - число различных имен.
+// По ним планировщик оценивает долю строк, проходящих условие, и проверяет условия
+// в порядке возрастания cost / (1 - selectivity): дешевые и избирательные - первыми.
+
+#define STATS_BUCKETS 32
+
+typedef struct {
+    int valid;
+    int rows;               // строк на момент analyze
+    int distinct[ZONE_FIELDS];
+    int min[ZONE_FIELDS];
+    int max[ZONE_FIELDS];
+    int hist[ZONE_FIELDS][STATS_BUCKETS];
+    int name_distinct;      // 0 - неизвестно
+} TableStats;
+
+static TableStats table_stats;
+
+static int stats_bucket(int field, int value) {
+    long long width = (long long)table_stats.max[field] - table_stats.min[field] + 1;
+    return (int)(((long long)value - table_stats.min[field]) * STATS_BUCKETS / width);
+}
+
+// Собирает статистику по текущей таблице; 0 - не хватило памяти
+static int stats_analyze() {
+    TableStats* st = &table_stats;
+    memset(st, 0, sizeof(TableStats));
+    int n = process_count;
+    int* values = (int*)scratch_alloc((n + 1) * sizeof(int) * ZONE_FIELDS);
+    int* tmp = (int*)scratch_alloc((n + 1) * sizeof(int));
+    if (values == NULL || tmp == NULL) return 0;
+
+    int i = 0;
+    for (Process* curr = head; curr; curr = curr->next, i++) {
+        int row[ZONE_FIELDS];
+        zone_values(curr, row);
+        for (int f = 0; f < ZONE_FIELDS; f++) values[f * n + i] = row[f];
+    }
+    for (int f = 0; f < ZONE_FIELDS && n > 0; f++) {
+        int* column = values + f * n;
+        // Значения упорядочиваются как позиции: по возрастанию
+        sort_positions(column, tmp, n, 0);
+        st->min[f] = column[0];
+        st->max[f] = column[n - 1];
+        for (int j = 0; j < n; j++) {
+            if (j == 0 || column[j] != column[j - 1]) st->distinct[f]++;
+            st->hist[f][stats_bucket(f, column[j])]++;
+        }
+    }
+
+    if (name_index_ensure()) {
+        name_index_order_ensure();
+        for (int j = 0; j < name_index.count; j++) {
+            if (j == 0 || strcmp(name_index_key(name_index.order[j]), name_index_key(name_index.order[j - 1])) != 0) {
+                st->name_distinct++;
+            }
+        }
+    }
+    st->rows = n;
+    st->valid = 1;
+    return 1;
+}
+
+// Доля строк со значением поля field меньше value
+static double stats_fraction_below(int field, int value) {
+    TableStats* st = &table_stats;
+    if (value <= st->min[field]) return 0.0;
+    if (value > st->max[field]) return 1.0;
+    int b = stats_bucket(field, value);
+    long long below = 0;
+    for (int i = 0; i < b; i++) below += st->hist[field][i];
+    // Внутри корзины значения считаются распределенными равномерно
+    double width = ((double)st->max[field] - st->min[field] + 1) / STATS_BUCKETS;
+    double start = st->min[field] + b * width;
+    double part = width > 0 ? (value - start) / width : 0.0;
+    if (part < 0) part = 0;
+    if (part > 1) part = 1;
+    return (below + part * st->hist[field][b]) / st->rows;
+}
+
+static double stats_equal(int field, int value) {
+    TableStats* st = &table_stats;
+    if (!st->valid || st->rows == 0) return 0.1;
+    if (value < st->min[field] || value > st->max[field]) return 0.0;
+    return 1.0 / st->distinct[field];
+}
+
+static double clamp_fraction(double value) {
+    if (value < 0.0) return 0.0;
+    if (value > 1.0) return 1.0;
+    return value;
+}
+
+// Оценка доли строк, для которых условие истинно
+static double condition_selectivity(Condition* cond) {
+    // Неразобранное условие не выполняется ни для одной строки
+    if (!cond->typed) return 0.0;
+    const char* field = cond->field_name;
+    const char* op = cond->oper;
+    int rows = process_count > 0 ? process_count : 1;
+
+    if (strcmp(field, "name") == 0) {
+        double eq = table_stats.valid && table_stats.name_distinct > 0 ? 1.0 / table_stats.name_distinct : 0.1;
+        if (cond->set) {
+            double in = clamp_fraction(cond->set->count * eq);
+            return strcmp(op, "in") == 0 ? in : 1.0 - in;
+        }
+        if (strcmp(op, "=") == 0) return eq;
+        if (strcmp(op, "!=") == 0) return 1.0 - eq;
+        if (strcmp(op, "prefix") == 0) return 0.1;
+        return 1.0 / 3;
+    }
+
+    if (strcmp(field, "status") == 0) {
+        double in;
+        if (cond->set) {
+            int count = 0;
+            for (int j = 0; j < 6; j++) {
+                if (value_set_has_int(cond->set, j)) count += status_counts[j];
+            }
+            in = (double)count / rows;
+            return strcmp(op, "in") == 0 ? in : 1.0 - in;
+        }
+        in = (double)status_counts[cond->int_value] / rows;
+        return strcmp(op, "=") == 0 ? in : 1.0 - in;
+    }
+
+    int f = zone_field_id(field);
+    if (f < 0) return 1.0;
+    if (cond->set) {
+        double avg = table_stats.valid && table_stats.distinct[f] > 0 ? 1.0 / table_stats.distinct[f] : 0.1;
+        double in = clamp_fraction(cond->set->count * avg);
+        return strcmp(op, "in") == 0 ? in : 1.0 - in;
+    }
+
+    int value = (f == ZONE_KERN_TM || f == ZONE_FILE_TM) ? time_to_seconds(cond->time_value) : cond->int_value;
+    double eq = f == ZONE_PRIORITY ? (double)priority_count_get(value) / rows : stats_equal(f, value);
+    if (strcmp(op, "=") == 0) return eq;
+    if (strcmp(op, "!=") == 0) return 1.0 - eq;
+    if (!table_stats.valid || table_stats.rows == 0) return 1.0 / 3;
+    double below = stats_fraction_below(f, value);
+    if (strcmp(op, "<") == 0) return clamp_fraction(below);
+    if (strcmp(op, "<=") == 0) return clamp_fraction(below + eq);
+    if (strcmp(op, ">") == 0) return clamp_fraction(1.0 - below - eq);
+    return clamp_fraction(1.0 - below);
+}
+
+// Относительная цена проверки условия для одной строки
+static double condition_cost(Condition* cond) {
+    if (!cond->typed) return 10.0;   // значение разбирается заново на каждой строке
+    int is_name = strcmp(cond->field_name, "name") == 0;
+    if (cond->set) return is_name ? 4.0 : 2.0;
+    return is_name ? 3.0 : 1.0;
+}
+
+// Копия условий в памяти команды в порядке проверки. Для прохода по снимку
+// (в потоке читателя) порядок не меняется: счетчики ведет основной поток
+static Condition* plan_conditions(Condition* conditions, int cond_count) {
+    if (cond_count < 2 || reader_snapshot) return conditions;
+    Condition* planned = (Condition*)scratch_alloc(cond_count * sizeof(Condition));
+    double* rank = (double*)scratch_alloc(cond_count * sizeof(double));
+    if (planned == NULL || rank == NULL) return conditions;
+
+    // Вставками: при равной оценке сохраняется порядок записи
+    for (int i = 0; i < cond_count; i++) {
+        double sel = condition_selectivity(&conditions[i]);
+        double r = sel >= 1.0 ? 1e30 : condition_cost(&conditions[i]) / (1.0 - sel);
+        int j = i;
+        while (j > 0 && rank[j - 1] > r) {
+            planned[j] = planned[j - 1];
+            rank[j] = rank[j - 1];
+            j--;
+        }
+        planned[j] = conditions[i];
+        rank[j] = r;
+    }
+    return planned;
+}
+
+// ===== ПРОХОД ПО ТАБЛИЦЕ =====
+
+// Курсор по строкам, удовлетворяющим условиям. Сначала сужает проход по порядку
+// сортировки, затем пропускает блоки, чьи min/max не могут удовлетворить условию.
+typedef struct {
+    Condition* conditions;
+    int cond_count;
+    Process** rows;     // строки снимка, если поток читает снимок (иначе NULL)
+    Process* curr;
+    int index;          // номер curr в списке
+    int end;            // номер строки, на которой проход заканчивается
+    int use_zones;
+    int block;          // блок, в котором лежит curr
+    int left;           // сколько строк блока, начиная с curr, еще не просмотрено
+    int row;            // номер строки, возвращенной последним scan_next
+    int* candidates;    // позиции из индекса по имени (иначе NULL)
+    int candidate_count;
+    int candidate_next;
+    int zone_count;
+    int zone_field[100];
+    char zone_oper[100][3];
+    int zone_value[100];
+} TableScan;
+
+// 1 - блок заведомо не содержит подходящих строк
+static int zone_block_excluded(TableScan* scan, ZoneBlock* block) {
+    for (int i = 0; i < scan->zone_count; i++) {
+        int mn = block->min[scan->zone_field[i]];
+        int mx = block->max[scan->zone_field[i]];
+        int v = scan->zone_value[i];
+        const char* op = scan->zone_oper[i];
+        if (strcmp(op, "=") == 0 && (v < mn || v > mx)) return 1;
+        if (strcmp(op, "!=") == 0 && mn == v && mx == v) return 1;
+        if (strcmp(op, "<") == 0 && mn >= v) return 1;
+        if (strcmp(op, "<=") == 0 && mn > v) return 1;
+        if (strcmp(op, ">") == 0 && mx <= v) return 1;
+        if (strcmp(op, ">=") == 0 && mx < v) return 1;
+    }
+    return 0;
+}
+
+// Цена строки при проходе по позициям индекса (сортировка позиций и переходы
+// по памяти) относительно строки последовательного прохода
+#define INDEX_ROW_COST 4
+
+// Если среди условий есть избирательное условие по имени, проход идет только по
+// позициям из индекса. Остальные условия проверяются для каждой из них
+static int scan_by_name_index(TableScan* scan) {
+    int best = -1, best_count = 0, best_lo = 0;
+    for (int i = 0; i < scan->cond_count; i++) {
+        if (!name_index_usable(&scan->conditions[i])) continue;
+        if (best < 0 && !name_index_ensure()) return 0;
+        int lo, hi;
+        int count = name_index_estimate(&scan->conditions[i], &lo, &hi);
+        if (best < 0 || count < best_count) {
+            best = i;
+            best_count = count;
+            best_lo = lo;
+        }
+    }
+    // Неизбирательное условие дешевле проверить обычным проходом
+    if (best < 0 || (long long)best_count * INDEX_ROW_COST > scan->end - scan->index) return 0;
+
+    int* positions = name_index_collect(&scan->conditions[best], best_lo, best_count);
+    if (positions == NULL) return 0;
+    // Отрезок по порядку сортировки сужает позиции еще сильнее
+    int kept = 0;
+    for (int i = 0; i < best_count; i++) {
+        if (positions[i] >= scan->index && positions[i] < scan->end) positions[kept++] = positions[i];
+    }
+    scan->candidates = positions;
+    scan->candidate_count = kept;
+    scan->candidate_next = 0;
+    return 1;
+}
+
+// Значения условий по числовым полям и времени разбираются один раз
+static void scan_zone_conditions(TableScan* scan, Condition* conditions, int cond_count) {
+    scan->zone_count = 0;
+    for (int i = 0; i < cond_count; i++) {
+        int f = zone_field_id(conditions[i].field_name);
+        const char* op = conditions[i].oper;
+        if (f < 0 || strlen(op) > 2) continue;
+        int v;
+        if (f == ZONE_CPU_USAGE) {
+            if (!pars_decimal(conditions[i].value_str, &v)) continue;
+        }
+        else if (f == ZONE_KERN_TM || f == ZONE_FILE_TM) {
+            Time t;
+            if (!pars_time(conditions[i].value_str, &t)) continue;
+            v = time_to_seconds(t);
+        }
+        else if (!diapozon_int(conditions[i].value_str, &v)) continue;
+        scan->zone_field[scan->zone_count] = f;
+        strcpy(scan->zone_oper[scan->zone_count], op);
+        scan->zone_value[scan->zone_count] = v;
+        scan->zone_count++;
+    }
+}
+
+static void scan_begin(TableScan* scan, Condition* conditions, int cond_count) {
+    scan->conditions = plan_conditions(conditions, cond_count);
+    scan->cond_count = cond_count;
+    scan->use_zones = 0;
+    scan->zone_count = 0;
+    scan->candidates = NULL;
+
+    if (reader_snapshot) {
+        // Порядок сортировки и карты зон относятся к живой таблице - снимок просматривается целиком
+        scan->rows = reader_snapshot->rows;
+        scan->curr = NULL;
+        scan->index = 0;
+        scan->end = reader_snapshot->count;
+        return;
+    }
+    scan->rows = NULL;
+    scan->curr = sorted_range(conditions, cond_count, &scan->index, &scan->end);
+    if (scan->curr != NULL && scan_by_name_index(scan)) return;
+
+    scan_zone_conditions(scan, conditions, cond_count);
+    if (scan->zone_count == 0 || scan->curr == NULL || !zone_maps_ensure()) return;
+
+    // Находим блок, в котором начинается проход
+    int rest = scan->index;
+    int b = 0;
+    while (b < zone_block_count && rest >= zone_blocks[b].count) {
+        rest -= zone_blocks[b].count;
+        b++;
+    }
+    if (b == zone_block_count) return;
+    scan->use_zones = 1;
+    scan->block = b;
+    scan->left = zone_blocks[b].count - rest;
+    if (zone_block_excluded(scan, &zone_blocks[b])) {
+        blocks_skipped++;
+        scan->index += scan->left;
+        scan->left = 0;
+    }
+}
+
+// Следующая подходящая строка или NULL. Ее номер - scan->row, блок - scan->block.
+static Process* scan_next(TableScan* scan) {
+    if (scan->candidates) {
+        while (scan->candidate_next < scan->candidate_count) {
+            int position = scan->candidates[scan->candidate_next++];
+            Process* proc = name_index.rows[position];
+            if (check_all_conditions(proc, scan->conditions, scan->cond_count)) {
+                scan->row = position;
+                return proc;
+            }
+        }
+        return NULL;
+    }
+    if (scan->rows) {
+        while (scan->index < scan->end) {
+            Process* proc = scan->rows[scan->index++];
+            if (check_all_conditions(proc, scan->conditions, scan->cond_count)) {
+                scan->row = scan->index - 1;
+                return proc;
+            }
+        }
+        return NULL;
+    }
+
+    while (scan->curr != NULL && scan->index < scan->end) {
+        if (scan->use_zones && scan->left == 0) {
+            // Переход к следующему блоку: пропущенные строки не просматриваются вовсе
+            scan->block++;
+            if (scan->block >= zone_block_count) return NULL;
+            ZoneBlock* block = &zone_blocks[scan->block];
+            scan->curr = block->first;
+            scan->left = block->count;
+            if (zone_block_excluded(scan, block)) {
+                blocks_skipped++;
+                scan->index += scan->left;
+                scan->left = 0;
+            }
+            continue;
+        }
+
+        Process* proc = scan->curr;
+        int row = scan->index;
+        scan->curr = proc->next;
+        scan->index++;
+        if (scan->use_zones) scan->left--;
+        if (check_all_conditions(proc, scan->conditions, scan->cond_count)) {
+            scan->row = row;
+            return proc;
+        }
+    }
+    return NULL;
+}
+
+// ===== СЖАТОЕ ХРАНЕНИЕ: ПРОХОД =====
+
+// Проход по сжатым блокам для select и count. Блок, чьи min/max не подходят, пропускается
+// целиком; в остальных сначала разжимаются только колонки из условий, а прочие колонки -
+// лишь у подошедших строк. Возвращаемая строка живет до перехода к следующему блоку.
+typedef struct {
+    Condition* conditions;
+    int cond_count;
+    TableScan zones;                    // условия для пропуска блоков (zone_block_excluded)
+    unsigned char used[PACK_COLUMNS];   // колонки, нужные условиям
+    Process* rows;                      // строки текущего блока
+    int block;
+    int row;
+} PackedScan;
+
+static int packed_column_of(const char* field) {
+    if (strcmp(field, "status") == 0) return PACK_STATUS;
+    if (strcmp(field, "name") == 0) return PACK_NAME;
+    return zone_field_id(field);
+}
+
+static void packed_scan_begin(PackedScan* scan, Condition* conditions, int cond_count) {
+    scan->block = -1;
+    scan->row = PACK_BLOCK_ROWS;
+    scan->rows = NULL;
+    if (reader_snapshot || packed_table.block_count == 0) {
+        scan->block = packed_table.block_count;
+        return;
+    }
+    scan->rows = (Process*)scratch_alloc(PACK_BLOCK_ROWS * sizeof(Process));
+    if (scan->rows == NULL) {
+        scan->block = packed_table.block_count;
+        return;
+    }
+    scan->conditions = plan_conditions(conditions, cond_count);
+    scan->cond_count = cond_count;
+    scan_zone_conditions(&scan->zones, conditions, cond_count);
+    memset(scan->used, 0, sizeof(scan->used));
+    for (int i = 0; i < cond_count; i++) {
+        int column = packed_column_of(conditions[i].field_name);
+        if (column >= 0) scan->used[column] = 1;
+    }
+}
+
+static Process* packed_scan_next(PackedScan* scan) {
+    while (scan->block < packed_table.block_count) {
+        PackedBlock* block = scan->block >= 0 ? &packed_table.blocks[scan->block] : NULL;
+        if (block == NULL || scan->row >= block->count) {
+            scan->block++;
+            scan->row = 0;
+            if (scan->block >= packed_table.block_count) break;
+            block = &packed_table.blocks[scan->block];
+            if (zone_block_excluded(&scan->zones, &block->zone)) {
+                blocks_skipped++;
+                scan->row = block->count;
+                continue;
+            }
+            // Блок, который не удалось прочитать, прерывает проход
+            if (!packed_load(block)) {
+                scan->block = packed_table.block_count;
+                break;
+            }
+            for (int c = 0; c < PACK_COLUMNS; c++) {
+                if (scan->used[c]) packed_decode_column(block, c, scan->rows);
+            }
+        }
+
+        Process* proc = &scan->rows[scan->row];
+        int row = scan->row++;
+        if (!check_all_conditions(proc, scan->conditions, scan->cond_count)) continue;
+        for (int c = 0; c < PACK_COLUMNS; c++) {
+            if (!scan->used[c]) packed_set_column(proc, c, packed_get(block, c, row));
+        }
+        return proc;
+    }
+    return NULL;
+}
+
+// ===== СЖАТОЕ ХРАНЕНИЕ: ПЕРЕЗАПИСЬ =====
+
+static void field_value_assign(FieldValue* value, Process** rows, int count);
+
+// delete и update с условиями меняют блоки по одному, не разворачивая таблицу: блок
+// читается через пул, разжимается во временные строки, подошедшие строки удаляются или
+// получают значения, и блок сжимается заново на прежнем месте в packed_table. В памяти
+// остается только один разжатый блок. Имена, на которые больше нет ссылок, остаются в
+// словаре до packed_clear. values == NULL - удаление.
+// Возвращает число затронутых строк или -1 (не хватило памяти или блок не удалось
+// прочитать; уже переписанные блоки остаются переписанными)
+static int packed_rewrite(FieldValue* values, int value_count, Condition* conditions, int cond_count) {
+    if (packed_table.block_count == 0) return 0;
+    int touches_counters = values == NULL;
+    for (int i = 0; i < value_count; i++) {
+        if (strcmp(values[i].field, "priority") == 0 || strcmp(values[i].field, "status") == 0) touches_counters = 1;
+    }
+
+    ScratchMark mark = scratch_mark();
+    Process* rows = (Process*)scratch_alloc(PACK_BLOCK_ROWS * sizeof(Process));
+    Process** matched = (Process**)scratch_alloc(PACK_BLOCK_ROWS * sizeof(Process*));
+    Process* before = (Process*)scratch_alloc(PACK_BLOCK_ROWS * sizeof(Process));
+    if (!rows || !matched || !before) {
+        scratch_reset(mark);
+        return -1;
+    }
+    Condition* planned = plan_conditions(conditions, cond_count);
+    TableScan zones;
+    scan_zone_conditions(&zones, conditions, cond_count);
+    unsigned char used[PACK_COLUMNS];
+    memset(used, 0, sizeof(used));
+    for (int i = 0; i < cond_count; i++) {
+        int column = packed_column_of(conditions[i].field_name);
+        if (column >= 0) used[column] = 1;
+    }
+
+    int affected = 0;
+    int last_changed = 0;
+    int error = 0;
+    int b = 0;
+    while (b < packed_table.block_count) {
+        PackedBlock* block = &packed_table.blocks[b];
+        if (zone_block_excluded(&zones, &block->zone)) {
+            blocks_skipped++;
+            b++;
+            continue;
+        }
+        if (!packed_load(block)) {
+            error = 1;
+            break;
+        }
+        int count = block->count;
+        memset(rows, 0, count * sizeof(Process));
+        for (int c = 0; c < PACK_COLUMNS; c++) {
+            if (used[c]) packed_decode_column(block, c, rows);
+        }
+        int match_count = 0;
+        for (int i = 0; i < count; i++) {
+            if (check_all_conditions(&rows[i], planned, cond_count)) matched[match_count++] = &rows[i];
+        }
+        if (match_count == 0) {
+            b++;
+            continue;
+        }
+        for (int c = 0; c < PACK_COLUMNS; c++) {
+            if (!used[c]) packed_decode_column(block, c, rows);
+        }
+        // Старые значения нужны счетчикам, если блок удастся сжать
+        for (int i = 0; touches_counters && i < match_count; i++) before[i] = *matched[i];
+
+        // Строки нового блока связываются через next; удаленные в цепочку не входят
+        Process* first = NULL;
+        Process* prev = NULL;
+        int kept = 0;
+        if (values == NULL) {
+            for (int i = 0, m = 0; i < count; i++) {
+                if (m < match_count && matched[m] == &rows[i]) {
+                    m++;
+                    continue;
+                }
+                if (prev) prev->next = &rows[i];
+                else first = &rows[i];
+                prev = &rows[i];
+                kept++;
+            }
+        }
+        else {
+            for (int v = 0; v < value_count; v++) field_value_assign(&values[v], matched, match_count);
+            for (int i = 0; i < count; i++) rows[i].next = i + 1 < count ? &rows[i + 1] : NULL;
+            first = rows;
+            kept = count;
+        }
+
+        ScratchMark block_mark = scratch_mark();
+        PackedBlock fresh;
+        int encoded = kept == 0 || packed_encode(&fresh, first, kept);
+        scratch_reset(block_mark);
+        // Присвоенные длинные имена уже скопированы в словарь
+        for (int i = 0; values != NULL && i < match_count; i++) name_clear(&matched[i]->name);
+        if (!encoded) {
+            error = 1;
+            break;
+        }
+
+        for (int i = 0; touches_counters && i < match_count; i++) {
+            counters_remove(&before[i]);
+            if (values != NULL) counters_add(matched[i]);
+        }
+        if (b == packed_table.block_count - 1) last_changed = 1;
+        affected += match_count;
+        if (kept == 0) {
+            pool_block_removed(block);
+            memmove(block, block + 1, (packed_table.block_count - b - 1) * sizeof(PackedBlock));
+            packed_table.block_count--;
+        }
+        else {
+            pool_block_replaced(block, &fresh);
+            b++;
+        }
+        packed_table.rows -= count - kept;
+    }
+
+    if (affected > 0) {
+        if (values == NULL) bloom_forget(affected);
+        for (int v = 0; v < value_count; v++) {
+            if (is_sort_key(values[v].field)) sort_state_reset();
+            if (strcmp(values[v].field, "pid") == 0) {
+                bloom_forget(affected);
+                bloom_add(values[v].int_value);
+            }
+        }
+        if (packed_table.block_count == 0) packed_clear();
+        else if (last_changed && !packed_set_last()) error = 1;
+        table_changed();
+    }
+    scratch_reset(mark);
+    return error ? -1 : affected;
+}
+
+// ===== ШАРДЫ: ПОТОКИ-ИСПОЛНИТЕЛИ =====
+
+// У каждого шарда свой постоянный поток. Главный поток раздает всем одно задание,
+// ждет завершения и сливает результаты шардов по позиции строки в списке.
+
+typedef enum { SHARD_MATCH, SHARD_APPLY, SHARD_SORT, SHARD_HASH, SHARD_EXIT } ShardJobType;
+
+typedef struct {
+    ShardJobType type;
+    Condition* conditions;
+    int cond_count;
+    FieldValue* values;
+    int value_count;
+    SortField* sort_fields;
+    int sort_count;
+    char** hash_fields;
+    int hash_count;
+} ShardJob;
+
+static ShardJob shard_job;
+static mutex_t shard_lock;
+static cond_t shard_job_ready;
+static cond_t shard_job_done;
+static int shard_generation = 0;
+static int shard_pending = 0;
+
+static int shard_reserve_results(Shard* shard, int count) {
+    if (count <= shard->result_capacity) return 1;
+    int new_capacity = count;
+    Process** matches = (Process**)my_realloc(shard->matches, new_capacity * sizeof(Process*));
+    if (matches == NULL) return 0;
+    shard->matches = matches;
+    int* match_positions = (int*)my_realloc(shard->match_positions, new_capacity * sizeof(int));
+    if (match_positions == NULL) return 0;
+    shard->match_positions = match_positions;
+    SortItem* items = (SortItem*)my_realloc(shard->items, new_capacity * sizeof(SortItem));
+    if (items == NULL) return 0;
+    shard->items = items;
+    unsigned int* hashes = (unsigned int*)my_realloc(shard->hashes, new_capacity * sizeof(unsigned int));
+    if (hashes == NULL) return 0;
+    shard->hashes = hashes;
+    shard->result_capacity = new_capacity;
+    return 1;
+}
+
+static void shard_run_job(Shard* shard, ShardJob* job) {
+    if (!shard_reserve_results(shard, shard->count)) {
+        shard->failed = 1;
+        return;
+    }
+    if (job->type == SHARD_MATCH) {
+        shard->match_count = 0;
+        for (int i = 0; i < shard->count; i++) {
+            if (check_all_conditions(shard->rows[i], job->conditions, job->cond_count)) {
+                shard->matches[shard->match_count] = shard->rows[i];
+                shard->match_positions[shard->match_count] = shard->positions[i];
+                shard->match_count++;
+            }
+        }
+    }
+    else if (job->type == SHARD_APPLY) {
+        for (int v = 0; v < job->value_count; v++) {
+            field_value_assign(&job->values[v], shard->matches, shard->match_count);
+        }
+    }
+    else if (job->type == SHARD_SORT) {
+        // Индекс - позиция в списке, поэтому слияние дает тот же порядок, что и общая сортировка
+        for (int i = 0; i < shard->count; i++) {
+            shard->items[i].proc = shard->rows[i];
+            shard->items[i].index = shard->positions[i];
+        }
+        if (shard->count > 1) quicksort_stable(shard->items, 0, shard->count - 1, job->sort_fields, job->sort_count);
+    }
+    else if (job->type == SHARD_HASH) {
+        for (int i = 0; i < shard->count; i++) {
+            shard->hashes[i] = hash_process_fields(shard->rows[i], job->hash_fields, job->hash_count);
+        }
+    }
+}
+
+static void shard_worker(void* arg) {
+    Shard* shard = (Shard*)arg;
+    int seen = 0;
+    mutex_lock(&shard_lock);
+    for (;;) {
+        while (shard_generation == seen) cond_wait(&shard_job_ready, &shard_lock);
+        seen = shard_generation;
+        ShardJob job = shard_job;
+        mutex_unlock(&shard_lock);
+
+        if (job.type == SHARD_EXIT) return;
+        shard_run_job(shard, &job);
+
+        mutex_lock(&shard_lock);
+        if (--shard_pending == 0) cond_signal(&shard_job_done);
+    }
+}
+
+// Выполняет задание на всех шардах; 0 - хотя бы один шард не справился
+static int shards_run(ShardJob* job) {
+    for (int i = 0; i < shard_count; i++) shards[i].failed = 0;
+    mutex_lock(&shard_lock);
+    shard_job = *job;
+    shard_pending = shard_count;
+    shard_generation++;
+    cond_broadcast(&shard_job_ready);
+    while (shard_pending > 0) cond_wait(&shard_job_done, &shard_lock);
+    mutex_unlock(&shard_lock);
+    for (int i = 0; i < shard_count; i++) {
+        if (shards[i].failed) return 0;
+    }
+    return 1;
+}
+
+static void shards_stop() {
+    if (shard_count == 0) return;
+    ShardJob job;
+    memset(&job, 0, sizeof(job));
+    job.type = SHARD_EXIT;
+    mutex_lock(&shard_lock);
+    shard_job = job;
+    shard_generation++;
+    cond_broadcast(&shard_job_ready);
+    mutex_unlock(&shard_lock);
+    for (int i = 0; i < shard_count; i++) {
+        thread_join(shards[i].thread);
+        my_free(shards[i].rows);
+        my_free(shards[i].positions);
+        my_free(shards[i].matches);
+        my_free(shards[i].match_positions);
+        my_free(shards[i].items);
+        my_free(shards[i].hashes);
+    }
+    mutex_destroy(&shard_lock);
+    cond_destroy(&shard_job_ready);
+    cond_destroy(&shard_job_done);
+    shard_count = 0;
+    shards_valid = 0;
+}
+
+static int shards_start(int count) {
+    memset(shards, 0, sizeof(shards));
+    mutex_init(&shard_lock);
+    cond_init(&shard_job_ready);
+    cond_init(&shard_job_done);
+    shard_generation = 0;
+    for (int i = 0; i < count; i++) {
+        shards[i].id = i;
+        shards[i].start.func = shard_worker;
+        shards[i].start.arg = &shards[i];
+        if (!thread_start(&shards[i].thread, &shards[i].start)) {
+            shard_count = i;
+            shards_stop();
+            return 0;
+        }
+        shard_count = i + 1;
+    }
+    shards_valid = 0;
+    return 1;
+}
+
+// Шардами пользуется только главный поток; читатели снимков идут обычным проходом
+static int shards_active() {
+    return shard_count > 1 && reader_snapshot == NULL;
+}
+
+// Подходящие строки всех шардов; выдаются по возрастанию позиции в списке
+typedef struct {
+    int heap[MAX_SHARDS];   // номера шардов, упорядоченные по позиции очередной строки
+    int next[MAX_SHARDS];   // сколько результатов шарда уже выдано
+    int size;
+    int row;                // позиция строки, возвращенной последним merge_next
+} ShardMerge;
+
+static int merge_position(ShardMerge* merge, int shard) {
+    return shards[shard].match_positions[merge->next[shard]];
+}
+
+static void merge_sift_down(ShardMerge* merge, int pos) {
+    for (;;) {
+        int smallest = pos;
+        int l = 2 * pos + 1, r = 2 * pos + 2;
+        if (l < merge->size && merge_position(merge, merge->heap[l]) < merge_position(merge, merge->heap[smallest])) smallest = l;
+        if (r < merge->size && merge_position(merge, merge->heap[r]) < merge_position(merge, merge->heap[smallest])) smallest = r;
+        if (smallest == pos) return;
+        int tmp = merge->heap[pos];
+        merge->heap[pos] = merge->heap[smallest];
+        merge->heap[smallest] = tmp;
+        pos = smallest;
+    }
+}
+
+static void merge_begin(ShardMerge* merge) {
+    merge->size = 0;
+    for (int i = 0; i < shard_count; i++) {
+        merge->next[i] = 0;
+        if (shards[i].match_count > 0) merge->heap[merge->size++] = i;
+    }
+    for (int i = merge->size / 2 - 1; i >= 0; i--) merge_sift_down(merge, i);
+}
+
+static Process* merge_next(ShardMerge* merge) {
+    if (merge->size == 0) return NULL;
+    int s = merge->heap[0];
+    Process* proc = shards[s].matches[merge->next[s]];
+    merge->row = shards[s].match_positions[merge->next[s]];
+    merge->next[s]++;
+    if (merge->next[s] == shards[s].match_count) merge->heap[0] = merge->heap[--merge->size];
+    merge_sift_down(merge, 0);
+    return proc;
+}
+
+// Отбор строк на всех шардах; 0 - нужно идти обычным проходом
+static int shards_match(Condition* conditions, int cond_count) {
+    if (!shards_active() || !shards_ensure()) return 0;
+    ShardJob job;
+    memset(&job, 0, sizeof(job));
+    job.type = SHARD_MATCH;
+    job.conditions = plan_conditions(conditions, cond_count);
+    job.cond_count = cond_count;
+    return shards_run(&job);
+}
+
+static int shards_match_count() {
+    int total = 0;
+    for (int i = 0; i < shard_count; i++) total += shards[i].match_count;
+    return total;
+}
+
+// ===== ПАРСИНГ СПИСКА ПОЛЕЙ =====
+
+static char** parse_field_list(const char* str, int* count) {
+    if (!str || !*str) {
+        *count = 0;
+        return NULL;
+    }
+
+    char* temp = (char*)scratch_alloc(strlen(str) + 1);
+    if (!temp) {
+        *count = 0;
+        return NULL;
+    }
+    strcpy(temp, str);
+
+    *count = 1;
+    for (const char* p = str; *p; p++) {
+        if (*p == ',') (*count)++;
+    }
+
+    char** result = (char**)scratch_alloc(*count * sizeof(char*));
+    if (!result) {
+        *count = 0;
+        return NULL;
+    }
+
+    int idx = 0;
+    char* save = NULL;
+    char* token = strtok_r(temp, ",", &save);
+    while (token && idx < *count) {
+        while (*token == ' ') token++;
+        char* end = token + strlen(token) - 1;
+        while (end > token && (*end == ' ' || *end == '\t')) *end-- = '\0';
+        result[idx] = (char*)scratch_alloc(strlen(token) + 1);
+        if (result[idx]) strcpy(result[idx], token);
+        idx++;
+        token = strtok_r(NULL, ",", &save);
+    }
+
+    // strtok пропускает пустые элементы ("pid,,name")
+    *count = idx;
+    return result;
+}
+
+// ===== ЛЕКСЕР INSERT =====
+
+// Строка insert не копируется по полям: структурные символы (=, кавычки, запятые) ищутся
+// блоками по 16 байт - SSE2 сравнивает блок со всеми искомыми символами сразу, movemask
+// дает позицию первого совпадения. Хвост короче блока и сборки без SSE2 идут побайтно.
+// Значения разбираются прямо в строке функциями *_span с теми же правилами.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LEX_SSE2 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#ifdef LEX_SSE2
+static int lowest_bit(unsigned int mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+// Первый символ c1 или c2 в [p, end); end, если их нет
+static const char* lex_find(const char* p, const char* end, char c1, char c2) {
+#ifdef LEX_SSE2
+    __m128i v1 = _mm_set1_epi8(c1);
+    __m128i v2 = _mm_set1_epi8(c2);
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, v1), _mm_cmpeq_epi8(chunk, v2)));
+        if (mask) return p + lowest_bit(mask);
+        p += 16;
+    }
+#endif
+    while (p < end && *p != c1 && *p != c2) p++;
+    return p;
+}
+
+typedef enum { INSERT_PID, INSERT_NAME, INSERT_PRIORITY, INSERT_KERN_TM, INSERT_FILE_TM, INSERT_CPU_USAGE, INSERT_STATUS } InsertField;
+
+// Номер поля по имени длиной len; -1 - неизвестное поле
+static int lex_field(const char* name, size_t len) {
+    switch (len) {
+    case 3: return memcmp(name, "pid", 3) == 0 ? INSERT_PID : -1;
+    case 4: return memcmp(name, "name", 4) == 0 ? INSERT_NAME : -1;
+    case 6: return memcmp(name, "status", 6) == 0 ? INSERT_STATUS : -1;
+    case 7:
+        if (memcmp(name, "kern_tm", 7) == 0) return INSERT_KERN_TM;
+        return memcmp(name, "file_tm", 7) == 0 ? INSERT_FILE_TM : -1;
+    case 8: return memcmp(name, "priority", 8) == 0 ? INSERT_PRIORITY : -1;
+    case 9: return memcmp(name, "cpu_usage", 9) == 0 ? INSERT_CPU_USAGE : -1;
+    default: return -1;
+    }
+}
+
+// Имя в кавычках [start, end); escaped - внутри встречался \.
+// Без экранирования текст берется прямо из строки команды
+static int lex_name(ProcessName* name, const char* start, const char* end, int escaped) {
+    if (*start != '"') return 0;
+    if (!escaped) {
+        const char* text_end = end > start + 1 && end[-1] == '"' ? end - 1 : end;
+        return name_assign(name, start + 1, (size_t)(text_end - start - 1));
+    }
+    size_t len = (size_t)(end - start);
+    char* value = (char*)scratch_alloc(2 * len + 2);
+    if (value == NULL) return 0;
+    char* text = value + len + 1;
+    memcpy(value, start, len);
+    value[len] = '\0';
+    pars_str_into(value, text);
+    return name_assign(name, text, strlen(text));
+}
+
+// ===== INSERT =====
+// ===== INSERT (ИСПРАВЛЕННАЯ) =====
+static void insert(const char* args, const char* full_command, FILE* output) {
+    // Строка разбирается на стеке: память под нее выбирается, когда известен pid
+    Process parsed;
+    memset(&parsed, 0, sizeof(Process));
+    parsed.status = RUNNING;
+    Process* proc = &parsed;
+
+    // Флаги для отслеживания полей (бит на поле)
+    int fields_set = 0;
+    int fields_found = 0;
+
+    const char* p = args;
+    const char* end = args + strlen(args);
+    // Пропускаем начальные пробелы
+    while (*p == ' ') p++;
+
+    // Основной цикл парсинга
+    while (p < end) {
+        // Имя поля - до '=', не длиннее 49 символов
+        const char* eq = lex_find(p, end, '=', '=');
+        if (eq == end || eq - p > 49) goto error;
+        // Убираем пробелы в конце имени поля
+        size_t name_len = (size_t)(eq - p);
+        while (name_len > 1 && (p[name_len - 1] == ' ' || p[name_len - 1] == '\t')) name_len--;
+        int field = lex_field(p, name_len);
+        if (field < 0) goto error; // Неизвестное поле
+        if (fields_set & (1 << field)) goto error;
+        fields_set |= 1 << field;
+
+        p = eq + 1; // Пропускаем '='
+
+        // Пропускаем пробелы перед значением
+        while (*p == ' ') p++;
+
+        // Запоминаем начало значения
+        const char* value_start = p;
+        int escaped = 0;
+
+        // Определяем тип значения по первому символу
+        if (*p == '"') {
+            p++; // Пропускаем открывающую кавычку
+            // Ищем закрывающую кавычку с учетом экранирования
+            for (;;) {
+                p = lex_find(p, end, '"', '\\');
+                if (p == end) break;
+                if (*p == '"') {
+                    p++; // Нашли закрывающую кавычку
+                    break;
+                }
+                escaped = 1;
+                p = end - p > 2 ? p + 2 : end; // пропускаем \ и следующий символ
+            }
+        }
+        else if (*p == '\'') {
+            p = lex_find(p + 1, end, '\'', '\'');
+            if (p < end) p++; // Пропускаем закрывающую кавычку
+        }
+        else {
+            // Числовое значение - идем до запятой или конца строки
+            p = lex_find(p, end, ',', ',');
+        }
+
+        const char* value_end = p;
+        ptrdiff_t value_len = value_end - value_start;
+        if (value_len <= 0 || value_len >= 255) goto error;
+
+        // Обработка поля
+        int ok = 0;
+        switch (field) {
+        case INSERT_PID: ok = diapozon_int_span(value_start, value_end, &proc->pid); break;
+        case INSERT_NAME: ok = lex_name(&proc->name, value_start, value_end, escaped); break;
+        case INSERT_PRIORITY: ok = diapozon_int_span(value_start, value_end, &proc->priority); break;
+        case INSERT_KERN_TM: ok = pars_time_span(value_start, value_end, &proc->kern_tm); break;
+        case INSERT_FILE_TM: ok = pars_time_span(value_start, value_end, &proc->file_tm); break;
+        case INSERT_CPU_USAGE: ok = pars_decimal_span(value_start, value_end, &proc->cpu_usage); break;
+        case INSERT_STATUS: ok = pars_status_span(value_start, value_end, &proc->status); break;
+        }
+        if (!ok) goto error;
+        fields_found++;
+
+        // Пропускаем пробелы после значения
+        while (*p == ' ') p++;
+        // Проверяем запятую
+        if (*p == ',') {
+            p++;
+            while (*p == ' ') p++;
+        }
+        else if (*p != '\0') {
+            goto error; // Ожидалась запятая или конец строки
+        }
+    }
+
+    // Проверяем, что все 7 полей заполнены
+    if (fields_found != 7) {
+        goto error;
+    }
+
+    // Успех - добавляем процесс
+    proc = row_store(&parsed);
+    if (!proc) goto error;
+    add_process(proc);
+    fprintf(output, "insert:%d\n", table_row_count());
+    return;
+
+error:
+    name_clear(&parsed.name);
+    print_incorrect(output, full_command);
+}
+
+// ===== ПРОЕКЦИЯ ВЫВОДА =====
+
+// Список полей select разбирается один раз: для каждого поля запоминается готовая
+// метка ("pid=", " name=", ...) и функция вывода значения, так что на строку
+// не приходится ни одного strcmp
+
+typedef void (*FieldEmitter)(OutBuffer* out, Process* proc);
+
+typedef struct {
+    const char* label;      // разделитель и "поле="; у неизвестного поля - только разделитель
+    int label_len;
+    FieldEmitter emit;      // NULL - неизвестное поле
+} ProjectionItem;
+
+typedef struct {
+    ProjectionItem* items;
+    int count;
+} Projection;
+
+static void emit_pid(OutBuffer* out, Process* proc) { out_int(out, proc->pid); }
+static void emit_priority(OutBuffer* out, Process* proc) { out_int(out, proc->priority); }
+static void emit_kern_tm(OutBuffer* out, Process* proc) { out_time(out, proc->kern_tm); }
+static void emit_file_tm(OutBuffer* out, Process* proc) { out_time(out, proc->file_tm); }
+static void emit_cpu_usage(OutBuffer* out, Process* proc) { out_decimal(out, proc->cpu_usage); }
+static void emit_status(OutBuffer* out, Process* proc) { out_status(out, proc->status); }
+
+static void emit_name(OutBuffer* out, Process* proc) {
+    const char* name = name_text(&proc->name);
+    out_str(out, name ? name : "");
+}
+
+typedef struct {
+    const char* name;
+    FieldEmitter emit;
+} FieldOutput;
+
+static const FieldOutput field_outputs[] = {
+    { "pid", emit_pid },
+    { "name", emit_name },
+    { "priority", emit_priority },
+    { "kern_tm", emit_kern_tm },
+    { "file_tm", emit_file_tm },
+    { "cpu_usage", emit_cpu_usage },
+    { "status", emit_status }
+};
+
+#define FIELD_OUTPUT_COUNT ((int)(sizeof(field_outputs) / sizeof(field_outputs[0])))
+
+static int field_output_id(const char* name) {
+    if (!name) return -1;
+    for (int f = 0; f < FIELD_OUTPUT_COUNT; f++) {
+        if (strcmp(name, field_outputs[f].name) == 0) return f;
+    }
+    return -1;
+}
+
+// Проекция в памяти команды; NULL - не хватило памяти
+static Projection* projection_compile(char** fields, int count) {
+    Projection* proj = (Projection*)scratch_alloc(sizeof(Projection));
+    if (!proj) return NULL;
+    proj->items = (ProjectionItem*)scratch_alloc((count > 0 ? count : 1) * sizeof(ProjectionItem));
+    if (!proj->items) return NULL;
+    proj->count = count;
+
+    for (int i = 0; i < count; i++) {
+        ProjectionItem* item = &proj->items[i];
+        int field = field_output_id(fields[i]);
+        const char* sep = i > 0 ? " " : "";
+        if (field < 0) {
+            item->label = sep;
+            item->label_len = (int)strlen(sep);
+            item->emit = NULL;
+            continue;
+        }
+        const char* name = field_outputs[field].name;
+        char* label = (char*)scratch_alloc(strlen(name) + 3);
+        if (!label) return NULL;
+        sprintf(label, "%s%s=", sep, name);
+        item->label = label;
+        item->label_len = (int)strlen(label);
+        item->emit = field_outputs[field].emit;
+    }
+    return proj;
+}
+
+static void projection_emit(OutBuffer* out, const Projection* proj, Process* proc) {
+    for (int i = 0; i < proj->count; i++) {
+        const ProjectionItem* item = &proj->items[i];
+        out_write(out, item->label, item->label_len);
+        if (item->emit) item->emit(out, proc);
+    }
+}
+
+// ===== TOP-K (ORDER BY + LIMIT) =====
+
+// Просеивание вниз в max-куче: на вершине лежит "худший" из отобранных
+// элементов, т.е. тот, что при сортировке оказался бы последним
+static void topk_sift_down(SortItem* heap, int size, int pos, SortField* fields, int count) {
+    while (1) {
+        int largest = pos;
+        int left = 2 * pos + 1;
+        int right = 2 * pos + 2;
+        if (left < size && compare_for_sort_stable(&heap[left], &heap[largest], fields, count) > 0) largest = left;
+        if (right < size && compare_for_sort_stable(&heap[right], &heap[largest], fields, count) > 0) largest = right;
+        if (largest == pos) return;
+        SortItem temp = heap[pos];
+        heap[pos] = heap[largest];
+        heap[largest] = temp;
+        pos = largest;
+    }
+}
+
+static void topk_sift_up(SortItem* heap, int pos, SortField* fields, int count) {
+    while (pos > 0) {
+        int parent = (pos - 1) / 2;
+        if (compare_for_sort_stable(&heap[pos], &heap[parent], fields, count) <= 0) return;
+        SortItem temp = heap[pos];
+        heap[pos] = heap[parent];
+        heap[parent] = temp;
+        pos = parent;
+    }
+}
+
+// Отбирает не более limit подходящих процессов в порядке fields за O(n log k).
+// Порядок в списке не меняется. Результат лежит в items[0..return) по возрастанию,
+// при равенстве ключей сохраняется исходный порядок, как у sort_cmd.
+static int select_top_k(SortItem* items, int limit, Condition* conditions, int cond_count,
+    SortField* fields, int count) {
+    int size = 0;
+    TableScan scan;
+    scan_begin(&scan, conditions, cond_count);
+    Process* curr;
+    while ((curr = scan_next(&scan)) != NULL) {
+        SortItem item;
+        item.proc = curr;
+        item.index = scan.row;
+        if (size < limit) {
+            items[size] = item;
+            topk_sift_up(items, size, fields, count);
+            size++;
+        }
+        else if (compare_for_sort_stable(&item, &items[0], fields, count) < 0) {
+            items[0] = item;
+            topk_sift_down(items, size, 0, fields, count);
+        }
+    }
+
+    // Разбираем кучу: худший элемент уходит в конец
+    for (int last = size - 1; last > 0; last--) {
+        SortItem temp = items[0];
+        items[0] = items[last];
+        items[last] = temp;
+        topk_sift_down(items, last, 0, fields, count);
+    }
+    return size;
+}
+
+// ===== SELECT =====
+
+static void select_cmd(const char* args, const char* full_command, FILE* output) {
+    if (!args || !*args) {
+        print_incorrect(output, full_command);
+        return;
+    }
+
+    char* args_copy = (char*)scratch_alloc(strlen(args) + 1);
+    if (!args_copy) {
+        print_incorrect(output, full_command);
+        return;
+    }
+    strcpy(args_copy, args);
+
+    char* fields_str = args_copy;
+    while (*fields_str == ' ' || *fields_str == '\t') fields_str++;
+    char* end = fields_str;
+    while (*end && !isspace((unsigned char)*end)) end++;
+
+    if (end == fields_str) {
+        print_incorrect(output, full_command);
+        return;
+    }
+
+    char* temp_fields = (char*)scratch_alloc(end - fields_str + 1);
+    strncpy(temp_fields, fields_str, end - fields_str);
+    temp_fields[end - fields_str] = '\0';
+
+    int field_count;
+    char** field_list = parse_field_list(temp_fields, &field_count);
+
+    if (!field_list || field_count == 0) {
+        print_incorrect(output, full_command);
+        return;
+    }
+
+    Projection* projection = projection_compile(field_list, field_count);
+    OutBuffer* out = out_begin(output);
+    if (!projection || !out) {
+        print_incorrect(output, full_command);
+        return;
+    }
+
+    // ИСПРАВЛЕНО: динамическое выделение вместо стека
+    Condition* conditions = (Condition*)scratch_alloc(100 * sizeof(Condition));
+    if (!conditions) {
+        print_incorrect(output, full_command);
+        return;
+    }
+
+    int cond_count = 0;
+    int error = 0;
+
+    // Необязательные order_by=<поле>=asc|desc,... и limit=<N>
+    SortField order_fields[100];
+    int order_count = 0;
+    int limit = -1;
+
+    char* cond_str = end;
+    while (*cond_str == ' ' || *cond_str == '\t') cond_str++;
+
+    if (*cond_str) {
+        char* cond_copy = (char*)scratch_alloc(strlen(cond_str) + 1);
+        if (!cond_copy) {
+            print_incorrect(output, full_command);
+            return;
+        }
+        strcpy(cond_copy, cond_str);
+
+        char* save = NULL;
+        char* token = strtok_r(cond_copy, " \t", &save);
+        while (token) {
+            if (strncmp(token, "order_by=", 9) == 0) {
+                if (order_count > 0 || !parse_sort_fields(token + 9, order_fields, &order_count)) {
+                    error = 1;
+                    break;
+                }
+            }
+            else if (strncmp(token, "limit=", 6) == 0) {
+                if (limit >= 0 || !diapozon_int(token + 6, &limit) || limit < 0) {
+                    error = 1;
+                    break;
+                }
+            }
+            else {
+                if (!parse_condition(token, &conditions[cond_count])) {
+                    error = 1;
+                    break;
+                }
+                cond_count++;
+            }
+            token = strtok_r(NULL, " \t", &save);
+        }
+
+    }
+
+    if (error) {
+        print_incorrect(output, full_command);
+        return;
+    }
+
+    if (bloom_excludes(conditions, cond_count)) {
+        fprintf(output, "select:0\n");
+        return;
+    }
+
+    if (order_count > 0) {
+        // Сортировка без изменения порядка в таблице: куча из не более чем limit элементов
+        int rows = table_row_count();
+        int k = (limit >= 0 && limit < rows) ? limit : rows;
+        SortItem* items = NULL;
+        if (k > 0) {
+            items = (SortItem*)scratch_alloc(k * sizeof(SortItem));
+            if (!items) {
+                print_incorrect(output, full_command);
+                return;
+            }
+        }
+
+        int found = k > 0 ? select_top_k(items, k, conditions, cond_count, order_fields, order_count) : 0;
+        fprintf(output, "select:%d\n", found);
+        for (int i = 0; i < found; i++) {
+            projection_emit(out, projection, items[i].proc);
+            out_char(out, '\n');
+        }
+    }
+    else if (shards_match(conditions, cond_count)) {
+        // Шарды отбирают строки параллельно, вывод - в порядке списка
+        int found = shards_match_count();
+        if (limit >= 0 && found > limit) found = limit;
+
+        fprintf(output, "select:%d\n", found);
+
+        ShardMerge merge;
+        merge_begin(&merge);
+        for (int printed = 0; printed < found; printed++) {
+            projection_emit(out, projection, merge_next(&merge));
+            out_char(out, '\n');
+        }
+    }
+    else {
+        // Сначала сжатые блоки (compress on), затем список
+        PackedScan packed;
+        TableScan scan;
+        int found = 0;
+        packed_scan_begin(&packed, conditions, cond_count);
+        while (packed_scan_next(&packed) != NULL) found++;
+        scan_begin(&scan, conditions, cond_count);
+        while (scan_next(&scan) != NULL) found++;
+        if (limit >= 0 && found > limit) found = limit;
+
+        fprintf(output, "select:%d\n", found);
+
+        int printed = 0;
+        Process* curr;
+        packed_scan_begin(&packed, conditions, cond_count);
+        while (printed < found && (curr = packed_scan_next(&packed)) != NULL) {
+            projection_emit(out, projection, curr);
+            out_char(out, '\n');
+            printed++;
+        }
+        scan_begin(&scan, conditions, cond_count);
+        while (printed < found && (curr = scan_next(&scan)) != NULL) {
+            projection_emit(out, projection, curr);
+            out_char(out, '\n');
+            printed++;
+        }
+    }
+    out_flush(out);
+}
+
+// ===== DELETE =====
+
+static void delete_cmd(const char* args, const char* full_command, FILE* output) {
+    if (!args || !*args) {
+        int del = table_row_count();
+        packed_clear();
+        clear_allproc();
+        fprintf(output, "delete:%d\n", del);
+        return;
+    }
+
+    char* args_copy = (char*)scratch_alloc(strlen(args) + 1);
+    if (!args_copy) {
+        print_incorrect(output, full_command);
+        return;
+    }
+    strcpy(args_copy, args);
+
+    // ИСПРАВЛЕНО: динамическое выделение вместо стека
+    Condition* conditions = (Condition*)scratch_alloc(100 * sizeof(Condition));
+    if (!conditions) {
+        print_incorrect(output, full_command);
+        return;
+    }
+
+    int cond_count = 0;
+    int error = 0;
+
+    char* save = NULL;
+    char* token = strtok_r(args_copy, " \t", &save);
+    while (token) {
+        if (!parse_condition(token, &conditions[cond_count])) {
+            error = 1;
+            break;
+        }
+        cond_count++;
+        token = strtok_r(NULL, " \t", &save);
+    }
+
+    if (error) {
+        print_incorrect(output, full_command);
+        return;
+    }
+
+    if (bloom_excludes(conditions, cond_count)) {
+        fprintf(output, "delete:0\n");
+        return;
+    }
+
+    int packed = packed_rewrite(NULL, 0, conditions, cond_count);
+    int* indices = (int*)scratch_alloc((process_count + 1) * sizeof(int));
+    if (packed < 0 || !indices) {
+        print_incorrect(output, full_command);
+        return;
+    }
+
+    int del_count = 0;
+    if (shards_match(conditions, cond_count)) {
+        ShardMerge merge;
+        merge_begin(&merge);
+        while (merge_next(&merge) != NULL) {
+            indices[del_count++] = merge.row;
+        }
+    }
+    else {
+        TableScan scan;
+        scan_begin(&scan, conditions, cond_count);
+        while (scan_next(&scan) != NULL) {
+            indices[del_count++] = scan.row;
+        }
+    }
+
+    for (int i = del_count - 1; i >= 0; i--) {
+        delete_process(indices[i]);
+    }
+
+    fprintf(output, "delete:%d\n", packed + del_count);
+}
+
+// ===== UPDATE =====
+
+static int field_value_parse(FieldValue* value, const char* text) {
+    const char* field = value->field;
+    value->str_value = NULL;
+    if (strcmp(field, "pid") == 0 || strcmp(field, "priority") == 0) return diapozon_int(text, &value->int_value);
+    if (strcmp(field, "cpu_usage") == 0) return pars_decimal(text, &value->int_value);
+    if (strcmp(field, "kern_tm") == 0 || strcmp(field, "file_tm") == 0) return pars_time(text, &value->time_value);
+    if (strcmp(field, "status") == 0) {
+        Status status;
+        if (!pars_status(text, &status)) return 0;
+        value->int_value = (int)status;
+        return 1;
+    }
+    if (strcmp(field, "name") == 0) {
+        value->str_value = pars_name(text);
+        return value->str_value != NULL;
+    }
+    return 0;
+}
+
+// Присваивает значение полю всех строк выборки (по столбцу). Общие структуры не трогает,
+// поэтому может идти в потоке шарда. Короткое имя копируется в запись, длинное разделяется строками
+static void field_value_assign(FieldValue* value, Process** rows, int count) {
+    const char* field = value->field;
+    if (strcmp(field, "pid") == 0) {
+        for (int i = 0; i < count; i++) rows[i]->pid = value->int_value;
+    }
+    else if (strcmp(field, "priority") == 0) {
+        for (int i = 0; i < count; i++) rows[i]->priority = value->int_value;
+    }
+    else if (strcmp(field, "cpu_usage") == 0) {
+        for (int i = 0; i < count; i++) rows[i]->cpu_usage = value->int_value;
+    }
+    else if (strcmp(field, "status") == 0) {
+        for (int i = 0; i < count; i++) rows[i]->status = (Status)value->int_value;
+    }
+    else if (strcmp(field, "kern_tm") == 0) {
+        for (int i = 0; i < count; i++) rows[i]->kern_tm = value->time_value;
+    }
+    else if (strcmp(field, "file_tm") == 0) {
+        for (int i = 0; i < count; i++) rows[i]->file_tm = value->time_value;
+    }
+    else if (strcmp(field, "name") == 0) {
+        size_t len = strlen(value->str_value);
+        for (int i = 0; i < count; i++) name_assign_shared(&rows[i]->name, value->str_value, len);
+    }
+}
+
+static void field_values_release(FieldValue* values, int count) {
+    for (int i = 0; i < count; i++) name_release(values[i].str_value);
+}
+
+// Отбирает строки по условиям в вектор выборки и присваивает им значения.
+// Возвращает число измененных строк или -1, если не хватило памяти
+static int update_rows(FieldValue* values, int value_count, Condition* conditions, int cond_count) {
+    int touches_zone = 0, touches_counters = 0;
+    for (int i = 0; i < value_count; i++) {
+        if (zone_field_id(values[i].field) >= 0) touches_zone = 1;
+        if (strcmp(values[i].field, "priority") == 0 || strcmp(values[i].field, "status") == 0) touches_counters = 1;
+    }
+
+    ScratchMark mark = scratch_mark();
+    Process** rows = (Process**)scratch_alloc((process_count + 1) * sizeof(Process*));
+    int* blocks = (int*)scratch_alloc((process_count + 1) * sizeof(int));
+    if (!rows || !blocks) {
+        scratch_reset(mark);
+        return -1;
+    }
+
+    int count = 0;
+    int sharded = 0;
+    int use_zones = 0;
+    if (snapshots != NULL) {
+        // Строки закрепленных снимков не меняются на месте: в список встает копия
+        conditions = plan_conditions(conditions, cond_count);
+        Process* prev = NULL;
+        Process* curr = head;
+        while (curr) {
+            if (check_all_conditions(curr, conditions, cond_count)) {
+                Process* copy = clone_process(curr);
+                if (copy) {
+                    copy->next = curr->next;
+                    if (prev) prev->next = copy;
+                    else head = copy;
+                    retire_process(curr);
+                    curr = copy;
+                    rows[count++] = copy;
+                }
+            }
+            prev = curr;
+            curr = curr->next;
+        }
+        // Указатели на замененные строки в sorted_rows, блоках и шардах устарели
+        sorted_rows_valid = 0;
+        zone_maps_invalidate();
+        shards_invalidate();
+        name_index_invalidate();
+    }
+    else if (shards_match(conditions, cond_count)) {
+        for (int s = 0; s < shard_count; s++) {
+            for (int i = 0; i < shards[s].match_count; i++) rows[count++] = shards[s].matches[i];
+        }
+        sharded = 1;
+    }
+    else {
+        TableScan scan;
+        scan_begin(&scan, conditions, cond_count);
+        Process* curr;
+        while ((curr = scan_next(&scan)) != NULL) {
+            blocks[count] = scan.block;
+            rows[count++] = curr;
+        }
+        use_zones = scan.use_zones;
+    }
+
+    if (count > 0) {
+        // Счетчики пересчитываются вокруг изменения
+        if (touches_counters) {
+            for (int i = 0; i < count; i++) counters_remove(rows[i]);
+        }
+        if (sharded) {
+            // Присваивания идут в потоках шардов над их частями выборки
+            ShardJob job;
+            memset(&job, 0, sizeof(job));
+            job.type = SHARD_APPLY;
+            job.values = values;
+            job.value_count = value_count;
+            shards_run(&job);
+        }
+        else {
+            for (int v = 0; v < value_count; v++) field_value_assign(&values[v], rows, count);
+        }
+        if (touches_counters) {
+            for (int i = 0; i < count; i++) counters_add(rows[i]);
+        }
+
+        table_changed();
+        for (int v = 0; v < value_count; v++) {
+            if (is_sort_key(values[v].field)) sort_state_reset();
+            if (strcmp(values[v].field, "pid") == 0) {
+                shards_invalidate();
+                bloom_forget(count);
+                bloom_add(values[v].int_value);
+            }
+            if (strcmp(values[v].field, "name") == 0) name_index_invalidate();
+        }
+        if (touches_zone) {
+            // Новые значения расширяют min/max блоков строк
+            if (use_zones) {
+                for (int i = 0; i < count; i++) zone_widen(&zone_blocks[blocks[i]], rows[i]);
+            }
+            else zone_maps_invalidate();
+        }
+    }
+
+    scratch_reset(mark);
+    return count;
+}
+
+// update по всей таблице: сначала сжатые блоки, затем список; -1 - не хватило памяти
+static int update_table(FieldValue* values, int value_count, Condition* conditions, int cond_count) {
+    int packed = packed_rewrite(values, value_count, conditions, cond_count);
+    if (packed < 0) return -1;
+    int listed = update_rows(values, value_count, conditions, cond_count);
+    return listed < 0 ? -1 : packed + listed;
+}
+
+static void update_cmd(const char* args, const char* full_command, FILE* output) {
+    if (!args || !*args) {
+        print_incorrect(output, full_command);
+        return;
+    }
+
+    char* args_copy = (char*)scratch_alloc(strlen(args) + 1);
+    if (!args_copy) {
+        print_incorrect(output, full_command);
+        return;
+    }
+    strcpy(args_copy, args);
+
+    char* p = args_copy;
+    while (*p == ' ' || *p == '\t') p++;
+
+    char* end = p;
+    while (*end && !isspace((unsigned char)*end)) end++;
+
+    if (end == p) {
+        print_incorrect(output, full_command);
+        return;
+    }
+
+    char* cond_str = end;
+    while (*cond_str == ' ' || *cond_str == '\t') cond_str++;
+    if (*cond_str == '\0') cond_str = NULL;
+    *end = '\0';
+
+    // Значения разбираются и проверяются один раз на всю команду
+    int max_values = 1;
+    for (const char* c = p; *c; c++) {
+        if (*c == ',') max_values++;
+    }
+    FieldValue* values = (FieldValue*)scratch_alloc(max_values * sizeof(FieldValue));
+    if (!values) {
+        print_incorrect(output, full_command);
+        return;
+    }
+    int value_count = 0;
+    int error = 0;
+
+    char* save = NULL;
+    char* token = strtok_r(p, ",", &save);
+    while (token) {
+        while (*token == ' ') token++;
+
+        char* eq = strchr(token, '=');
+        if (!eq) {
+            error = 1;
+            break;
+        }
+
+        *eq = '\0';
+        char* field = token;
+        char* value = eq + 1;
+
+        char* end_f = field + strlen(field) - 1;
+        while (end_f > field && (*end_f == ' ' || *end_f == '\t')) *end_f-- = '\0';
+        while (*value == ' ' || *value == '\t') value++;
+
+        for (int i = 0; i < value_count; i++) {
+            if (strcmp(values[i].field, field) == 0) error = 1;
+        }
+        if (error || !is_known_field(field)) {
+            error = 1;
+            break;
+        }
+
+        strcpy(values[value_count].field, field);
+        if (!field_value_parse(&values[value_count], value)) {
+            error = 1;
+            break;
+        }
+        value_count++;
+        token = strtok_r(NULL, ",", &save);
+    }
+
+    if (error || value_count == 0) {
+        field_values_release(values, value_count);
+        print_incorrect(output, full_command);
+        return;
+    }
+
+    // ИСПРАВЛЕНО: динамическое выделение вместо стека
+    Condition* conditions = (Condition*)scratch_alloc(100 * sizeof(Condition));
+    if (!conditions) {
+        field_values_release(values, value_count);
+        print_incorrect(output, full_command);
+        return;
+    }
+
+    int cond_count = 0;
+
+    if (cond_str) {
+        token = strtok_r(cond_str, " \t", &save);
+        while (token) {
+            if (!parse_condition(token, &conditions[cond_count])) {
+                error = 1;
+                break;
+            }
+            cond_count++;
+            token = strtok_r(NULL, " \t", &save);
+        }
+    }
+
+    int updated = error ? -1 :
+        bloom_excludes(conditions, cond_count) ? 0 : update_table(values, value_count, conditions, cond_count);
+    field_values_release(values, value_count);
+    if (updated < 0) {
+        print_incorrect(output, full_command);
+        return;
+    }
+    fprintf(output, "update:%d\n", updated);
+}
+
+// ===== UNIQ =====
+
+static int compare_processes(Process* a, Process* b, char** fields, int count) {
+    if (!a || !b || !fields || count == 0) return 0;
+    for (int i = 0; i < count; i++) {
+        if (strcmp(fields[i], "pid") == 0) {
+            if (a->pid != b->pid) return 0;
+        }
+        else if (strcmp(fields[i], "name") == 0) {
+            const char* name_a = name_text(&a->name);
+            const char* name_b = name_text(&b->name);
+            if (!name_a && !name_b) continue;
+            if (!name_a || !name_b) return 0;
+            if (strcmp(name_a, name_b) != 0) return 0;
+        }
+        else if (strcmp(fields[i], "priority") == 0) {
+            if (a->priority != b->priority) return 0;
+        }
+        else if (strcmp(fields[i], "kern_tm") == 0) {
+            if (compare_time(a->kern_tm, b->kern_tm) != 0) return 0;
+        }
+        else if (strcmp(fields[i], "file_tm") == 0) {
+            if (compare_time(a->file_tm, b->file_tm) != 0) return 0;
+        }
+        else if (strcmp(fields[i], "cpu_usage") == 0) {
+            if (a->cpu_usage != b->cpu_usage) return 0;
+        }
+        else if (strcmp(fields[i], "status") == 0) {
+            if (a->status != b->status) return 0;
+        }
+    }
+    return 1;
+}
+
+// Шарды считают хеши ключа своих строк, затем общий проход с конца списка
+// оставляет последнее вхождение каждого ключа. 0 - нужно идти обычным проходом
+static int uniq_sharded(char** fields, int count, int* to_delete) {
+    if (!shards_active() || process_count == 0 || !shards_ensure()) return 0;
+    ShardJob job;
+    memset(&job, 0, sizeof(job));
+    job.type = SHARD_HASH;
+    job.hash_fields = fields;
+    job.hash_count = count;
+    if (!shards_run(&job)) return 0;
+
+    Process** rows = (Process**)scratch_alloc(process_count * sizeof(Process*));
+    unsigned int* hashes = (unsigned int*)scratch_alloc(process_count * sizeof(unsigned int));
+    int capacity = 16;
+    while (capacity < process_count * 2) capacity *= 2;
+    int* kept = (int*)scratch_alloc(capacity * sizeof(int));
+    if (!rows || !hashes || !kept) {
+        return 0;
+    }
+    for (int s = 0; s < shard_count; s++) {
+        for (int i = 0; i < shards[s].count; i++) {
+            rows[shards[s].positions[i]] = shards[s].rows[i];
+            hashes[shards[s].positions[i]] = shards[s].hashes[i];
+        }
+    }
+    for (int i = 0; i < capacity; i++) kept[i] = -1;
+
+    for (int i = process_count - 1; i >= 0; i--) {
+        int slot = (int)(hashes[i] & (unsigned int)(capacity - 1));
+        while (kept[slot] >= 0) {
+            int k = kept[slot];
+            if (hashes[k] == hashes[i] && compare_processes(rows[k], rows[i], fields, count)) break;
+            slot = (slot + 1) & (capacity - 1);
+        }
+        if (kept[slot] >= 0) to_delete[i] = 1;
+        else kept[slot] = i;
+    }
+
+    return 1;
+}
+
+static void uniq_cmd(const char* args, const char* full_command, FILE* output) {
+    if (!args || !*args) {
+        print_incorrect(output, full_command);
+        return;
+    }
+
+    char* args_copy = (char*)scratch_alloc(strlen(args) + 1);
+    if (!args_copy) {
+        print_incorrect(output, full_command);
+        return;
+    }
+    strcpy(args_copy, args);
+
+    while (*args_copy == ' ' || *args_copy == '\t') args_copy++;
+    char* end = args_copy + strlen(args_copy) - 1;
+    while (end > args_copy && (*end == ' ' || *end == '\t')) *end-- = '\0';
+
+    int field_count;
+    char** field_list = parse_field_list(args_copy, &field_count);
+
+    if (!field_list || field_count == 0) {
+        print_incorrect(output, full_command);
+        return;
+    }
+
+    for (int i = 0; i < field_count; i++) {
+        for (int j = i + 1; j < field_count; j++) {
+            if (strcmp(field_list[i], field_list[j]) == 0) {
+                print_incorrect(output, full_command);
+                return;
+            }
+        }
+    }
+
+    int* to_delete = (int*)scratch_alloc(process_count * sizeof(int));
+    if (!to_delete) {
+        print_incorrect(output, full_command);
+        return;
+    }
+
+    for (int i = 0; i < process_count; i++) to_delete[i] = 0;
+
+    if (!uniq_sharded(field_list, field_count, to_delete)) {
+        for (int i = process_count - 1; i >= 0; i--) {
+            if (to_delete[i]) continue;
+            Process* curr = get_process_index(i);
+            for (int j = i - 1; j >= 0; j--) {
+                if (to_delete[j]) continue;
+                Process* other = get_process_index(j);
+                if (compare_processes(curr, other, field_list, field_count)) {
+                    to_delete[j] = 1;
+                }
+            }
+        }
+    }
+
+    int del_count = 0;
+    for (int i = 0; i < process_count; i++) if (to_delete[i]) del_count++;
+
+    for (int i = process_count - 1; i >= 0; i--) {
+        if (to_delete[i]) delete_process(i);
+    }
+
+    fprintf(output, "uniq:%d\n", del_count);
+}
+
+// ===== SORT =====
+
+static int compare_for_sort(Process* a, Process* b, SortField* fields, int count) {
+    if (!a || !b || !fields || count == 0) return 0;
+
+    for (int i = 0; i < count; i++) {
+        int cmp = 0;
+
+        if (strcmp(fields[i].field_name, "pid") == 0) {
+            cmp = compare_int(a->pid, b->pid);
+        }
+        else if (strcmp(fields[i].field_name, "name") == 0) {
+            cmp = compare_names(&a->name, &b->name);
+        }
+        else if (strcmp(fields[i].field_name, "priority") == 0) {
+            cmp = compare_int(a->priority, b->priority);
+        }
+        else if (strcmp(fields[i].field_name, "kern_tm") == 0) {
+            cmp = compare_time(a->kern_tm, b->kern_tm);
+        }
+        else if (strcmp(fields[i].field_name, "file_tm") == 0) {
+            cmp = compare_time(a->file_tm, b->file_tm);
+        }
+        else if (strcmp(fields[i].field_name, "cpu_usage") == 0) {
+            cmp = compare_decimal(a->cpu_usage, b->cpu_usage);
+        }
+        else if (strcmp(fields[i].field_name, "status") == 0) {
+            cmp = compare_status(a->status, b->status);
+        }
+
+        if (cmp != 0) {
+            return fields[i].order == 0 ? cmp : -cmp;
+        }
+    }
+
+    return 0;
+}
+
+static int parse_sort_fields(const char* str, SortField* fields, int* count) {
+    if (!str || !*str || !fields || !count) return 0;
+
+    char* temp = (char*)scratch_alloc(strlen(str) + 1);
+    if (!temp) return 0;
+    strcpy(temp, str);
+
+    *count = 0;
+    int error = 0;
+
+    char* save = NULL;
+    char* token = strtok_r(temp, ",", &save);
+    while (token && *count < 100) {
+        while (*token == ' ') token++;
+
+        char* eq = strchr(token, '=');
+        if (!eq) { error = 1; break; }
+
+        *eq = '\0';
+        char* name = token;
+        char* order = eq + 1;
+
+        char* end = name + strlen(name) - 1;
+        while (end > name && (*end == ' ' || *end == '\t')) *end-- = '\0';
+        while (*order == ' ' || *order == '\t') order++;
+        end = order + strlen(order) - 1;
+        while (end > order && (*end == ' ' || *end == '\t')) *end-- = '\0';
+
+        // Проверка на дубликаты полей
+        for (int i = 0; i < *count; i++) {
+            if (strcmp(fields[i].field_name, name) == 0) { error = 1; break; }
+        }
+        if (error) break;
+
+        strcpy(fields[*count].field_name, name);
+        if (strcmp(order, "asc") == 0) {
+            fields[*count].order = 0;
+        }
+        else if (strcmp(order, "desc") == 0) {
+            fields[*count].order = 1;
+        }
+        else {
+            error = 1;
+            break;
+        }
+
+        (*count)++;
+        token = strtok_r(NULL, ",", &save);
+    }
+
+    return !error && *count > 0;
+}
+
+// Функция сравнения с учетом индекса
+static int compare_for_sort_stable(SortItem* a, SortItem* b, SortField* fields, int count) {
+    for (int i = 0; i < count; i++) {
+        int cmp = 0;
+
+        if (strcmp(fields[i].field_name, "pid") == 0) {
+            cmp = compare_int(a->proc->pid, b->proc->pid);
+        }
+        else if (strcmp(fields[i].field_name, "name") == 0) {
+            cmp = compare_names(&a->proc->name, &b->proc->name);
+        }
+        else if (strcmp(fields[i].field_name, "priority") == 0) {
+            cmp = compare_int(a->proc->priority, b->proc->priority);
+        }
+        else if (strcmp(fields[i].field_name, "kern_tm") == 0) {
+            cmp = compare_time(a->proc->kern_tm, b->proc->kern_tm);
+        }
+        else if (strcmp(fields[i].field_name, "file_tm") == 0) {
+            cmp = compare_time(a->proc->file_tm, b->proc->file_tm);
+        }
+        else if (strcmp(fields[i].field_name, "cpu_usage") == 0) {
+            cmp = compare_decimal(a->proc->cpu_usage, b->proc->cpu_usage);
+        }
+        else if (strcmp(fields[i].field_name, "status") == 0) {
+            cmp = compare_status(a->proc->status, b->proc->status);
+        }
+
+        if (cmp != 0) {
+            return fields[i].order == 0 ? cmp : -cmp;
+        }
+    }
+
+    // Ключи равны - сравниваем по исходному индексу для стабильности
+    return compare_int(a->index, b->index);
+}
+
+// Быстрая сортировка для SortItem
+static void quicksort_stable(SortItem* arr, int left, int right, SortField* fields, int count) {
+    if (left >= right) return;
+
+    int i = left;
+    int j = right;
+    SortItem pivot = arr[left + (right - left) / 2];
+
+    while (i <= j) {
+        while (compare_for_sort_stable(&arr[i], &pivot, fields, count) < 0) i++;
+        while (compare_for_sort_stable(&arr[j], &pivot, fields, count) > 0) j--;
+
+        if (i <= j) {
+            SortItem temp = arr[i];
+            arr[i] = arr[j];
+            arr[j] = temp;
+            i++;
+            j--;
+        }
+    }
+
+    if (left < j) quicksort_stable(arr, left, j, fields, count);
+    if (i < right) quicksort_stable(arr, i, right, fields, count);
+}
+
+static void shard_heap_sift_down(int* heap, int size, int* next, int pos, SortField* fields, int count) {
+    for (;;) {
+        int smallest = pos;
+        int l = 2 * pos + 1, r = 2 * pos + 2;
+        if (l < size && compare_for_sort_stable(&shards[heap[l]].items[next[heap[l]]],
+            &shards[heap[smallest]].items[next[heap[smallest]]], fields, count) < 0) smallest = l;
+        if (r < size && compare_for_sort_stable(&shards[heap[r]].items[next[heap[r]]],
+            &shards[heap[smallest]].items[next[heap[smallest]]], fields, count) < 0) smallest = r;
+        if (smallest == pos) return;
+        int tmp = heap[pos];
+        heap[pos] = heap[smallest];
+        heap[smallest] = tmp;
+        pos = smallest;
+    }
+}
+
+// Шарды сортируют свои строки, затем k-путевое слияние по куче заполняет items.
+// 0 - нужно сортировать обычным образом
+static int sort_sharded(SortItem* items, SortField* fields, int count) {
+    if (!shards_active() || !shards_ensure()) return 0;
+    ShardJob job;
+    memset(&job, 0, sizeof(job));
+    job.type = SHARD_SORT;
+    job.sort_fields = fields;
+    job.sort_count = count;
+    if (!shards_run(&job)) return 0;
+
+    // Куча из головных элементов шардов; next[s] - сколько строк шарда уже слито
+    int heap[MAX_SHARDS];
+    int next[MAX_SHARDS];
+    int size = 0;
+    for (int s = 0; s < shard_count; s++) {
+        next[s] = 0;
+        if (shards[s].count > 0) heap[size++] = s;
+    }
+    for (int i = size / 2 - 1; i >= 0; i--) shard_heap_sift_down(heap, size, next, i, fields, count);
+    for (int out = 0; out < process_count; out++) {
+        int s = heap[0];
+        items[out] = shards[s].items[next[s]++];
+        if (next[s] == shards[s].count) heap[0] = heap[--size];
+        shard_heap_sift_down(heap, size, next, 0, fields, count);
+    }
+    return 1;
+}
+
+// ===== ВНЕШНЯЯ СОРТИРОВКА =====
+
+// Если массив SortItem для всей таблицы больше бюджета (sort_memory <КБ>), список сортируется
+// отрезками: каждый отрезок сортируется в памяти и пишется во временный файл как указатели
+// на строки, затем отрезки сливаются деревом проигравших. При равных ключах побеждает более
+// ранний отрезок, поэтому результат совпадает с сортировкой в памяти. Слитая
+// последовательность тоже пишется в файл, и список перестраивается только после слияния.
+
+static long long sort_memory = 0;      // байт, 0 - без ограничения
+static long sort_runs = 0;             // отрезков во всех внешних сортировках
+
+typedef struct {
+    long long pos;      // продолжение отрезка в файле
+    int left;           // строк отрезка, еще не прочитанных из файла
+    Process** buf;
+    int buf_len;
+    int buf_next;
+} SortRun;
+
+typedef struct {
+    FILE* file;
+    SortRun* runs;
+    int run_count;      // он же номер условного отрезка, который меньше любого
+    int buf_rows;
+    SortField* fields;
+    int count;
+} RunMerge;
+
+static int run_fill(RunMerge* m, SortRun* run) {
+    int n = run->left < m->buf_rows ? run->left : m->buf_rows;
+    run->buf_next = 0;
+    run->buf_len = 0;
+    if (n == 0) return 1;
+    if (file_seek(m->file, run->pos, SEEK_SET) != 0 ||
+        fread(run->buf, sizeof(Process*), n, m->file) != (size_t)n) return 0;
+    run->pos += (long long)n * sizeof(Process*);
+    run->left -= n;
+    run->buf_len = n;
+    return 1;
+}
+
+// 1 - голова отрезка a идет раньше головы b; исчерпанный отрезок больше любого
+static int run_less(RunMerge* m, int a, int b) {
+    if (a == m->run_count) return 1;
+    if (b == m->run_count) return 0;
+    SortRun* ra = &m->runs[a];
+    SortRun* rb = &m->runs[b];
+    if (ra->buf_next == ra->buf_len) return 0;
+    if (rb->buf_next == rb->buf_len) return 1;
+    int cmp = compare_for_sort(ra->buf[ra->buf_next], rb->buf[rb->buf_next], m->fields, m->count);
+    return cmp != 0 ? cmp < 0 : a < b;
+}
+
+// Проход от листа leaf к корню: в узлах остаются проигравшие, в tree[0] - победитель
+static void loser_adjust(RunMerge* m, int* tree, int leaf) {
+    int winner = leaf;
+    for (int node = (leaf + m->run_count) / 2; node > 0; node /= 2) {
+        if (run_less(m, tree[node], winner)) {
+            int loser = winner;
+            winner = tree[node];
+            tree[node] = loser;
+        }
+    }
+    tree[0] = winner;
+}
+
+static int sort_write(FILE* file, long long pos, Process** rows, int n) {
+    return file_seek(file, pos, SEEK_SET) == 0 && fwrite(rows, sizeof(Process*), n, file) == (size_t)n;
+}
+
+// Сортирует список по fields; 0 - ошибка временного файла или памяти (список не изменен)
+static int sort_external(SortField* fields, int count) {
+    long long budget_rows = sort_memory / (long long)(sizeof(SortItem) + sizeof(Process*));
+    int run_rows = budget_rows < 1 ? 1 : (budget_rows < process_count ? (int)budget_rows : process_count);
+    int run_count = (process_count + run_rows - 1) / run_rows;
+
+    RunMerge m;
+    m.file = tmpfile();
+    m.runs = (SortRun*)scratch_alloc(run_count * sizeof(SortRun));
+    m.run_count = run_count;
+    m.fields = fields;
+    m.count = count;
+    int* tree = (int*)scratch_alloc(run_count * sizeof(int));
+    if (m.file == NULL || m.runs == NULL || tree == NULL) {
+        if (m.file) fclose(m.file);
+        return 0;
+    }
+
+    // Отрезки: память под них потом отдается буферам слияния
+    ScratchMark mark = scratch_mark();
+    SortItem* items = (SortItem*)scratch_alloc(run_rows * sizeof(SortItem));
+    Process** rows = (Process**)scratch_alloc(run_rows * sizeof(Process*));
+    int ok = items != NULL && rows != NULL;
+    long long pos = 0;
+    Process* curr = head;
+    for (int r = 0; ok && r < run_count; r++) {
+        int n = 0;
+        for (; curr != NULL && n < run_rows; curr = curr->next, n++) {
+            items[n].proc = curr;
+            items[n].index = n;
+        }
+        quicksort_stable(items, 0, n - 1, fields, count);
+        for (int i = 0; i < n; i++) rows[i] = items[i].proc;
+        ok = sort_write(m.file, pos, rows, n);
+        m.runs[r].pos = pos;
+        m.runs[r].left = n;
+        pos += (long long)n * sizeof(Process*);
+    }
+    scratch_reset(mark);
+
+    // Буферы чтения отрезков и вывода делят половину бюджета
+    long long buf_rows = sort_memory / 2 / ((long long)(run_count + 1) * sizeof(Process*));
+    m.buf_rows = buf_rows < 1 ? 1 : (buf_rows > 4096 ? 4096 : (int)buf_rows);
+    Process** out = (Process**)scratch_alloc(m.buf_rows * sizeof(Process*));
+    ok = ok && out != NULL;
+    for (int r = 0; ok && r < run_count; r++) {
+        m.runs[r].buf = (Process**)scratch_alloc(m.buf_rows * sizeof(Process*));
+        ok = m.runs[r].buf != NULL && run_fill(&m, &m.runs[r]);
+    }
+
+    // Слияние в конец файла
+    long long out_start = pos;
+    if (ok) {
+        for (int i = 0; i < run_count; i++) tree[i] = run_count;
+        for (int r = run_count - 1; r >= 0; r--) loser_adjust(&m, tree, r);
+    }
+    int out_len = 0;
+    for (int i = 0; ok && i < process_count; i++) {
+        int w = tree[0];
+        SortRun* run = &m.runs[w];
+        out[out_len++] = run->buf[run->buf_next++];
+        if (out_len == m.buf_rows) {
+            ok = sort_write(m.file, pos, out, out_len);
+            pos += (long long)out_len * sizeof(Process*);
+            out_len = 0;
+        }
+        if (ok && run->buf_next == run->buf_len) ok = run_fill(&m, run);
+        loser_adjust(&m, tree, w);
+    }
+    if (ok && out_len > 0) ok = sort_write(m.file, pos, out, out_len);
+
+    // Перестраиваем список по слитой последовательности
+    if (ok) ok = file_seek(m.file, out_start, SEEK_SET) == 0;
+    if (ok) {
+        Process* prev = NULL;
+        for (int done = 0; done < process_count; ) {
+            int n = process_count - done < m.buf_rows ? process_count - done : m.buf_rows;
+            // Файл только что записан; ошибка чтения здесь не ожидается
+            if (fread(out, sizeof(Process*), n, m.file) != (size_t)n) break;
+            for (int i = 0; i < n; i++) {
+                if (prev) prev->next = out[i];
+                else head = out[i];
+                prev = out[i];
+            }
+            done += n;
+        }
+        if (prev) prev->next = NULL;
+        sort_runs += run_count;
+    }
+    fclose(m.file);
+    return ok;
+}
+
+static void sort_cmd(const char* args, const char* full_command, FILE* output) {
+    if (!args || !*args) {
+        print_incorrect(output, full_command);
+        return;
+    }
+
+    char* args_copy = (char*)scratch_alloc(strlen(args) + 1);
+    if (!args_copy) {
+        print_incorrect(output, full_command);
+        return;
+    }
+    strcpy(args_copy, args);
+
+    while (*args_copy == ' ' || *args_copy == '\t') args_copy++;
+    char* end = args_copy + strlen(args_copy) - 1;
+    while (end > args_copy && (*end == ' ' || *end == '\t')) *end-- = '\0';
+
+    SortField fields[100];
+    int count = 0;
+
+    if (!parse_sort_fields(args_copy, fields, &count)) {
+        print_incorrect(output, full_command);
+        return;
+    }
+
+    if (count == 0) {
+        print_incorrect(output, full_command);
+        return;
+    }
+
+    if (process_count == 0) {
+        sort_state_reset();
+        memcpy(sort_state, fields, count * sizeof(SortField));
+        sort_state_count = count;
+        fprintf(output, "sort:0\n");
+        return;
+    }
+
+    SortItem* items = NULL;
+    if (sort_memory > 0 && (long long)process_count * (long long)sizeof(SortItem) > sort_memory) {
+        if (!sort_external(fields, count)) {
+            print_incorrect(output, full_command);
+            return;
+        }
+    }
+    else {
+        // Создаем массив SortItem с индексами
+        items = (SortItem*)scratch_alloc(process_count * sizeof(SortItem));
+        if (!items) {
+            print_incorrect(output, full_command);
+            return;
+        }
+
+        if (!sort_sharded(items, fields, count)) {
+            Process* curr = head;
+            for (int i = 0; i < process_count; i++) {
+                items[i].proc = curr;
+                items[i].index = i;  // Сохраняем исходный индекс
+                curr = curr->next;
+            }
+
+            // Сортируем
+            quicksort_stable(items, 0, process_count - 1, fields, count);
+        }
+
+        // Перестраиваем список
+        head = items[0].proc;
+        for (int i = 0; i < process_count - 1; i++) {
+            items[i].proc->next = items[i + 1].proc;
+        }
+        items[process_count - 1].proc->next = NULL;
+    }
+
+    // Запоминаем порядок: дальше диапазонные select идут бинарным поиском
+    table_changed();
+    zone_maps_invalidate();
+    shards_invalidate();
+    name_index_invalidate();
+    sort_state_reset();
+    memcpy(sort_state, fields, count * sizeof(SortField));
+    sort_state_count = count;
+    // После внешней сортировки массив строится при первом обращении
+    if (items && sorted_rows_reserve(process_count)) {
+        for (int i = 0; i < process_count; i++) sorted_rows[i] = items[i].proc;
+        sorted_rows_valid = 1;
+    }
+
+    fprintf(output, "sort:%d\n", process_count);
+}
+
+// ===== SORTED_INSERT =====
+
+// sorted_insert on|off: вставлять новые строки в позицию по текущему порядку сортировки
+static void sorted_insert_cmd(const char* args, const char* full_command, FILE* output) {
+    if (args && strcmp(args, "on") == 0) sorted_insert_mode = 1;
+    else if (args && strcmp(args, "off") == 0) sorted_insert_mode = 0;
+    else {
+        print_incorrect(output, full_command);
+        return;
+    }
+    fprintf(output, "sorted_insert:%s\n", sorted_insert_mode ? "on" : "off");
+}
+
+// ===== AGGREGATE =====
+
+typedef enum {
+    AGG_COUNT,
+    AGG_SUM,
+    AGG_MIN,
+    AGG_MAX,
+    AGG_AVG
+} AggFunc;
+
+static const char* agg_func_names[] = {
+    "count",
+    "sum",
+    "min",
+    "max",
+    "avg"
+};
+
+typedef struct {
+    AggFunc func;
+    char field_name[50];
+} AggSpec;
+
+// Состояние одного агрегата внутри группы. Значения хранятся как есть:
+// cpu_usage - в сотых долях, время - в секундах от начала суток
+typedef struct {
+    long long sum;
+    long long min;
+    long long max;
+} AggState;
+
+typedef struct {
+    Process* key;       // первый процесс группы, по нему печатаются поля группировки
+    unsigned int hash;
+    int next;           // следующая группа в цепочке бакета, -1 - конец
+    int count;
+} AggGroup;
+
+static int is_known_field(const char* name) {
+    return strcmp(name, "pid") == 0 || strcmp(name, "name") == 0 ||
+        strcmp(name, "priority") == 0 || strcmp(name, "kern_tm") == 0 ||
+        strcmp(name, "file_tm") == 0 || strcmp(name, "cpu_usage") == 0 ||
+        strcmp(name, "status") == 0;
+}
+
+static Time seconds_to_time(long long seconds) {
+    Time t;
+    t.hour = (unsigned short)(seconds / 3600);
+    t.minute = (unsigned short)(seconds / 60 % 60);
+    t.second = (unsigned short)(seconds % 60);
+    return t;
+}
+
+// Деление с округлением половины от нуля
+static long long div_round(long long num, long long den) {
+    if (num >= 0) return (num + den / 2) / den;
+    return -((-num + den / 2) / den);
+}
+
+static void print_decimal_ll(FILE* out, long long value) {
+    if (value < 0) {
+        fprintf(out, "-");
+        value = -value;
+    }
+    fprintf(out, "%lld.%02lld", value / 100, value % 100);
+}
+
+static int parse_agg_spec(const char* str, AggSpec* spec) {
+    if (strcmp(str, "count") == 0) {
+        spec->func = AGG_COUNT;
+        spec->field_name[0] = '\0';
+        return 1;
+    }
+
+    const char* open = strchr(str, '(');
+    if (!open) return 0;
+    size_t len = strlen(str);
+    if (len < 2 || str[len - 1] != ')') return 0;
+
+    ptrdiff_t func_len = open - str;
+    int found = 0;
+    for (int j = AGG_SUM; j <= AGG_AVG; j++) {
+        if ((ptrdiff_t)strlen(agg_func_names[j]) == func_len &&
+            strncmp(str, agg_func_names[j], func_len) == 0) {
+            spec->func = (AggFunc)j;
+            found = 1;
+            break;
+        }
+    }
+    if (!found) return 0;
+
+    ptrdiff_t field_len = (str + len - 1) - (open + 1);
+    if (field_len <= 0 || field_len >= 50) return 0;
+    strncpy(spec->field_name, open + 1, field_len);
+    spec->field_name[field_len] = '\0';
+
+    if (strcmp(spec->field_name, "priority") == 0 || strcmp(spec->field_name, "cpu_usage") == 0) return 1;
+    // Сумма времени суток смысла не имеет
+    if (strcmp(spec->field_name, "kern_tm") == 0 || strcmp(spec->field_name, "file_tm") == 0) {
+        return spec->func != AGG_SUM;
+    }
+    return 0;
+}
+
+static long long agg_field_value(Process* proc, const char* field) {
+    if (strcmp(field, "priority") == 0) return proc->priority;
+    if (strcmp(field, "cpu_usage") == 0) return proc->cpu_usage;
+    if (strcmp(field, "kern_tm") == 0) return time_to_seconds(proc->kern_tm);
+    if (strcmp(field, "file_tm") == 0) return time_to_seconds(proc->file_tm);
+    return 0;
+}
+
+// FNV-1a по значениям полей группировки
+static unsigned int hash_process_fields(Process* proc, char** fields, int count) {
+    unsigned int h = 2166136261u;
+    for (int i = 0; i < count; i++) {
+        const unsigned char* bytes = NULL;
+        size_t len = 0;
+        int num = 0;
+        if (strcmp(fields[i], "name") == 0) {
+            const char* name = name_text(&proc->name);
+            bytes = (const unsigned char*)(name ? name : "");
+            len = strlen((const char*)bytes);
+        }
+        else {
+            if (strcmp(fields[i], "pid") == 0) num = proc->pid;
+            else if (strcmp(fields[i], "priority") == 0) num = proc->priority;
+            else if (strcmp(fields[i], "kern_tm") == 0) num = time_to_seconds(proc->kern_tm);
+            else if (strcmp(fields[i], "file_tm") == 0) num = time_to_seconds(proc->file_tm);
+            else if (strcmp(fields[i], "cpu_usage") == 0) num = proc->cpu_usage;
+            else if (strcmp(fields[i], "status") == 0) num = (int)proc->status;
+            bytes = (const unsigned char*)&num;
+            len = sizeof(num);
+        }
+        for (size_t j = 0; j < len; j++) {
+            h ^= bytes[j];
+            h *= 16777619u;
+        }
+        // Разделитель, чтобы ("ab","c") и ("a","bc") не совпадали
+        h ^= 0xff;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void print_agg_value(FILE* output, AggSpec* spec, AggState* state, int count) {
+    if (spec->func == AGG_COUNT) {
+        fprintf(output, "count=%d", count);
+        return;
+    }
+
+    fprintf(output, "%s(%s)=", agg_func_names[spec->func], spec->field_name);
+    long long value = 0;
+    if (spec->func == AGG_SUM) value = state->sum;
+    else if (spec->func == AGG_MIN) value = state->min;
+    else if (spec->func == AGG_MAX) value = state->max;
+
+    int is_time = strcmp(spec->field_name, "kern_tm") == 0 || strcmp(spec->field_name, "file_tm") == 0;
+    if (is_time) {
+        if (spec->func == AGG_AVG) value = div_round(state->sum, count);
+        print_time(output, seconds_to_time(value));
+    }
+    else if (strcmp(spec->field_name, "cpu_usage") == 0) {
+        if (spec->func == AGG_AVG) value = div_round(state->sum, count);
+        print_decimal_ll(output, value);
+    }
+    else {
+        // priority: среднее печатается с двумя знаками, как decimal
+        if (spec->func == AGG_AVG) print_decimal_ll(output, div_round(state->sum * 100, count));
+        else fprintf(output, "%lld", value);
+    }
+}
+
+static void aggregate_cmd(const char* args, const char* full_command, FILE* output) {
+    if (!args || !*args) {
+        print_incorrect(output, full_command);
+        return;
+    }
+
+    char* args_copy = (char*)scratch_alloc(strlen(args) + 1);
+    if (!args_copy) {
+        print_incorrect(output, full_command);
+        return;
+    }
+    strcpy(args_copy, args);
+
+    // aggregate <поля группировки> <агрегаты> [условия]
+    char* save = NULL;
+    char* group_str = strtok_r(args_copy, " \t", &save);
+    char* spec_str = group_str ? strtok_r(NULL, " \t", &save) : NULL;
+    char* cond_str = spec_str ? strtok_r(NULL, "", &save) : NULL;
+    if (!group_str || !spec_str) {
+        print_incorrect(output, full_command);
+        return;
+    }
+
+    int group_count = 0;
+    char** group_fields = parse_field_list(group_str, &group_count);
+    int spec_count = 0;
+    char** spec_list = parse_field_list(spec_str, &spec_count);
+    AggSpec* specs = spec_count > 0 ? (AggSpec*)scratch_alloc(spec_count * sizeof(AggSpec)) : NULL;
+    Condition* conditions = (Condition*)scratch_alloc(100 * sizeof(Condition));
+
+    int error = !group_fields || group_count == 0 || !spec_list || !specs || !conditions;
+    for (int i = 0; !error && i < group_count; i++) {
+        if (!is_known_field(group_fields[i])) error = 1;
+        for (int j = i + 1; !error && j < group_count; j++) {
+            if (strcmp(group_fields[i], group_fields[j]) == 0) error = 1;
+        }
+    }
+    for (int i = 0; !error && i < spec_count; i++) {
+        if (!parse_agg_spec(spec_list[i], &specs[i])) error = 1;
+    }
+
+    int cond_count = 0;
+    if (!error && cond_str) {
+        char* token = strtok_r(cond_str, " \t", &save);
+        while (token) {
+            if (!parse_condition(token, &conditions[cond_count])) {
+                error = 1;
+                break;
+            }
+            cond_count++;
+            token = strtok_r(NULL, " \t", &save);
+        }
+    }
+
+    // Групп не больше, чем процессов; таблица бакетов - степень двойки
+    int rows = table_row_count();
+    int bucket_count = 1;
+    while (bucket_count < 2 * rows) bucket_count <<= 1;
+    int* buckets = NULL;
+    AggGroup* groups = NULL;
+    AggState* states = NULL;
+    if (!error) {
+        buckets = (int*)scratch_alloc(bucket_count * sizeof(int));
+        groups = (AggGroup*)scratch_alloc((rows > 0 ? rows : 1) * sizeof(AggGroup));
+        states = (AggState*)scratch_alloc((rows > 0 ? rows : 1) * spec_count * sizeof(AggState));
+        if (!buckets || !groups || !states) error = 1;
+    }
+
+    if (error) {
+        print_incorrect(output, full_command);
+        return;
+    }
+
+    for (int i = 0; i < bucket_count; i++) buckets[i] = -1;
+
+    // Один проход: поиск группы по хешу и накопление агрегатов
+    int groups_used = 0;
+    TableScan scan;
+    scan_begin(&scan, conditions, cond_count);
+    Process* curr;
+    while ((curr = scan_next(&scan)) != NULL) {
+        unsigned int h = hash_process_fields(curr, group_fields, group_count);
+        int b = (int)(h & (unsigned int)(bucket_count - 1));
+        int g = buckets[b];
+        while (g >= 0 && !(groups[g].hash == h && compare_processes(curr, groups[g].key, group_fields, group_count))) {
+            g = groups[g].next;
+        }
+
+        if (g < 0) {
+            g = groups_used++;
+            groups[g].key = curr;
+            groups[g].hash = h;
+            groups[g].next = buckets[b];
+            groups[g].count = 0;
+            buckets[b] = g;
+        }
+
+        AggState* st = &states[g * spec_count];
+        for (int i = 0; i < spec_count; i++) {
+            if (specs[i].func == AGG_COUNT) continue;
+            long long v = agg_field_value(curr, specs[i].field_name);
+            if (groups[g].count == 0) {
+                st[i].sum = v;
+                st[i].min = v;
+                st[i].max = v;
+            }
+            else {
+                st[i].sum += v;
+                if (v < st[i].min) st[i].min = v;
+                if (v > st[i].max) st[i].max = v;
+            }
+        }
+        groups[g].count++;
+    }
+
+    Projection* projection = projection_compile(group_fields, group_count);
+    OutBuffer* out = out_begin(output);
+    if (!projection || !out) {
+        print_incorrect(output, full_command);
+        return;
+    }
+
+    // Группы выводятся в порядке первого появления
+    fprintf(output, "aggregate:%d\n", groups_used);
+    for (int g = 0; g < groups_used; g++) {
+        projection_emit(out, projection, groups[g].key);
+        out_flush(out);
+        for (int i = 0; i < spec_count; i++) {
+            fprintf(output, " ");
+            print_agg_value(output, &specs[i], &states[g * spec_count + i], groups[g].count);
+        }
+        fprintf(output, "\n");
+    }
+
+}
+
+// ===== COUNT =====
+
+// Возвращает 1 и кладет ответ в *result, если условие считается по счетчикам
+static int count_from_counters(Condition* cond, int* result) {
+    if (strcmp(cond->field_name, "status") == 0) {
+        if (cond->set) {
+            int in = 0;
+            for (int j = 0; j < 6; j++) {
+                if (value_set_has_int(cond->set, j)) in += status_counts[j];
+            }
+            *result = strcmp(cond->oper, "in") == 0 ? in : table_row_count() - in;
+            return 1;
+        }
+        Status val;
+        // Как и в check_condition, некорректное значение не подходит ни одной строке
+        if (!pars_status(cond->value_str, &val)) *result = 0;
+        else if (strcmp(cond->oper, "=") == 0) *result = status_counts[val];
+        else if (strcmp(cond->oper, "!=") == 0) *result = table_row_count() - status_counts[val];
+        else *result = 0;
+        return 1;
+    }
+
+    if (strcmp(cond->field_name, "priority") == 0) {
+        int val;
+        if (strcmp(cond->oper, "=") != 0 && strcmp(cond->oper, "!=") != 0) return 0;
+        if (!diapozon_int(cond->value_str, &val)) *result = 0;
+        else if (strcmp(cond->oper, "=") == 0) *result = priority_count_get(val);
+        else *result = table_row_count() - priority_count_get(val);
+        return 1;
+    }
+
+    return 0;
+}
+
+static void count_cmd(const char* args, const char* full_command, FILE* output) {
+    if (!args || !*args) {
+        fprintf(output, "count:%d\n", table_row_count());
+        return;
+    }
+
+    char* args_copy = (char*)scratch_alloc(strlen(args) + 1);
+    if (!args_copy) {
+        print_incorrect(output, full_command);
+        return;
+    }
+    strcpy(args_copy, args);
+
+    Condition* conditions = (Condition*)scratch_alloc(100 * sizeof(Condition));
+    if (!conditions) {
+        print_incorrect(output, full_command);
+        return;
+    }
+
+    int cond_count = 0;
+    int error = 0;
+
+    char* save = NULL;
+    char* token = strtok_r(args_copy, " \t", &save);
+    while (token) {
+        if (!parse_condition(token, &conditions[cond_count])) {
+            error = 1;
+            break;
+        }
+        cond_count++;
+        token = strtok_r(NULL, " \t", &save);
+    }
+
+    if (error) {
+        print_incorrect(output, full_command);
+        return;
+    }
+
+    int found = 0;
+    // Счетчики описывают живую таблицу, а не снимок
+    if (bloom_excludes(conditions, cond_count)) found = 0;
+    else if (reader_snapshot || !(cond_count == 1 && count_from_counters(&conditions[0], &found))) {
+        if (shards_match(conditions, cond_count)) {
+            found = shards_match_count();
+        }
+        else {
+            // Произвольные условия - обычный проход (или отрезок по ведущему ключу сортировки)
+            PackedScan packed;
+            packed_scan_begin(&packed, conditions, cond_count);
+            while (packed_scan_next(&packed) != NULL) found++;
+            TableScan scan;
+            scan_begin(&scan, conditions, cond_count);
+            while (scan_next(&scan) != NULL) found++;
+        }
+    }
+
+    fprintf(output, "count:%d\n", found);
+}
+
+// ===== SHARDS =====
+
+// shards N: распределить отбор строк по хешу pid между N потоками (0 или 1 - выключить)
+static void shards_cmd(const char* args, const char* full_command, FILE* output) {
+    int count;
+    if (!args || !diapozon_int(args, &count) || count < 0 || count > MAX_SHARDS) {
+        print_incorrect(output, full_command);
+        return;
+    }
+    if (count <= 1) count = 0;
+    // Шарды делят только список - со сжатыми блоками не совмещаются
+    if (count > 0 && compress_mode) {
+        print_incorrect(output, full_command);
+        return;
+    }
+    if (count != shard_count) {
+        shards_stop();
+        if (count > 0 && !shards_start(count)) {
+            print_incorrect(output, full_command);
+            return;
+        }
+    }
+    fprintf(output, "shards:%d\n", shard_count);
+}
+
+// ===== ANALYZE =====
+
+// analyze: собрать статистику полей для планировщика условий
+static void analyze_cmd(const char* args, const char* full_command, FILE* output) {
+    if (args && *args) {
+        print_incorrect(output, full_command);
+        return;
+    }
+    if (!stats_analyze()) {
+        print_incorrect(output, full_command);
+        return;
+    }
+    fprintf(output, "analyze:%d\n", table_stats.rows);
+}
+
+// ===== ПЛАНИРОВЩИК ЧИТАЮЩИХ КОМАНД =====
+
+// В режиме workers <N> подряд идущие select, count и aggregate не выполняются сразу, а
+// копятся в пачку. Изменяющая команда (и любая другая, кроме чтения) - барьер: перед ней
+// пачка выполняется параллельно на N потоках (основной поток - один из них) на общем
+// закрепленном снимке, а вывод команд переносится в output в исходном порядке. Пока пачка
+// выполняется, таблица не меняется, поэтому результат побайтно совпадает с
+// последовательным. Задачи раздаются потокам непрерывными кусками; поток берет задачи
+// из конца своего куска, а освободившийся крадет из начала чужого.
+
+#define SCHED_MAX_WORKERS 16
+#define SCHED_BATCH_SIZE 256
+
+typedef void (*CommandFunc)(const char* args, const char* full_command, FILE* output);
+
+typedef struct {
+    CommandFunc func;
+    char* line;         // копия строки команды
+    const char* args;   // указывает внутрь line
+    long length;        // сколько байт команда записала в свой файл
+} SchedTask;
+
+typedef struct {
+    mutex_t lock;
+    int lo;             // [lo, hi) - еще не взятые задачи куска
+    int hi;
+    int index;
+    thread_t thread;
+    ThreadStart start;
+} SchedWorker;
+
+static SchedTask sched_tasks[SCHED_BATCH_SIZE];
+static FILE* sched_files[SCHED_BATCH_SIZE];    // вывод задачи; файлы переиспользуются между пачками
+static int sched_task_count = 0;
+static SchedWorker sched_pool[SCHED_MAX_WORKERS];
+static int sched_workers = 0;
+static mutex_t sched_lock;
+static cond_t sched_wake;
+static cond_t sched_done;
+static int sched_round = 0;
+static int sched_active = 0;        // потоки пула, еще не закончившие пачку
+static int sched_stopping = 0;
+static TableSnapshot* sched_snapshot = NULL;
+static volatile long sched_steals = 0;
+static long sched_batches = 0;
+
+// Номер следующей задачи для потока self; -1 - задачи кончились везде
+static int sched_take(SchedWorker* self) {
+    int task = -1;
+    mutex_lock(&self->lock);
+    if (self->lo < self->hi) task = --self->hi;
+    mutex_unlock(&self->lock);
+    for (int k = 1; task < 0 && k < sched_workers; k++) {
+        SchedWorker* victim = &sched_pool[(self->index + k) % sched_workers];
+        mutex_lock(&victim->lock);
+        if (victim->lo < victim->hi) task = victim->lo++;
+        mutex_unlock(&victim->lock);
+        if (task >= 0) atomic_add(&sched_steals, 1);
+    }
+    return task;
+}
+
+static void sched_work(SchedWorker* self) {
+    reader_snapshot = sched_snapshot;
+    int i;
+    while ((i = sched_take(self)) >= 0) {
+        SchedTask* task = &sched_tasks[i];
+        ScratchMark mark = scratch_mark();
+        task->func(task->args, task->line, sched_files[i]);
+        task->length = ftell(sched_files[i]);
+        scratch_reset(mark);
+    }
+    reader_snapshot = NULL;
+}
+
+static void sched_thread(void* arg) {
+    SchedWorker* self = (SchedWorker*)arg;
+    int seen = 0;
+    mutex_lock(&sched_lock);
+    for (;;) {
+        while (sched_round == seen && !sched_stopping) cond_wait(&sched_wake, &sched_lock);
+        if (sched_stopping) break;
+        seen = sched_round;
+        mutex_unlock(&sched_lock);
+        sched_work(self);
+        mutex_lock(&sched_lock);
+        if (--sched_active == 0) cond_signal(&sched_done);
+    }
+    mutex_unlock(&sched_lock);
+    scratch_release();
+}
+
+static void copy_prefix(FILE* from, long length, FILE* to) {
+    char buffer[4096];
+    rewind(from);
+    while (length > 0) {
+        size_t n = fread(buffer, 1, length < (long)sizeof(buffer) ? (size_t)length : sizeof(buffer), from);
+        if (n == 0) break;
+        fwrite(buffer, 1, n, to);
+        length -= (long)n;
+    }
+}
+
+// Выполняет накопленную пачку и выводит результаты по порядку
+static void sched_flush(FILE* output) {
+    int count = sched_task_count;
+    if (count == 0) return;
+    sched_task_count = 0;
+    // Одну команду дешевле выполнить прямо по таблице, чем строить для нее снимок
+    sched_snapshot = count > 1 ? snapshot_acquire() : NULL;
+    if (sched_snapshot == NULL) {
+        for (int i = 0; i < count; i++) {
+            SchedTask* task = &sched_tasks[i];
+            task->func(task->args, task->line, output);
+            my_free(task->line);
+        }
+        return;
+    }
+
+    for (int i = 0; i < count; i++) rewind(sched_files[i]);
+    for (int w = 0; w < sched_workers; w++) {
+        sched_pool[w].lo = (int)((long long)count * w / sched_workers);
+        sched_pool[w].hi = (int)((long long)count * (w + 1) / sched_workers);
+    }
+    mutex_lock(&sched_lock);
+    sched_active = sched_workers - 1;
+    sched_round++;
+    cond_broadcast(&sched_wake);
+    mutex_unlock(&sched_lock);
+
+    sched_work(&sched_pool[0]);
+    mutex_lock(&sched_lock);
+    // Поток выходит из sched_work, только когда задач не осталось ни у кого
+    while (sched_active > 0) cond_wait(&sched_done, &sched_lock);
+    mutex_unlock(&sched_lock);
+
+    snapshot_release(sched_snapshot);
+    sched_snapshot = NULL;
+    reclaim_snapshots();
+    for (int i = 0; i < count; i++) {
+        copy_prefix(sched_files[i], sched_tasks[i].length, output);
+        my_free(sched_tasks[i].line);
     }
+    sched_batches++;
+}
+
+// Откладывает читающую команду; 0 - не удалось, команду надо выполнить сразу
+static int sched_add(CommandFunc func, const char* args, const char* line, FILE* output) {
+    if (sched_task_count == SCHED_BATCH_SIZE) sched_flush(output);
+    int i = sched_task_count;
+    if (sched_files[i] == NULL) sched_files[i] = tmpfile();
+    SchedTask* task = &sched_tasks[i];
+    task->line = sched_files[i] ? (char*)my_malloc(strlen(line) + 1) : NULL;
+    if (task->line == NULL) return 0;
+    strcpy(task->line, line);
+    task->args = task->line + (args - line);
+    task->func = func;
+    task->length = 0;
+    sched_task_count++;
     return 1;
 }
 
-// ===== ПАРСИНГ СПИСКА ПОЛЕЙ =====
+static void sched_stop() {
+    if (sched_workers == 0) return;
+    mutex_lock(&sched_lock);
+    sched_stopping = 1;
+    cond_broadcast(&sched_wake);
+    mutex_unlock(&sched_lock);
+    for (int w = 1; w < sched_workers; w++) thread_join(sched_pool[w].thread);
+    for (int w = 0; w < sched_workers; w++) mutex_destroy(&sched_pool[w].lock);
+    mutex_destroy(&sched_lock);
+    cond_destroy(&sched_wake);
+    cond_destroy(&sched_done);
+    for (int i = 0; i < SCHED_BATCH_SIZE; i++) {
+        if (sched_files[i]) fclose(sched_files[i]);
+        sched_files[i] = NULL;
+    }
+    sched_workers = 0;
+    sched_stopping = 0;
+}
 
-char** parse_field_list(const char* str, int* count) {
-    if (!str || !*str) {
-        *count = 0;
-        return NULL;
+// Запускает workers - 1 потоков; 0 - не удалось (уже запущенные останавливаются)
+static int sched_start(int workers) {
+    sched_stop();
+    mutex_init(&sched_lock);
+    cond_init(&sched_wake);
+    cond_init(&sched_done);
+    sched_round = 0;
+    for (int w = 0; w < workers; w++) {
+        mutex_init(&sched_pool[w].lock);
+        sched_pool[w].index = w;
+        sched_pool[w].lo = sched_pool[w].hi = 0;
+    }
+    sched_workers = 1;
+    for (int w = 1; w < workers; w++) {
+        sched_pool[w].start.func = sched_thread;
+        sched_pool[w].start.arg = &sched_pool[w];
+        if (!thread_start(&sched_pool[w].thread, &sched_pool[w].start)) {
+            for (int rest = w + 1; rest < workers; rest++) mutex_destroy(&sched_pool[rest].lock);
+            mutex_destroy(&sched_pool[w].lock);
+            sched_stop();
+            return 0;
+        }
+        sched_workers++;
+    }
+    return 1;
+}
+
+// ===== ЧИТАТЕЛИ В ОТДЕЛЬНЫХ ПОТОКАХ =====
+
+// В режиме readers on команды select, count и aggregate выполняются в отдельном потоке
+// на закрепленном снимке, а основной поток сразу переходит к следующим командам, в том
+// числе изменяющим. Вывод отложенных команд копится во временных файлах и переносится
+// в output строго в порядке команд.
+
+#define MAX_PENDING_COMMANDS 16
+
+typedef struct {
+    CommandFunc func;
+    char* line;         // копия строки команды
+    const char* args;   // указывает внутрь line
+    FILE* out;
+    TableSnapshot* snapshot;
+    int threaded;
+    thread_t thread;
+    ThreadStart start;
+} PendingCommand;
+
+static PendingCommand pending[MAX_PENDING_COMMANDS];
+static int pending_count = 0;
+static int readers_mode = 0;
+
+static void reader_thread(void* arg) {
+    PendingCommand* cmd = (PendingCommand*)arg;
+    reader_snapshot = cmd->snapshot;
+    cmd->func(cmd->args, cmd->line, cmd->out);
+    reader_snapshot = NULL;
+    snapshot_release(cmd->snapshot);
+    scratch_release();
+}
+
+static void copy_stream(FILE* from, FILE* to) {
+    char buffer[4096];
+    size_t n;
+    rewind(from);
+    while ((n = fread(buffer, 1, sizeof(buffer), from)) > 0) fwrite(buffer, 1, n, to);
+}
+
+// Дожидается отложенных команд и выводит их результаты по порядку
+static void pending_flush(FILE* output) {
+    sched_flush(output);
+    for (int i = 0; i < pending_count; i++) {
+        PendingCommand* cmd = &pending[i];
+        if (cmd->threaded) thread_join(cmd->thread);
+        copy_stream(cmd->out, output);
+        fclose(cmd->out);
+        my_free(cmd->line);
+    }
+    pending_count = 0;
+    reclaim_snapshots();
+}
+
+static void run_command(CommandFunc func, int is_read, const char* args, const char* line, FILE* output) {
+    if (sched_workers > 0) {
+        if (is_read && sched_add(func, args, line, output)) return;
+        sched_flush(output);
+        func(args, line, output);
+        return;
+    }
+    if (!readers_mode) {
+        if (pending_count > 0) pending_flush(output);
+        func(args, line, output);
+        return;
+    }
+    reclaim_snapshots();
+    if (!is_read && pending_count == 0) {
+        func(args, line, output);
+        return;
+    }
+    if (pending_count == MAX_PENDING_COMMANDS) pending_flush(output);
+
+    // Если читатели еще работают, вывод команды откладывается, чтобы не обогнать их
+    PendingCommand* cmd = &pending[pending_count];
+    cmd->line = (char*)my_malloc(strlen(line) + 1);
+    cmd->out = cmd->line ? tmpfile() : NULL;
+    if (cmd->out == NULL) {
+        my_free(cmd->line);
+        pending_flush(output);
+        func(args, line, output);
+        return;
+    }
+    strcpy(cmd->line, line);
+    cmd->args = cmd->line + (args - line);
+    cmd->func = func;
+    cmd->threaded = 0;
+    pending_count++;
+
+    if (is_read) {
+        cmd->snapshot = snapshot_acquire();
+        if (cmd->snapshot) {
+            cmd->start.func = reader_thread;
+            cmd->start.arg = cmd;
+            cmd->threaded = thread_start(&cmd->thread, &cmd->start);
+            if (!cmd->threaded) snapshot_release(cmd->snapshot);
+        }
+    }
+    if (!cmd->threaded) func(cmd->args, cmd->line, cmd->out);
+}
+
+// readers on|off
+static void readers_cmd(const char* args, const char* full_command, FILE* output) {
+    // Снимки читателей строятся по списку, поэтому readers on несовместим с compress on
+    if (args && strcmp(args, "on") == 0 && !compress_mode && sched_workers == 0) readers_mode = 1;
+    else if (args && strcmp(args, "off") == 0) readers_mode = 0;
+    else {
+        print_incorrect(output, full_command);
+        return;
+    }
+    fprintf(output, "readers:%s\n", readers_mode ? "on" : "off");
+}
+
+static void unknown_cmd(const char* args, const char* full_command, FILE* output) {
+    (void)args;
+    print_incorrect(output, full_command);
+}
+
+// ===== COMPRESS =====
+
+// compress on|off: хранить строки сжатыми блоками (только без readers и shards)
+static void compress_cmd(const char* args, const char* full_command, FILE* output) {
+    if (args && strcmp(args, "on") == 0 && !readers_mode && sched_workers == 0 && shard_count == 0) {
+        compress_mode = 1;
+        packed_compact();
+    }
+    else if (args && strcmp(args, "off") == 0) {
+        if (!packed_expand()) {
+            print_incorrect(output, full_command);
+            return;
+        }
+        compress_mode = 0;
+    }
+    else {
+        print_incorrect(output, full_command);
+        return;
+    }
+    fprintf(output, "compress:%s\n", compress_mode ? "on" : "off");
+}
+
+// pool <КБ>: держать в памяти не больше КБ сжатых блоков, остальные - в файле (0 - выключить)
+static void pool_cmd(const char* args, const char* full_command, FILE* output) {
+    int kb;
+    if (!args || !diapozon_int(args, &kb) || kb < 0 || (kb > 0 && !compress_mode)) {
+        print_incorrect(output, full_command);
+        return;
+    }
+    if (kb > 0 ? !pool_start((long long)kb * 1024) : !pool_stop()) {
+        print_incorrect(output, full_command);
+        return;
+    }
+    fprintf(output, "pool:%d\n", kb);
+}
+
+// ===== SORT_MEMORY =====
+
+// sort_memory <КБ>: сортировать внешним слиянием, если таблица не помещается в КБ (0 - без ограничения)
+static void sort_memory_cmd(const char* args, const char* full_command, FILE* output) {
+    int kb;
+    if (!args || !diapozon_int(args, &kb) || kb < 0) {
+        print_incorrect(output, full_command);
+        return;
+    }
+    sort_memory = (long long)kb * 1024;
+    fprintf(output, "sort_memory:%d\n", kb);
+}
+
+// ===== WORKERS =====
+
+// workers <N>: выполнять подряд идущие читающие команды на N потоках (0 - последовательно)
+static void workers_cmd(const char* args, const char* full_command, FILE* output) {
+    int workers;
+    if (!args || !diapozon_int(args, &workers) || workers < 0 || workers > SCHED_MAX_WORKERS ||
+        (workers > 0 && (readers_mode || compress_mode))) {
+        print_incorrect(output, full_command);
+        return;
+    }
+    if (workers == 0) sched_stop();
+    else if (!sched_start(workers)) {
+        print_incorrect(output, full_command);
+        return;
+    }
+    fprintf(output, "workers:%d\n", workers);
+}
+
+// ===== EXPORT / IMPORT (ФОРМАТ ARROW) =====
+
+// export <файл> / import <файл>: таблица в файловом формате Arrow IPC, который читают
+// pyarrow, DuckDB, Polars и т.п. Колонки: pid, priority, cpu_usage (в сотых долях) - int32,
+// kern_tm и file_tm - time32[s], name - utf8, status - словарь utf8 с индексами int8.
+// Файл: "ARROW1", схема, пачка словаря статусов, пачки строк по ARROW_BATCH_ROWS, метка
+// конца потока, футер с положениями пачек, его длина и снова "ARROW1". Метаданные -
+// flatbuffers, тело пачки - буферы колонок подряд с выравниванием на 8 байт; каждый буфер
+// пишется одним fwrite. Числа - в порядке байт машины, как в ReplicaData (little-endian).
+// import отображает файл в память и берет значения прямо из буферов колонок, без разбора
+// текста; строки добавляются в конец таблицы, только если весь файл прошел проверку
+
+#define ARROW_BATCH_ROWS 65536
+#define ARROW_FIELDS 7
+#define ARROW_BUFFERS 15            // на колонку маска NULL и значения, у name - смещения и байты
+#define ARROW_MAX_DICTIONARY 256
+#define ARROW_V5 4                  // MetadataVersion
+
+enum { ARROW_SCHEMA = 1, ARROW_DICTIONARY = 2, ARROW_RECORD_BATCH = 3 };  // MessageHeader
+enum { ARROW_INT = 2, ARROW_UTF8 = 5, ARROW_TIME = 9 };                    // Type
+
+// Колонки в порядке файла
+typedef enum {
+    ARROW_PID,
+    ARROW_NAME,
+    ARROW_PRIORITY,
+    ARROW_KERN_TM,
+    ARROW_FILE_TM,
+    ARROW_CPU_USAGE,
+    ARROW_STATUS
+} ArrowColumn;
+
+static const char* arrow_names[ARROW_FIELDS] = { "pid", "name", "priority", "kern_tm", "file_tm", "cpu_usage", "status" };
+static const int arrow_types[ARROW_FIELDS] = { ARROW_INT, ARROW_UTF8, ARROW_INT, ARROW_TIME, ARROW_TIME, ARROW_INT, ARROW_UTF8 };
+// Номер первого буфера колонки (маски NULL) в пачке
+static const int arrow_first_buffer[ARROW_FIELDS] = { 0, 2, 5, 7, 9, 11, 13 };
+
+// Buffer и FieldNode из схемы Arrow: два int64
+typedef struct {
+    long long offset;       // FieldNode: длина
+    long long length;       // FieldNode: число NULL
+} ArrowBuffer;
+
+typedef struct {
+    long long offset;
+    int meta_length;        // с маркером и длиной метаданных
+    int padding;
+    long long body_length;
+} ArrowBlock;
+
+// --- Сборка flatbuffers ---
+// Объекты пишутся от начала к концу: родитель раньше детей, а ссылки на детей (по формату
+// всегда вперед) проставляет fb_link, когда ребенок записан
+
+typedef struct {
+    unsigned char* data;
+    size_t len;
+    size_t capacity;
+    int failed;
+} FbBuilder;
+
+// Поле таблицы: значение размером size байт или ссылка (size = 0), место которой вернется в *slot
+typedef struct {
+    int id;
+    int size;
+    long long value;
+    size_t* slot;
+} FbField;
+
+// src == NULL - нули; возвращает положение записанного
+static size_t fb_put(FbBuilder* b, const void* src, size_t size) {
+    if (b->failed) return 0;
+    if (b->len + size > b->capacity) {
+        size_t capacity = b->capacity ? b->capacity * 2 : 1024;
+        while (capacity < b->len + size) capacity *= 2;
+        unsigned char* data = (unsigned char*)my_realloc(b->data, capacity);
+        if (data == NULL) {
+            b->failed = 1;
+            return 0;
+        }
+        b->data = data;
+        b->capacity = capacity;
+    }
+    size_t pos = b->len;
+    if (src) memcpy(b->data + pos, src, size);
+    else memset(b->data + pos, 0, size);
+    b->len += size;
+    return pos;
+}
+
+// Выравнивает так, чтобы через prefix байт началась граница align
+static void fb_align(FbBuilder* b, size_t align, size_t prefix) {
+    while (!b->failed && (b->len + prefix) % align != 0) fb_put(b, NULL, 1);
+}
+
+static void fb_link(FbBuilder* b, size_t slot, size_t target) {
+    if (b->failed) return;
+    unsigned int offset = (unsigned int)(target - slot);
+    memcpy(b->data + slot, &offset, 4);
+}
+
+// Таблица: vtable, за ней сами поля по убыванию размера, каждое выровнено на свой размер
+static size_t fb_table(FbBuilder* b, const FbField* fields, int count) {
+    unsigned short offsets[8];
+    memset(offsets, 0, sizeof(offsets));
+    int max_id = -1;
+    unsigned short table_size = 4;
+    for (int size = 8; size >= 1; size /= 2) {
+        for (int i = 0; i < count; i++) {
+            int field_size = fields[i].size ? fields[i].size : 4;
+            if (field_size != size) continue;
+            table_size = (unsigned short)((table_size + size - 1) & ~(size - 1));
+            offsets[fields[i].id] = table_size;
+            table_size = (unsigned short)(table_size + size);
+            if (fields[i].id > max_id) max_id = fields[i].id;
+        }
     }
 
-    char* temp = (char*)my_malloc(strlen(str) + 1);
-    if (!temp) {
-        *count = 0;
-        return NULL;
+    fb_align(b, 2, 0);
+    unsigned short header[2] = { (unsigned short)(4 + 2 * (max_id + 1)), table_size };
+    size_t vtable = fb_put(b, header, 4);
+    fb_put(b, offsets, 2 * (max_id + 1));
+    fb_align(b, 8, 0);
+    size_t table = fb_put(b, NULL, table_size);
+    for (int i = 0; i < count; i++) {
+        size_t pos = table + offsets[fields[i].id];
+        if (fields[i].size == 0) *fields[i].slot = pos;
+        else if (!b->failed) memcpy(b->data + pos, &fields[i].value, fields[i].size);
+    }
+    if (!b->failed) {
+        int back = (int)(table - vtable);
+        memcpy(b->data + table, &back, 4);
+    }
+    return table;
+}
+
+static size_t fb_string(FbBuilder* b, const char* str) {
+    unsigned int len = (unsigned int)strlen(str);
+    fb_align(b, 4, 0);
+    size_t pos = fb_put(b, &len, 4);
+    fb_put(b, str, len + 1);
+    return pos;
+}
+
+// Вектор из count элементов по size байт, выровненных на align; items == NULL - вектор
+// ссылок, которые потом проставляются fb_link по адресу pos + 4 + 4 * i
+static size_t fb_vector(FbBuilder* b, const void* items, unsigned int count, size_t size, size_t align) {
+    fb_align(b, align, 4);
+    size_t pos = fb_put(b, &count, 4);
+    fb_put(b, items, count * size);
+    return pos;
+}
+
+// --- Метаданные Arrow ---
+
+static size_t arrow_int_type(FbBuilder* b, int bit_width) {
+    FbField fields[] = { { 0, 4, bit_width, NULL }, { 1, 1, 1, NULL } };    // bitWidth, is_signed
+    return fb_table(b, fields, 2);
+}
+
+static size_t arrow_type(FbBuilder* b, int type) {
+    if (type == ARROW_INT) return arrow_int_type(b, 32);
+    if (type == ARROW_TIME) {
+        FbField fields[] = { { 0, 2, 0, NULL }, { 1, 4, 32, NULL } };        // SECOND, bitWidth
+        return fb_table(b, fields, 2);
+    }
+    return fb_table(b, NULL, 0);                                            // Utf8
+}
+
+// Схема таблицы; ссылка на нее пишется в slot
+static void arrow_schema(FbBuilder* b, size_t slot) {
+    size_t fields_slot;
+    FbField schema[] = { { 1, 0, 0, &fields_slot } };
+    fb_link(b, slot, fb_table(b, schema, 1));
+    size_t fields = fb_vector(b, NULL, ARROW_FIELDS, 4, 4);
+    fb_link(b, fields_slot, fields);
+
+    for (int i = 0; i < ARROW_FIELDS; i++) {
+        size_t name_slot, type_slot, children_slot, dictionary_slot;
+        FbField field[] = {
+            { 0, 0, 0, &name_slot },
+            { 1, 1, 0, NULL },                  // nullable
+            { 2, 1, arrow_types[i], NULL },
+            { 3, 0, 0, &type_slot },
+            { 5, 0, 0, &children_slot },
+            { 4, 0, 0, &dictionary_slot }       // только у status
+        };
+        fb_link(b, fields + 4 + 4 * i, fb_table(b, field, i == ARROW_STATUS ? 6 : 5));
+        fb_link(b, name_slot, fb_string(b, arrow_names[i]));
+        fb_link(b, type_slot, arrow_type(b, arrow_types[i]));
+        fb_link(b, children_slot, fb_vector(b, NULL, 0, 4, 4));
+        if (i == ARROW_STATUS) {
+            size_t index_slot;
+            FbField dictionary[] = { { 0, 8, 0, NULL }, { 1, 0, 0, &index_slot } };  // id, indexType
+            fb_link(b, dictionary_slot, fb_table(b, dictionary, 2));
+            fb_link(b, index_slot, arrow_int_type(b, 8));
+        }
+    }
+}
+
+// Начинает сообщение заново; возвращает место ссылки на заголовок
+static size_t arrow_message(FbBuilder* b, int header_type, long long body_length) {
+    b->len = 0;
+    size_t root = fb_put(b, NULL, 4);
+    size_t header_slot;
+    FbField message[] = {
+        { 0, 2, ARROW_V5, NULL },
+        { 1, 1, header_type, NULL },
+        { 2, 0, 0, &header_slot },
+        { 3, 8, body_length, NULL }
+    };
+    fb_link(b, root, fb_table(b, message, 4));
+    return header_slot;
+}
+
+// RecordBatch: все колонки длиной rows без NULL
+static void arrow_record_batch(FbBuilder* b, size_t slot, long long rows, int columns, const ArrowBuffer* buffers, int buffer_count) {
+    size_t nodes_slot, buffers_slot;
+    FbField batch[] = { { 0, 8, rows, NULL }, { 1, 0, 0, &nodes_slot }, { 2, 0, 0, &buffers_slot } };
+    fb_link(b, slot, fb_table(b, batch, 3));
+    ArrowBuffer nodes[ARROW_FIELDS];
+    for (int i = 0; i < columns; i++) {
+        nodes[i].offset = rows;
+        nodes[i].length = 0;
+    }
+    fb_link(b, nodes_slot, fb_vector(b, nodes, columns, sizeof(ArrowBuffer), 8));
+    fb_link(b, buffers_slot, fb_vector(b, buffers, buffer_count, sizeof(ArrowBuffer), 8));
+}
+
+// Раскладывает буферы тела подряд с выравниванием на 8; возвращает длину тела
+static long long arrow_layout(ArrowBuffer* buffers, int count) {
+    long long offset = 0;
+    for (int i = 0; i < count; i++) {
+        buffers[i].offset = offset;
+        offset += (buffers[i].length + 7) & ~7LL;
+    }
+    return offset;
+}
+
+// --- Запись файла ---
+
+typedef struct {
+    FILE* file;
+    long long pos;
+    FbBuilder meta;
+    ArrowBlock dictionary;
+    ArrowBlock* batches;
+    int batch_count;
+    int batch_capacity;
+    int failed;
+} ArrowWriter;
+
+static void arrow_write(ArrowWriter* w, const void* data, size_t size) {
+    if (w->failed || size == 0) return;
+    if (fwrite(data, 1, size, w->file) != size) w->failed = 1;
+    w->pos += (long long)size;
+}
+
+// Сообщение из w->meta и тело из буферов; положение сообщения - в block
+static void arrow_write_message(ArrowWriter* w, const void* const* data, const ArrowBuffer* buffers, int count,
+    long long body_length, ArrowBlock* block) {
+    static const char zeros[8] = { 0 };
+    fb_align(&w->meta, 8, 0);
+    if (w->meta.failed) w->failed = 1;
+    if (w->failed) return;
+    unsigned int prefix[2] = { 0xFFFFFFFFu, (unsigned int)w->meta.len };
+    block->offset = w->pos;
+    block->meta_length = 8 + (int)w->meta.len;
+    block->padding = 0;
+    block->body_length = body_length;
+    arrow_write(w, prefix, sizeof(prefix));
+    arrow_write(w, w->meta.data, w->meta.len);
+    for (int i = 0; i < count; i++) {
+        arrow_write(w, data[i], (size_t)buffers[i].length);
+        arrow_write(w, zeros, (size_t)(-buffers[i].length & 7));
     }
-    strcpy(temp, str);
+}
 
-    *count = 1;
-    for (const char* p = str; *p; p++) {
-        if (*p == ',') (*count)++;
+// Словарь статусов: utf8-колонка из status_names
+static void arrow_write_dictionary(ArrowWriter* w) {
+    int offsets[SLEEPING + 2];
+    char text[64];
+    offsets[0] = 0;
+    for (int i = 0; i <= SLEEPING; i++) {
+        size_t len = strlen(status_names[i]);
+        memcpy(text + offsets[i], status_names[i], len);
+        offsets[i + 1] = offsets[i] + (int)len;
     }
+    ArrowBuffer buffers[3] = { { 0, 0 }, { 0, sizeof(offsets) }, { 0, offsets[SLEEPING + 1] } };
+    const void* data[3] = { NULL, offsets, text };
+    long long body_length = arrow_layout(buffers, 3);
+
+    size_t header_slot = arrow_message(&w->meta, ARROW_DICTIONARY, body_length);
+    size_t data_slot;
+    FbField dictionary[] = { { 0, 8, 0, NULL }, { 1, 0, 0, &data_slot } };      // id, data
+    fb_link(&w->meta, header_slot, fb_table(&w->meta, dictionary, 2));
+    arrow_record_batch(&w->meta, data_slot, SLEEPING + 1, 1, buffers, 3);
+    arrow_write_message(w, data, buffers, 3, body_length, &w->dictionary);
+}
 
-    char** result = (char**)my_malloc(*count * sizeof(char*));
-    if (!result) {
-        my_free(temp);
-        *count = 0;
-        return NULL;
+// Колонки одной пачки
+typedef struct {
+    int* ints;                  // pid, priority, kern_tm, file_tm, cpu_usage по ARROW_BATCH_ROWS
+    int* name_offsets;
+    signed char* statuses;
+    char* names;
+    size_t names_capacity;
+} ArrowColumns;
+
+// Пишет строки начиная с proc (не больше ARROW_BATCH_ROWS); возвращает следующую строку
+static Process* arrow_write_batch(ArrowWriter* w, ArrowColumns* c, Process* proc, int* rows) {
+    int* pid = c->ints;
+    int* priority = pid + ARROW_BATCH_ROWS;
+    int* kern_tm = priority + ARROW_BATCH_ROWS;
+    int* file_tm = kern_tm + ARROW_BATCH_ROWS;
+    int* cpu_usage = file_tm + ARROW_BATCH_ROWS;
+    size_t names_len = 0;
+    int n = 0;
+    c->name_offsets[0] = 0;
+    for (; proc && n < ARROW_BATCH_ROWS; proc = proc->next, n++) {
+        pid[n] = proc->pid;
+        priority[n] = proc->priority;
+        kern_tm[n] = proc->kern_tm.hour * 3600 + proc->kern_tm.minute * 60 + proc->kern_tm.second;
+        file_tm[n] = proc->file_tm.hour * 3600 + proc->file_tm.minute * 60 + proc->file_tm.second;
+        cpu_usage[n] = proc->cpu_usage;
+        c->statuses[n] = (signed char)proc->status;
+
+        const char* name = name_text(&proc->name);
+        size_t len = name ? strlen(name) : 0;
+        if (names_len + len > c->names_capacity) {
+            size_t capacity = c->names_capacity ? c->names_capacity * 2 : 64 * 1024;
+            while (capacity < names_len + len) capacity *= 2;
+            char* names = (char*)my_realloc(c->names, capacity);
+            if (names == NULL || capacity > INT_MAX) {
+                if (names) c->names = names;
+                w->failed = 1;
+                return NULL;
+            }
+            c->names = names;
+            c->names_capacity = capacity;
+        }
+        if (len > 0) memcpy(c->names + names_len, name, len);
+        names_len += len;
+        c->name_offsets[n + 1] = (int)names_len;
     }
 
-    int idx = 0;
-    char* token = strtok(temp, ",");
-    while (token && idx < *count) {
-        while (*token == ' ') token++;
-        char* end = token + strlen(token) - 1;
-        while (end > token && (*end == ' ' || *end == '\t')) *end-- = '\0';
-        result[idx] = (char*)my_malloc(strlen(token) + 1);
-        if (result[idx]) strcpy(result[idx], token);
-        idx++;
-        token = strtok(NULL, ",");
+    ArrowBuffer buffers[ARROW_BUFFERS];
+    const void* data[ARROW_BUFFERS];
+    memset(buffers, 0, sizeof(buffers));
+    memset(data, 0, sizeof(data));
+    const int* ints[ARROW_FIELDS] = { pid, NULL, priority, kern_tm, file_tm, cpu_usage, NULL };
+    for (int i = 0; i < ARROW_FIELDS; i++) {
+        int values = arrow_first_buffer[i] + 1;
+        if (ints[i]) {
+            data[values] = ints[i];
+            buffers[values].length = (long long)n * 4;
+        }
     }
+    data[arrow_first_buffer[ARROW_NAME] + 1] = c->name_offsets;
+    buffers[arrow_first_buffer[ARROW_NAME] + 1].length = (long long)(n + 1) * 4;
+    data[arrow_first_buffer[ARROW_NAME] + 2] = c->names;
+    buffers[arrow_first_buffer[ARROW_NAME] + 2].length = (long long)names_len;
+    data[arrow_first_buffer[ARROW_STATUS] + 1] = c->statuses;
+    buffers[arrow_first_buffer[ARROW_STATUS] + 1].length = n;
+    long long body_length = arrow_layout(buffers, ARROW_BUFFERS);
+
+    if (w->batch_count == w->batch_capacity) {
+        int capacity = w->batch_capacity ? w->batch_capacity * 2 : 16;
+        ArrowBlock* batches = (ArrowBlock*)my_realloc(w->batches, capacity * sizeof(ArrowBlock));
+        if (batches == NULL) {
+            w->failed = 1;
+            return NULL;
+        }
+        w->batches = batches;
+        w->batch_capacity = capacity;
+    }
+    size_t header_slot = arrow_message(&w->meta, ARROW_RECORD_BATCH, body_length);
+    arrow_record_batch(&w->meta, header_slot, n, ARROW_FIELDS, buffers, ARROW_BUFFERS);
+    arrow_write_message(w, data, buffers, ARROW_BUFFERS, body_length, &w->batches[w->batch_count++]);
+    *rows += n;
+    return proc;
+}
 
-    my_free(temp);
-    return result;
+// Пишет всю таблицу (список, сжатые блоки уже развернуты); возвращает число строк
+static int arrow_export(ArrowWriter* w) {
+    arrow_write(w, "ARROW1\0\0", 8);
+    ArrowBlock schema_block;
+    arrow_schema(&w->meta, arrow_message(&w->meta, ARROW_SCHEMA, 0));
+    arrow_write_message(w, NULL, NULL, 0, 0, &schema_block);
+    arrow_write_dictionary(w);
+
+    ArrowColumns c;
+    memset(&c, 0, sizeof(c));
+    c.ints = (int*)my_malloc((size_t)ARROW_BATCH_ROWS * 5 * sizeof(int));
+    c.name_offsets = (int*)my_malloc((ARROW_BATCH_ROWS + 1) * sizeof(int));
+    c.statuses = (signed char*)my_malloc(ARROW_BATCH_ROWS);
+    if (!c.ints || !c.name_offsets || !c.statuses) w->failed = 1;
+    int rows = 0;
+    Process* proc = head;
+    // Пустая таблица - одна пачка без строк, чтобы у читателей была хотя бы одна
+    do {
+        proc = arrow_write_batch(w, &c, proc, &rows);
+    } while (proc && !w->failed);
+    my_free(c.ints);
+    my_free(c.name_offsets);
+    my_free(c.statuses);
+    my_free(c.names);
+
+    // Метка конца потока и футер: версия, схема, положения словаря и пачек
+    unsigned int end_of_stream[2] = { 0xFFFFFFFFu, 0 };
+    arrow_write(w, end_of_stream, sizeof(end_of_stream));
+    FbBuilder* b = &w->meta;
+    b->len = 0;
+    size_t root = fb_put(b, NULL, 4);
+    size_t schema_slot, dictionaries_slot, batches_slot;
+    FbField footer[] = {
+        { 0, 2, ARROW_V5, NULL },
+        { 1, 0, 0, &schema_slot },
+        { 2, 0, 0, &dictionaries_slot },
+        { 3, 0, 0, &batches_slot }
+    };
+    fb_link(b, root, fb_table(b, footer, 4));
+    arrow_schema(b, schema_slot);
+    fb_link(b, dictionaries_slot, fb_vector(b, &w->dictionary, 1, sizeof(ArrowBlock), 8));
+    fb_link(b, batches_slot, fb_vector(b, w->batches, w->batch_count, sizeof(ArrowBlock), 8));
+    if (b->failed) w->failed = 1;
+    if (w->failed) return rows;
+    int footer_len = (int)b->len;
+    arrow_write(w, b->data, b->len);
+    arrow_write(w, &footer_len, 4);
+    arrow_write(w, "ARROW1", 6);
+    return rows;
 }
 
-void free_field_list(char** list, int count) {
-    if (!list) return;
-    for (int i = 0; i < count; i++) {
-        if (list[i]) my_free(list[i]);
+// --- Чтение flatbuffers с проверкой границ ---
+
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+    int failed;
+} FbReader;
+
+static unsigned long long fb_read(FbReader* r, size_t pos, size_t size) {
+    unsigned long long value = 0;
+    if (pos > r->size || r->size - pos < size) {
+        r->failed = 1;
+        return 0;
     }
-    my_free(list);
+    memcpy(&value, r->data + pos, size);
+    return value;
 }
 
-// ===== INSERT =====
-// ===== INSERT (ИСПРАВЛЕННАЯ) =====
-void insert(const char* args, const char* full_command, FILE* output) {
-    // Создаем процесс
-    Process* proc = creation_process();
-    if (!proc) {
-        print_incorrect(output, full_command);
-        return;
+// Положение поля id таблицы; 0 - поля нет
+static size_t fb_field(FbReader* r, size_t table, int id) {
+    if (table == 0) return 0;
+    long long vtable = (long long)table - (int)fb_read(r, table, 4);
+    if (vtable < 0) {
+        r->failed = 1;
+        return 0;
     }
+    unsigned int vtable_size = (unsigned int)fb_read(r, (size_t)vtable, 2);
+    if (4 + 2 * (unsigned int)id + 2 > vtable_size) return 0;
+    unsigned int offset = (unsigned int)fb_read(r, (size_t)vtable + 4 + 2 * id, 2);
+    return offset ? table + offset : 0;
+}
 
-    // Флаги для отслеживания полей
-    int pid_set = 0, name_set = 0, priority_set = 0;
-    int kern_set = 0, file_set = 0, cpu_set = 0, status_set = 0;
-    int fields_found = 0;
+static long long fb_scalar(FbReader* r, size_t table, int id, size_t size, long long def) {
+    size_t pos = fb_field(r, table, id);
+    if (pos == 0) return def;
+    unsigned long long value = fb_read(r, pos, size);
+    if (size == 1) return (unsigned char)value;
+    if (size == 2) return (short)value;
+    if (size == 4) return (int)value;
+    return (long long)value;
+}
 
-    const char* p = args;
-    // Пропускаем начальные пробелы
-    while (*p == ' ') p++;
+// Таблица, вектор или строка по ссылке pos; 0 - ссылка за пределами буфера
+static size_t fb_deref(FbReader* r, size_t pos) {
+    size_t target = pos + (size_t)fb_read(r, pos, 4);
+    if (target >= r->size) {
+        r->failed = 1;
+        return 0;
+    }
+    return target;
+}
 
-    // Основной цикл парсинга
-    while (*p) {
-        // Парсим имя поля
-        char field_name[50] = { 0 };
-        int i = 0;
-        while (*p && *p != '=' && i < 49) {
-            field_name[i++] = *p;
-            p++;
-        }
-        if (*p != '=') {
-            free_process(proc);
-            print_incorrect(output, full_command);
-            return;
-        }
-        field_name[i] = '\0';
-        // Убираем пробелы в конце имени поля
-        char* end = field_name + strlen(field_name) - 1;
-        while (end > field_name && (*end == ' ' || *end == '\t')) *end-- = '\0';
+static size_t fb_ref(FbReader* r, size_t table, int id) {
+    size_t pos = fb_field(r, table, id);
+    return pos ? fb_deref(r, pos) : 0;
+}
 
-        p++; // Пропускаем '='
+// Число элементов вектора по size байт (элементы - с vector + 4); -1 - вектор не помещается
+static long long fb_vector_len(FbReader* r, size_t vector, size_t size) {
+    if (vector == 0) return -1;
+    unsigned long long count = fb_read(r, vector, 4);
+    if (r->failed || (r->size - vector - 4) / size < count) return -1;
+    return (long long)count;
+}
 
-        // Пропускаем пробелы перед значением
-        while (*p == ' ') p++;
+static int fb_string_is(FbReader* r, size_t str, const char* text) {
+    size_t len = strlen(text);
+    return fb_vector_len(r, str, 1) == (long long)len && memcmp(r->data + str + 4, text, len) == 0;
+}
 
-        // Запоминаем начало значения
-        const char* value_start = p;
-        char delimiter = 0;
+// --- Загрузка файла ---
 
-        // Определяем тип значения по первому символу
-        if (*p == '"') {
-            delimiter = '"';
-            p++; // Пропускаем открывающую кавычку
-            // Ищем закрывающую кавычку с учетом экранирования
-            while (*p) {
-                if (*p == '\\') {
-                    p += 2; // ВАЖНО: пропускаем \ и следующий символ
-                    continue;
-                }
-                if (*p == '"') {
-                    p++; // Нашли закрывающую кавычку
-                    break;
-                }
-                p++;
-            }
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+    long long dictionary_id;
+    int index_width;            // байт на индекс статуса
+    int index_signed;
+    int dictionary_size;        // -1 - словаря еще не было
+    int status_map[ARROW_MAX_DICTIONARY];  // индекс словаря -> Status, -1 - не статус
+    Process* first;             // прочитанные строки
+    Process* last;
+    int rows;
+} ArrowReader;
+
+// Проверяет, что схема файла совпадает со схемой таблицы
+static int arrow_check_schema(ArrowReader* a, FbReader* r, size_t schema) {
+    if (schema == 0 || fb_scalar(r, schema, 0, 2, 0) != 0) return 0;   // только little-endian
+    size_t fields = fb_ref(r, schema, 1);
+    if (fb_vector_len(r, fields, 4) != ARROW_FIELDS) return 0;
+    for (int i = 0; i < ARROW_FIELDS; i++) {
+        size_t field = fb_deref(r, fields + 4 + 4 * i);
+        if (field == 0 || !fb_string_is(r, fb_ref(r, field, 0), arrow_names[i]) ||
+            fb_scalar(r, field, 2, 1, 0) != arrow_types[i]) {
+            return 0;
         }
-        else if (*p == '\'') {
-            delimiter = '\'';
-            p++; // Пропускаем открывающую кавычку
-            while (*p && *p != '\'') {
-                p++;
-            }
-            if (*p == '\'') p++; // Пропускаем закрывающую кавычку
+        size_t type = fb_ref(r, field, 3);
+        if (arrow_types[i] == ARROW_INT &&
+            (fb_scalar(r, type, 0, 4, 0) != 32 || fb_scalar(r, type, 1, 1, 0) != 1)) {
+            return 0;
         }
-        else {
-            // Числовое значение - идем до запятой или конца строки
-            while (*p && *p != ',') {
-                p++;
-            }
+        // Time: unit по умолчанию MILLISECOND
+        if (arrow_types[i] == ARROW_TIME &&
+            (fb_scalar(r, type, 0, 2, 1) != 0 || fb_scalar(r, type, 1, 4, 32) != 32)) {
+            return 0;
         }
-
-        // Копируем значение
-        const char* value_end = p;
-        ptrdiff_t diff = value_end - value_start;
-        int value_len = (int)diff;
-        char value_str[256] = { 0 };
-        if (value_len <= 0 || value_len >= 255) {
-            free_process(proc);
-            print_incorrect(output, full_command);
-            return;
+        size_t dictionary = fb_ref(r, field, 4);
+        if ((dictionary != 0) != (i == ARROW_STATUS)) return 0;
+        if (dictionary) {
+            a->dictionary_id = fb_scalar(r, dictionary, 0, 8, 0);
+            // Без indexType индексы - int32
+            size_t index = fb_ref(r, dictionary, 1);
+            int bits = index ? (int)fb_scalar(r, index, 0, 4, 0) : 32;
+            if (bits != 8 && bits != 16 && bits != 32) return 0;
+            a->index_width = bits / 8;
+            a->index_signed = index ? (int)fb_scalar(r, index, 1, 1, 0) : 1;
         }
-        strncpy(value_str, value_start, value_len);
-        value_str[value_len] = '\0';
+    }
+    return !r->failed;
+}
 
-        // Обработка поля
-        if (strcmp(field_name, "pid") == 0) {
-            if (pid_set++) goto error;
-            if (!diapozon_int(value_str, &proc->pid)) goto error;
-            fields_found++;
-        }
-        else if (strcmp(field_name, "name") == 0) {
-            if (name_set++) goto error;
-            proc->name = pars_str(value_str);
-            if (!proc->name) goto error;
-            fields_found++;
-        }
-        else if (strcmp(field_name, "priority") == 0) {
-            if (priority_set++) goto error;
-            if (!diapozon_int(value_str, &proc->priority)) goto error;
-            fields_found++;
-        }
-        else if (strcmp(field_name, "kern_tm") == 0) {
-            if (kern_set++) goto error;
-            if (!pars_time(value_str, &proc->kern_tm)) goto error;
-            fields_found++;
-        }
-        else if (strcmp(field_name, "file_tm") == 0) {
-            if (file_set++) goto error;
-            if (!pars_time(value_str, &proc->file_tm)) goto error;
-            fields_found++;
-        }
-        else if (strcmp(field_name, "cpu_usage") == 0) {
-            if (cpu_set++) goto error;
-            if (!pars_decimal(value_str, &proc->cpu_usage)) goto error;
-            fields_found++;
-        }
-        else if (strcmp(field_name, "status") == 0) {
-            if (status_set++) goto error;
-            if (!pars_status(value_str, &proc->status)) goto error;
-            fields_found++;
-        }
-        else {
-            goto error; // Неизвестное поле
-        }
+// Находит сообщение блока footer_block; метаданные - в meta, тело - body/body_length.
+// Возвращает заголовок сообщения нужного типа или 0
+static size_t arrow_read_message(ArrowReader* a, FbReader* footer, size_t footer_block, int header_type,
+    FbReader* meta, const unsigned char** body, long long* body_length) {
+    unsigned long long offset = fb_read(footer, footer_block, 8);
+    unsigned long long meta_length = (unsigned int)fb_read(footer, footer_block + 8, 4);
+    unsigned long long length = fb_read(footer, footer_block + 16, 8);
+    if (footer->failed || meta_length < 8 || offset > a->size || a->size - offset < meta_length ||
+        a->size - offset - meta_length < length) {
+        return 0;
+    }
+    FbReader prefix = { a->data + offset, (size_t)meta_length, 0 };
+    unsigned int flatbuffer_size = (unsigned int)fb_read(&prefix, 4, 4);
+    if (fb_read(&prefix, 0, 4) != 0xFFFFFFFFu || flatbuffer_size > meta_length - 8) return 0;
+    meta->data = a->data + offset + 8;
+    meta->size = flatbuffer_size;
+    meta->failed = 0;
+    *body = a->data + offset + meta_length;
+    *body_length = (long long)length;
+
+    size_t message = fb_deref(meta, 0);
+    if (message == 0 || fb_scalar(meta, message, 1, 1, 0) != header_type) return 0;
+    return fb_ref(meta, message, 2);
+}
 
-        // Пропускаем пробелы после значения
-        while (*p == ' ') p++;
-        // Проверяем запятую
-        if (*p == ',') {
-            p++;
-            while (*p == ' ') p++;
+// Проверяет RecordBatch: columns колонок без NULL и сжатия, buffer_count буферов в пределах тела
+static long long arrow_batch_buffers(FbReader* meta, size_t batch, const unsigned char* body, long long body_length,
+    int columns, int buffer_count, const unsigned char** buffers, long long* lengths) {
+    long long rows = fb_scalar(meta, batch, 0, 8, 0);
+    if (batch == 0 || rows < 0 || rows > INT_MAX || fb_field(meta, batch, 3) != 0) return -1;
+    size_t nodes = fb_ref(meta, batch, 1);
+    size_t vector = fb_ref(meta, batch, 2);
+    if (fb_vector_len(meta, nodes, 16) != columns || fb_vector_len(meta, vector, 16) != buffer_count) return -1;
+    for (int i = 0; i < columns; i++) {
+        if ((long long)fb_read(meta, nodes + 4 + 16 * i, 8) != rows || fb_read(meta, nodes + 12 + 16 * i, 8) != 0) {
+            return -1;
         }
-        else if (*p != '\0') {
-            goto error; // Ожидалась запятая или конец строки
+    }
+    for (int i = 0; i < buffer_count; i++) {
+        long long offset = (long long)fb_read(meta, vector + 4 + 16 * i, 8);
+        lengths[i] = (long long)fb_read(meta, vector + 12 + 16 * i, 8);
+        if (offset < 0 || lengths[i] < 0 || offset > body_length || body_length - offset < lengths[i]) return -1;
+        buffers[i] = body + offset;
+    }
+    return meta->failed ? -1 : rows;
+}
+
+static int arrow_int32(const unsigned char* values, long long i) {
+    int value;
+    memcpy(&value, values + 4 * i, 4);
+    return value;
+}
+
+// Колонка utf8: offsets - n + 1 смещение в bytes; 0 - смещения выходят за bytes
+static int arrow_utf8_at(const unsigned char* offsets, const unsigned char* bytes, long long bytes_length,
+    long long i, const char** str, size_t* len) {
+    int start = arrow_int32(offsets, i);
+    int end = arrow_int32(offsets, i + 1);
+    if (start < 0 || end < start || end > bytes_length) return 0;
+    *str = (const char*)bytes + start;
+    *len = (size_t)(end - start);
+    return 1;
+}
+
+static int arrow_read_dictionary(ArrowReader* a, FbReader* footer, size_t footer_block) {
+    FbReader meta;
+    const unsigned char* body;
+    long long body_length;
+    size_t dictionary = arrow_read_message(a, footer, footer_block, ARROW_DICTIONARY, &meta, &body, &body_length);
+    // Дельта-словари не поддерживаются: каждый словарь заменяет предыдущий
+    if (dictionary == 0 || fb_scalar(&meta, dictionary, 0, 8, 0) != a->dictionary_id ||
+        fb_scalar(&meta, dictionary, 2, 1, 0) != 0) {
+        return 0;
+    }
+    const unsigned char* buffers[3];
+    long long lengths[3];
+    long long count = arrow_batch_buffers(&meta, fb_ref(&meta, dictionary, 1), body, body_length, 1, 3, buffers, lengths);
+    if (count < 0 || count > ARROW_MAX_DICTIONARY || (count > 0 && lengths[1] < (count + 1) * 4)) return 0;
+    for (long long i = 0; i < count; i++) {
+        const char* str;
+        size_t len;
+        if (!arrow_utf8_at(buffers[1], buffers[2], lengths[2], i, &str, &len)) return 0;
+        a->status_map[i] = -1;
+        for (int status = 0; status <= SLEEPING; status++) {
+            if (strlen(status_names[status]) == len && memcmp(status_names[status], str, len) == 0) {
+                a->status_map[i] = status;
+            }
         }
     }
+    a->dictionary_size = (int)count;
+    return 1;
+}
 
-    // Проверяем, что все 7 полей заполнены
-    if (fields_found != 7) {
-        goto error;
+// Индекс словаря шириной width байт
+static long long arrow_index(const unsigned char* values, long long i, int width, int is_signed) {
+    if (width == 1) return is_signed ? (long long)(signed char)values[i] : (long long)values[i];
+    if (width == 2) {
+        unsigned short value;
+        memcpy(&value, values + 2 * i, 2);
+        return is_signed ? (long long)(short)value : (long long)value;
     }
+    unsigned int value;
+    memcpy(&value, values + 4 * i, 4);
+    return is_signed ? (long long)(int)value : (long long)value;
+}
 
-    // Успех - добавляем процесс
-    append_process(proc);
-    fprintf(output, "insert:%d\n", process_count);
-    return;
+// Время из секунд от полуночи; 0 - вне суток
+static int arrow_time(int seconds, Time* t) {
+    if (seconds < 0 || seconds >= 24 * 3600) return 0;
+    t->hour = (unsigned short)(seconds / 3600);
+    t->minute = (unsigned short)(seconds / 60 % 60);
+    t->second = (unsigned short)(seconds % 60);
+    return 1;
+}
 
-error:
-    free_process(proc);
-    print_incorrect(output, full_command);
+// Читает пачку строк в цепочку a->first..a->last
+static int arrow_read_batch(ArrowReader* a, FbReader* footer, size_t footer_block) {
+    FbReader meta;
+    const unsigned char* body;
+    long long body_length;
+    size_t batch = arrow_read_message(a, footer, footer_block, ARROW_RECORD_BATCH, &meta, &body, &body_length);
+    const unsigned char* buffers[ARROW_BUFFERS];
+    long long lengths[ARROW_BUFFERS];
+    long long rows = arrow_batch_buffers(&meta, batch, body, body_length, ARROW_FIELDS, ARROW_BUFFERS, buffers, lengths);
+    if (rows < 0 || a->dictionary_size < 0 || rows > INT_MAX - a->rows) return 0;
+    if (rows == 0) return 1;
+
+    // Буферы значений должны вмещать все строки
+    for (int i = 0; i < ARROW_FIELDS; i++) {
+        long long need = rows * 4;
+        if (i == ARROW_NAME) need = (rows + 1) * 4;
+        if (i == ARROW_STATUS) need = rows * a->index_width;
+        if (lengths[arrow_first_buffer[i] + 1] < need) return 0;
+    }
+    const unsigned char* pid = buffers[arrow_first_buffer[ARROW_PID] + 1];
+    const unsigned char* name_offsets = buffers[arrow_first_buffer[ARROW_NAME] + 1];
+    const unsigned char* names = buffers[arrow_first_buffer[ARROW_NAME] + 2];
+    long long names_length = lengths[arrow_first_buffer[ARROW_NAME] + 2];
+    const unsigned char* priority = buffers[arrow_first_buffer[ARROW_PRIORITY] + 1];
+    const unsigned char* kern_tm = buffers[arrow_first_buffer[ARROW_KERN_TM] + 1];
+    const unsigned char* file_tm = buffers[arrow_first_buffer[ARROW_FILE_TM] + 1];
+    const unsigned char* cpu_usage = buffers[arrow_first_buffer[ARROW_CPU_USAGE] + 1];
+    const unsigned char* status = buffers[arrow_first_buffer[ARROW_STATUS] + 1];
+
+    for (long long i = 0; i < rows; i++) {
+        Process* proc = creation_process();
+        if (proc == NULL) return 0;
+        if (a->last) a->last->next = proc;
+        else a->first = proc;
+        a->last = proc;
+
+        const char* name;
+        size_t name_len;
+        long long index = arrow_index(status, i, a->index_width, a->index_signed);
+        proc->pid = arrow_int32(pid, i);
+        proc->priority = arrow_int32(priority, i);
+        // cpu_usage - decimal(3,2), как в pars_decimal
+        proc->cpu_usage = arrow_int32(cpu_usage, i);
+        if (!arrow_time(arrow_int32(kern_tm, i), &proc->kern_tm) ||
+            !arrow_time(arrow_int32(file_tm, i), &proc->file_tm) ||
+            proc->cpu_usage < -99999 || proc->cpu_usage > 99999 ||
+            index < 0 || index >= a->dictionary_size || a->status_map[index] < 0 ||
+            !arrow_utf8_at(name_offsets, names, names_length, i, &name, &name_len) ||
+            memchr(name, '\0', name_len) != NULL || !name_assign(&proc->name, name, name_len)) {
+            return 0;
+        }
+        proc->status = (Status)a->status_map[index];
+    }
+    a->rows += (int)rows;
+    return 1;
 }
 
-// ===== SELECT =====
+// Разбирает отображенный файл; 0 - файл не в формате таблицы
+static int arrow_import(ArrowReader* a) {
+    if (a->size < 8 + 10 || memcmp(a->data, "ARROW1", 6) != 0 || memcmp(a->data + a->size - 6, "ARROW1", 6) != 0) {
+        return 0;
+    }
+    int footer_len;
+    memcpy(&footer_len, a->data + a->size - 10, 4);
+    if (footer_len <= 0 || (size_t)footer_len > a->size - 8 - 10) return 0;
+    FbReader footer = { a->data + a->size - 10 - footer_len, (size_t)footer_len, 0 };
+    size_t root = fb_deref(&footer, 0);
+    if (root == 0 || !arrow_check_schema(a, &footer, fb_ref(&footer, root, 1))) return 0;
+
+    size_t dictionaries = fb_ref(&footer, root, 2);
+    size_t batches = fb_ref(&footer, root, 3);
+    long long dictionary_count = fb_vector_len(&footer, dictionaries, sizeof(ArrowBlock));
+    long long batch_count = fb_vector_len(&footer, batches, sizeof(ArrowBlock));
+    if (dictionary_count < 0 || batch_count < 0) return 0;
+    for (long long i = 0; i < dictionary_count; i++) {
+        if (!arrow_read_dictionary(a, &footer, dictionaries + 4 + sizeof(ArrowBlock) * i)) return 0;
+    }
+    for (long long i = 0; i < batch_count; i++) {
+        if (!arrow_read_batch(a, &footer, batches + 4 + sizeof(ArrowBlock) * i)) return 0;
+    }
+    return 1;
+}
 
-void select_cmd(const char* args, const char* full_command, FILE* output) {
-    if (!args || !*args) {
+// export <файл>: записать таблицу в файл Arrow
+static void export_cmd(const char* args, const char* full_command, FILE* output) {
+    FILE* file = args && *args ? fopen(args, "wb") : NULL;
+    if (file == NULL) {
         print_incorrect(output, full_command);
         return;
     }
-
-    char* args_copy = (char*)my_malloc(strlen(args) + 1);
-    if (!args_copy) {
+    ArrowWriter w;
+    memset(&w, 0, sizeof(w));
+    w.file = file;
+    int rows = arrow_export(&w);
+    if (fclose(file) != 0) w.failed = 1;
+    my_free(w.meta.data);
+    my_free(w.batches);
+    if (w.failed) {
+        remove(args);
         print_incorrect(output, full_command);
         return;
     }
-    strcpy(args_copy, args);
-
-    char* fields_str = args_copy;
-    while (*fields_str == ' ' || *fields_str == '\t') fields_str++;
-    char* end = fields_str;
-    while (*end && !isspace((unsigned char)*end)) end++;
+    fprintf(output, "export:%d\n", rows);
+}
 
-    if (end == fields_str) {
-        my_free(args_copy);
+// import <файл>: добавить в конец таблицы строки из файла Arrow
+static void import_cmd(const char* args, const char* full_command, FILE* output) {
+    SharedMem map;
+    if (!args || !*args || !file_map(&map, args)) {
         print_incorrect(output, full_command);
         return;
     }
-
-    char* temp_fields = (char*)my_malloc(end - fields_str + 1);
-    strncpy(temp_fields, fields_str, end - fields_str);
-    temp_fields[end - fields_str] = '\0';
-
-    int field_count;
-    char** field_list = parse_field_list(temp_fields, &field_count);
-    my_free(temp_fields);
-
-    if (!field_list || field_count == 0) {
-        my_free(args_copy);
-        if (field_list) free_field_list(field_list, field_count);
+    ArrowReader a;
+    memset(&a, 0, sizeof(a));
+    a.data = (const unsigned char*)map.data;
+    a.size = map.size;
+    a.dictionary_size = -1;
+    int ok = arrow_import(&a);
+    shared_close(&map);
+    if (!ok) {
+        while (a.first) {
+            Process* next = a.first->next;
+            free_process(a.first);
+            a.first = next;
+        }
         print_incorrect(output, full_command);
         return;
     }
 
-    // ИСПРАВЛЕНО: динамическое выделение вместо стека
-    Condition* conditions = (Condition*)my_malloc(100 * sizeof(Condition));
-    if (!conditions) {
-        free_field_list(field_list, field_count);
-        my_free(args_copy);
-        print_incorrect(output, full_command);
-        return;
+    int sorted = sorted_insert_mode && sort_state_count > 0;
+    Process* tail = head;
+    while (tail && tail->next) tail = tail->next;
+    Process* proc = a.first;
+    while (proc) {
+        Process* next = proc->next;
+        proc->next = NULL;
+        if (sorted) add_process(proc);
+        else {
+            append_process_after(tail, proc);
+            tail = proc;
+        }
+        proc = next;
     }
+    fprintf(output, "import:%d\n", table_row_count());
+}
 
-    int cond_count = 0;
-    int error = 0;
+// ===== РЕПЛИКИ В РАЗДЕЛЯЕМОЙ ПАМЯТИ =====
 
-    char* cond_str = end;
-    while (*cond_str == ' ' || *cond_str == '\t') cond_str++;
+// replica <имя>: таблица публикуется в сегмент "<имя>.<поколение>" - заголовок, записи
+// Process подряд (next = NULL, длинные имена - NAME_REL на строки в конце сегмента), затем
+// строки. Сегмент создается с запасом записей и строк. Если после публикации строки только
+// добавлялись в конец, писатель дописывает их в запас текущего сегмента: видимые читателям
+// строки не меняются, поэтому читатели в других процессах (ldb_attach) работают прямо по
+// сегменту без копирования и блокировок. Любое другое изменение или нехватка запаса - новое
+// поколение с полной копией таблицы. Номер поколения и число видимых строк лежат в
+// управляющем сегменте "<имя>" под seqlock: писатель делает seq нечетным на время записи,
+// читатель повторяет чтение, пока seq не совпадет до и после. Старый сегмент после
+// публикации удаляется по имени; читатель, успевший его подключить, дочитывает свой запрос.
 
-    if (*cond_str) {
-        char* cond_copy = (char*)my_malloc(strlen(cond_str) + 1);
-        if (!cond_copy) {
-            my_free(conditions);
-            free_field_list(field_list, field_count);
-            my_free(args_copy);
-            print_incorrect(output, full_command);
-            return;
-        }
-        strcpy(cond_copy, cond_str);
+#define REPLICA_MAGIC 0x4C444252u
+#define REPLICA_NAME_SIZE 64
+#define REPLICA_RETRIES 1000
 
-        char* token = strtok(cond_copy, " \t");
-        while (token) {
-            if (!parse_condition(token, &conditions[cond_count])) {
-                error = 1;
-                break;
-            }
-            cond_count++;
-            token = strtok(NULL, " \t");
-        }
+typedef struct {
+    unsigned int magic;
+    unsigned int layout;        // sizeof(Process): читатель должен быть собран так же
+    volatile long seq;          // нечетный - писатель меняет заголовок
+    volatile long generation;   // номер текущего сегмента с данными
+    volatile long rows;         // строк сегмента, видимых читателям
+} ReplicaControl;
+
+typedef struct {
+    unsigned int magic;
+    int row_capacity;           // мест под записи; строки начинаются сразу за ними
+    long long size;
+} ReplicaData;
+
+typedef struct {
+    char name[REPLICA_NAME_SIZE];   // пусто - публикация выключена
+    SharedMem control;
+    SharedMem data;
+    long generation;
+    // Состояние сегмента для дописывания
+    int rows;
+    int row_capacity;
+    size_t strings_used;
+    size_t strings_capacity;
+    Process* last;                  // последняя опубликованная строка списка (NULL - список был пуст)
+    long rewrites;                  // table_rewrites и table_moves на момент публикации
+    long moves;
+} ReplicaWriter;
+
+typedef struct {
+    char name[REPLICA_NAME_SIZE];
+    SharedMem control;
+    SharedMem data;
+    long generation;
+    TableSnapshot snapshot;         // строки указывают в data
+    int rows_capacity;
+} ReplicaReader;
+
+static ReplicaWriter replica_writer = { 0 };
+static ReplicaReader replica_reader = { 0 };
+static long replica_publishes = 0;
+static long replica_appends = 0;
+
+// 0 - имя сегмента не помещается (для имен из replica_name_valid не бывает)
+static int replica_segment_name(char* out, const char* name, long generation) {
+    int len = snprintf(out, SHARED_NAME_SIZE, "%s.%ld", name, generation);
+    return len > 0 && len < SHARED_NAME_SIZE;
+}
+
+// Записи начинаются сразу после заголовка, выровненного под Process
+static size_t replica_header_size() {
+    return (sizeof(ReplicaData) + sizeof(long long) - 1) / sizeof(long long) * sizeof(long long);
+}
 
-        my_free(cond_copy);
+// Копирует имя text в запись row; длинное - в область строк *strings
+static void replica_put_name(Process* row, const char* text, size_t len, char** strings) {
+    if (text == NULL) {
+        row->name.kind = NAME_NONE;
     }
+    else if (len < NAME_INLINE_SIZE) {
+        memcpy(row->name.data.text, text, len + 1);
+        row->name.kind = NAME_INLINE;
+    }
+    else {
+        memcpy(*strings, text, len + 1);
+        row->name.data.rel = (long long)(*strings - (char*)&row->name);
+        row->name.kind = NAME_REL;
+        *strings += len + 1;
+    }
+}
 
-    if (error) {
-        my_free(conditions);
-        free_field_list(field_list, field_count);
-        my_free(args_copy);
-        print_incorrect(output, full_command);
-        return;
+// Длинные имена словаря сжатых блоков пишутся один раз; dict_offset[id] - их место
+static int replica_publish() {
+    ScratchMark mark = scratch_mark();
+    NameDict* dict = &packed_table.dict;
+    long long* dict_offset = (long long*)scratch_alloc((dict->count + 1) * sizeof(long long));
+    if (dict_offset == NULL) return 0;
+
+    int rows = process_count + packed_table.rows;
+    size_t strings_size = 1;
+    for (int id = 1; id < dict->count; id++) {
+        size_t len = strlen(dict->names[id]);
+        if (len >= NAME_INLINE_SIZE) strings_size += len + 1;
+    }
+    for (Process* curr = head; curr; curr = curr->next) {
+        const char* text = name_text(&curr->name);
+        if (text && curr->name.kind != NAME_INLINE) strings_size += strlen(text) + 1;
     }
 
-    int found = 0;
-    Process* curr = head;
-    while (curr) {
-        if (check_all_conditions(curr, conditions, cond_count)) found++;
-        curr = curr->next;
+    long generation = replica_writer.generation + 1;
+    char segment[SHARED_NAME_SIZE];
+    SharedMem mem;
+    if (!replica_segment_name(segment, replica_writer.name, generation)) {
+        scratch_reset(mark);
+        return 0;
+    }
+    // Запас вдвое: следующие вставки дописываются без новой копии
+    int row_capacity = rows < 512 ? 1024 : rows * 2;
+    size_t strings_capacity = strings_size * 2 + 4096;
+    size_t size = replica_header_size() + (size_t)row_capacity * sizeof(Process) + strings_capacity;
+    if (!shared_create(&mem, segment, size)) {
+        scratch_reset(mark);
+        return 0;
     }
 
-    fprintf(output, "select:%d\n", found);
+    ReplicaData* header = (ReplicaData*)mem.data;
+    Process* out = (Process*)((char*)mem.data + replica_header_size());
+    char* strings = (char*)(out + row_capacity);
+    char* strings_start = strings;
+    header->magic = REPLICA_MAGIC;
+    header->row_capacity = row_capacity;
+    header->size = (long long)size;
+
+    for (int id = 1; id < dict->count; id++) {
+        size_t len = strlen(dict->names[id]);
+        if (len < NAME_INLINE_SIZE) continue;
+        dict_offset[id] = strings - strings_start;
+        memcpy(strings, dict->names[id], len + 1);
+        strings += len + 1;
+    }
 
-    curr = head;
-    while (curr) {
-        if (check_all_conditions(curr, conditions, cond_count)) {
-            for (int i = 0; i < field_count; i++) {
-                if (i > 0) fprintf(output, " ");
-                if (strcmp(field_list[i], "pid") == 0) {
-                    fprintf(output, "pid="); print_int(output, curr->pid);
-                }
-                else if (strcmp(field_list[i], "name") == 0) {
-                    fprintf(output, "name="); print_str(output, curr->name);
-                }
-                else if (strcmp(field_list[i], "priority") == 0) {
-                    fprintf(output, "priority="); print_int(output, curr->priority);
-                }
-                else if (strcmp(field_list[i], "kern_tm") == 0) {
-                    fprintf(output, "kern_tm="); print_time(output, curr->kern_tm);
-                }
-                else if (strcmp(field_list[i], "file_tm") == 0) {
-                    fprintf(output, "file_tm="); print_time(output, curr->file_tm);
-                }
-                else if (strcmp(field_list[i], "cpu_usage") == 0) {
-                    fprintf(output, "cpu_usage="); print_decimal(output, curr->cpu_usage);
-                }
-                else if (strcmp(field_list[i], "status") == 0) {
-                    fprintf(output, "status="); print_status(output, curr->status);
-                }
+    int i = 0;
+    for (int b = 0; b < packed_table.block_count; b++) {
+        PackedBlock* block = &packed_table.blocks[b];
+        if (!packed_load(block)) {
+            shared_close(&mem);
+            shared_remove(segment);
+            scratch_reset(mark);
+            return 0;
+        }
+        for (int r = 0; r < block->count; r++, i++) {
+            Process* row = &out[i];
+            memset(row, 0, sizeof(Process));
+            for (int c = 0; c < PACK_NAME; c++) packed_set_column(row, c, packed_get(block, c, r));
+            int id = packed_get(block, PACK_NAME, r);
+            const char* text = id == 0 ? NULL : dict->names[id];
+            size_t len = text ? strlen(text) : 0;
+            if (len >= NAME_INLINE_SIZE) {
+                row->name.data.rel = (long long)(strings_start + dict_offset[id] - (char*)&row->name);
+                row->name.kind = NAME_REL;
             }
-            fprintf(output, "\n");
+            else replica_put_name(row, text, len, &strings);
         }
-        curr = curr->next;
     }
-
-    my_free(conditions);
-    free_field_list(field_list, field_count);
-    my_free(args_copy);
+    Process* last = NULL;
+    for (Process* curr = head; curr; curr = curr->next, i++) {
+        Process* row = &out[i];
+        *row = *curr;
+        row->next = NULL;
+        const char* text = name_text(&curr->name);
+        replica_put_name(row, text, text ? strlen(text) : 0, &strings);
+        last = curr;
+    }
+    *strings = '\0';
+
+    // Переключение поколения под seqlock; сегмент данных к этому моменту записан
+    ReplicaControl* control = (ReplicaControl*)replica_writer.control.data;
+    atomic_add(&control->seq, 1);
+    atomic_add(&control->generation, 1);
+    control->rows = rows;
+    atomic_add(&control->seq, 1);
+
+    if (replica_writer.data.data) {
+        shared_close(&replica_writer.data);
+        if (replica_segment_name(segment, replica_writer.name, replica_writer.generation)) shared_remove(segment);
+    }
+    replica_writer.data = mem;
+    replica_writer.generation = generation;
+    replica_writer.rows = rows;
+    replica_writer.row_capacity = row_capacity;
+    replica_writer.strings_used = (size_t)(strings - strings_start) + 1;
+    replica_writer.strings_capacity = strings_capacity;
+    replica_writer.last = last;
+    replica_writer.rewrites = table_rewrites;
+    replica_writer.moves = table_moves;
+    replica_publishes++;
+    scratch_reset(mark);
+    return 1;
 }
 
-// ===== DELETE =====
-
-void delete_cmd(const char* args, const char* full_command, FILE* output) {
-    if (!args || !*args) {
-        int del = process_count;
-        clear_allproc();
-        fprintf(output, "delete:%d\n", del);
-        return;
+// Дописывает строки, добавленные в конец списка после публикации, в запас текущего
+// сегмента. 0 - так нельзя (таблица менялась иначе или не хватает запаса), нужна публикация
+static int replica_append() {
+    ReplicaWriter* writer = &replica_writer;
+    int rows = process_count + packed_table.rows;
+    if (writer->data.data == NULL || table_rewrites != writer->rewrites || rows < writer->rows) return 0;
+    int added = rows - writer->rows;
+    if (added > process_count || rows > writer->row_capacity) return 0;
+
+    // Строка перед новыми; после переноса строк в сжатые блоки запомненная могла уйти
+    Process* before = writer->last;
+    if (table_moves != writer->moves) {
+        before = NULL;
+        for (int i = 0; i < process_count - added; i++) before = before ? before->next : head;
     }
+    Process* first = before ? before->next : head;
 
-    char* args_copy = (char*)my_malloc(strlen(args) + 1);
-    if (!args_copy) {
-        print_incorrect(output, full_command);
-        return;
+    size_t strings_size = 0;
+    for (Process* curr = first; curr; curr = curr->next) {
+        const char* text = name_text(&curr->name);
+        if (text && curr->name.kind != NAME_INLINE) strings_size += strlen(text) + 1;
+    }
+    if (writer->strings_used + strings_size > writer->strings_capacity) return 0;
+
+    // Новые записи лежат за видимыми, поэтому читатели их не видят, пока не сменится rows
+    Process* out = (Process*)((char*)writer->data.data + replica_header_size());
+    char* strings = (char*)(out + writer->row_capacity) + writer->strings_used;
+    int i = writer->rows;
+    for (Process* curr = first; curr; curr = curr->next, i++) {
+        Process* row = &out[i];
+        *row = *curr;
+        row->next = NULL;
+        const char* text = name_text(&curr->name);
+        replica_put_name(row, text, text ? strlen(text) : 0, &strings);
+        before = curr;
     }
-    strcpy(args_copy, args);
 
-    // ИСПРАВЛЕНО: динамическое выделение вместо стека
-    Condition* conditions = (Condition*)my_malloc(100 * sizeof(Condition));
-    if (!conditions) {
-        my_free(args_copy);
-        print_incorrect(output, full_command);
-        return;
+    if (added > 0) {
+        ReplicaControl* control = (ReplicaControl*)writer->control.data;
+        atomic_add(&control->seq, 1);
+        control->rows = rows;
+        atomic_add(&control->seq, 1);
+        replica_appends++;
     }
+    writer->rows = rows;
+    writer->strings_used += strings_size;
+    writer->last = before;
+    writer->moves = table_moves;
+    return 1;
+}
 
-    int cond_count = 0;
-    int error = 0;
+// Публикует таблицу после изменяющей команды, если включена реплика
+static void replica_sync() {
+    if (replica_writer.name[0] && !replica_append()) replica_publish();
+}
 
-    char* token = strtok(args_copy, " \t");
-    while (token) {
-        if (!parse_condition(token, &conditions[cond_count])) {
-            error = 1;
-            break;
-        }
-        cond_count++;
-        token = strtok(NULL, " \t");
+static void replica_stop() {
+    if (replica_writer.name[0] == '\0') return;
+    char segment[SHARED_NAME_SIZE];
+    if (replica_writer.data.data) {
+        shared_close(&replica_writer.data);
+        if (replica_segment_name(segment, replica_writer.name, replica_writer.generation)) shared_remove(segment);
+    }
+    shared_close(&replica_writer.control);
+    shared_remove(replica_writer.name);
+    memset(&replica_writer, 0, sizeof(replica_writer));
+}
+
+// Имя короче REPLICA_NAME_SIZE: с префиксом ("/" или "Local\\") и суффиксом ".<поколение>"
+// имя сегмента всегда помещается в SHARED_NAME_SIZE. Длинное имя - ошибка, а не обрезка
+static int replica_name_valid(const char* name) {
+    size_t len = strlen(name);
+    if (len == 0 || len >= REPLICA_NAME_SIZE) return 0;
+    for (size_t i = 0; i < len; i++) {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '_') return 0;
     }
+    return 1;
+}
 
-    if (error) {
-        my_free(conditions);
-        my_free(args_copy);
-        print_incorrect(output, full_command);
-        return;
+static int replica_start(const char* name) {
+    replica_stop();
+    strcpy(replica_writer.name, name);
+    if (!shared_create(&replica_writer.control, name, sizeof(ReplicaControl))) {
+        replica_writer.name[0] = '\0';
+        return 0;
+    }
+    ReplicaControl* control = (ReplicaControl*)replica_writer.control.data;
+    control->magic = REPLICA_MAGIC;
+    control->layout = (unsigned int)sizeof(Process);
+    control->seq = 0;
+    control->generation = 0;
+    control->rows = 0;
+    if (!replica_publish()) {
+        replica_stop();
+        return 0;
     }
+    return 1;
+}
 
-    int* indices = (int*)my_malloc(process_count * sizeof(int));
-    if (!indices) {
-        my_free(conditions);
-        my_free(args_copy);
+// replica <имя>|off: публиковать таблицу для читателей из других процессов
+static void replica_cmd(const char* args, const char* full_command, FILE* output) {
+    if (args && strcmp(args, "off") == 0) {
+        replica_stop();
+        fprintf(output, "replica:off\n");
+        return;
+    }
+    if (!args || !replica_name_valid(args) || !replica_start(args)) {
         print_incorrect(output, full_command);
         return;
     }
+    fprintf(output, "replica:%s\n", args);
+}
 
-    int del_count = 0, idx = 0;
-    Process* curr = head;
-    while (curr) {
-        if (check_all_conditions(curr, conditions, cond_count)) {
-            indices[del_count++] = idx;
+// --- читатель ---
+
+static int replica_attach(const char* name) {
+    if (!replica_name_valid(name)) return 0;
+    memset(&replica_reader, 0, sizeof(replica_reader));
+    if (!shared_open(&replica_reader.control, name)) return 0;
+    ReplicaControl* control = (ReplicaControl*)replica_reader.control.data;
+    if (replica_reader.control.size < sizeof(ReplicaControl) || control->magic != REPLICA_MAGIC ||
+        control->layout != (unsigned int)sizeof(Process)) {
+        shared_close(&replica_reader.control);
+        return 0;
+    }
+    strcpy(replica_reader.name, name);
+    return 1;
+}
+
+static void replica_detach() {
+    shared_close(&replica_reader.data);
+    shared_close(&replica_reader.control);
+    my_free(replica_reader.snapshot.rows);
+    memset(&replica_reader, 0, sizeof(replica_reader));
+}
+
+// Подключает текущее поколение; 0 - писатель пропал или не удалось прочитать заголовок
+static int replica_refresh() {
+    ReplicaControl* control = (ReplicaControl*)replica_reader.control.data;
+    for (int attempt = 0; attempt < REPLICA_RETRIES; attempt++) {
+        long seq = atomic_load(&control->seq);
+        if (seq & 1) continue;
+        long generation = atomic_load(&control->generation);
+        int rows = (int)atomic_load(&control->rows);
+        if (atomic_load(&control->seq) != seq) continue;
+
+        // Тот же сегмент: дописанные строки добавляются к снимку
+        SharedMem mem = replica_reader.data;
+        int known = replica_reader.snapshot.count;
+        if (generation != replica_reader.generation || mem.data == NULL) {
+            // Сегмент мог быть удален сразу после чтения заголовка - тогда читаем заново
+            char segment[SHARED_NAME_SIZE];
+            if (!replica_segment_name(segment, replica_reader.name, generation)) return 0;
+            if (!shared_open(&mem, segment)) continue;
+            known = 0;
         }
-        idx++;
-        curr = curr->next;
+        ReplicaData* header = (ReplicaData*)mem.data;
+        if (mem.size < replica_header_size() || header->magic != REPLICA_MAGIC ||
+            mem.size < (size_t)header->size || rows < 0 || rows > header->row_capacity) {
+            if (mem.data != replica_reader.data.data) shared_close(&mem);
+            continue;
+        }
+        if (rows > replica_reader.rows_capacity) {
+            int new_capacity = replica_reader.rows_capacity ? replica_reader.rows_capacity : 1024;
+            while (new_capacity < rows) new_capacity *= 2;
+            Process** grown = (Process**)my_realloc(replica_reader.snapshot.rows, new_capacity * sizeof(Process*));
+            if (grown == NULL) {
+                if (mem.data != replica_reader.data.data) shared_close(&mem);
+                return 0;
+            }
+            replica_reader.snapshot.rows = grown;
+            replica_reader.rows_capacity = new_capacity;
+        }
+        Process* records = (Process*)((char*)mem.data + replica_header_size());
+        for (int i = known; i < rows; i++) replica_reader.snapshot.rows[i] = &records[i];
+        replica_reader.snapshot.count = rows;
+        replica_reader.snapshot.version = generation;
+
+        if (mem.data != replica_reader.data.data) {
+            shared_close(&replica_reader.data);
+            replica_reader.data = mem;
+            replica_reader.generation = generation;
+        }
+        return 1;
     }
+    return 0;
+}
 
-    for (int i = del_count - 1; i >= 0; i--) {
-        delete_process(indices[i]);
+// Выполняет select, count или aggregate по текущему поколению реплики
+static void replica_exec(const char* line, FILE* output) {
+    ScratchMark mark = scratch_mark();
+    const char* args = line;
+    while (*args && !isspace((unsigned char)*args)) args++;
+    size_t cmd_len = (size_t)(args - line);
+    while (*args == ' ' || *args == '\t') args++;
+
+    CommandFunc func = NULL;
+    if (cmd_len == 6 && strncmp(line, "select", 6) == 0) func = select_cmd;
+    else if (cmd_len == 5 && strncmp(line, "count", 5) == 0) func = count_cmd;
+    else if (cmd_len == 9 && strncmp(line, "aggregate", 9) == 0) func = aggregate_cmd;
+
+    if (func == NULL || !replica_refresh()) {
+        print_incorrect(output, line);
+    }
+    else {
+        reader_snapshot = &replica_reader.snapshot;
+        func(args, line, output);
+        reader_snapshot = NULL;
     }
+    scratch_reset(mark);
+}
 
-    my_free(indices);
-    my_free(conditions);
-    my_free(args_copy);
-    fprintf(output, "delete:%d\n", del_count);
+// ===== РАЗБОР КОМАНДЫ =====
+
+// Флаги команды в таблице commands
+#define CMD_READ          0x01  // не меняет таблицу: выполняется на снимке, может уйти читателям
+#define CMD_KEEP_REPLICA  0x02  // после команды реплика не публикуется (сама replica)
+
+typedef struct {
+    const char* name;
+    CommandFunc func;
+    int flags;
+    // 1 - команда работает со сжатыми блоками и не требует packed_expand; NULL - только со списком
+    int (*packed_native)(const char* args);
+} CommandInfo;
+
+static int packed_always(const char* args) {
+    (void)args;
+    return 1;
 }
 
-// ===== UPDATE =====
+// Вставка в конец дописывает строку к сжатой таблице; sorted_insert ищет место в списке
+static int insert_packed(const char* args) {
+    (void)args;
+    return !sorted_insert_mode || sort_state_count == 0;
+}
 
-void update_field(Process* proc, const char* field, const char* value) {
-    if (!proc || !field || !value) return;
-    if (strcmp(field, "pid") == 0) diapozon_int(value, &proc->pid);
-    else if (strcmp(field, "name") == 0) {
-        if (proc->name) my_free(proc->name);
-        proc->name = pars_str(value);
-    }
-    else if (strcmp(field, "priority") == 0) diapozon_int(value, &proc->priority);
-    else if (strcmp(field, "kern_tm") == 0) pars_time(value, &proc->kern_tm);
-    else if (strcmp(field, "file_tm") == 0) pars_time(value, &proc->file_tm);
-    else if (strcmp(field, "cpu_usage") == 0) pars_decimal(value, &proc->cpu_usage);
-    else if (strcmp(field, "status") == 0) pars_status(value, &proc->status);
+// delete и update переписывают блоки, пока читатели не держат снимки
+static int rewrite_packed(const char* args) {
+    (void)args;
+    return snapshots == NULL;
 }
 
-void update_cmd(const char* args, const char* full_command, FILE* output) {
-    if (!args || !*args) {
-        print_incorrect(output, full_command);
-        return;
+// select с order_by сортирует список. Слова разбираются так же, как в select_cmd:
+// после списка полей order_by= - только отдельное слово, а не часть значения условия
+static int select_packed(const char* args) {
+    const char* p = args;
+    while (*p == ' ' || *p == '\t') p++;
+    while (*p && !isspace((unsigned char)*p)) p++;
+    for (;;) {
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '\0') return 1;
+        if (strncmp(p, "order_by=", 9) == 0) return 0;
+        while (*p && *p != ' ' && *p != '\t') p++;
     }
+}
 
-    char* args_copy = (char*)my_malloc(strlen(args) + 1);
-    if (!args_copy) {
-        print_incorrect(output, full_command);
-        return;
+static const CommandInfo commands[] = {
+    { "insert", insert, 0, insert_packed },
+    { "select", select_cmd, CMD_READ, select_packed },
+    { "delete", delete_cmd, 0, rewrite_packed },
+    { "update", update_cmd, 0, rewrite_packed },
+    { "uniq", uniq_cmd, 0, NULL },
+    { "sort", sort_cmd, 0, NULL },
+    { "aggregate", aggregate_cmd, CMD_READ, NULL },
+    { "count", count_cmd, CMD_READ, packed_always },
+    { "sorted_insert", sorted_insert_cmd, 0, packed_always },
+    { "readers", readers_cmd, 0, packed_always },
+    { "shards", shards_cmd, 0, packed_always },
+    { "analyze", analyze_cmd, 0, NULL },
+    { "compress", compress_cmd, 0, packed_always },
+    { "pool", pool_cmd, 0, packed_always },
+    { "sort_memory", sort_memory_cmd, 0, packed_always },
+    { "replica", replica_cmd, CMD_KEEP_REPLICA, packed_always },
+    { "workers", workers_cmd, 0, packed_always },
+    { "export", export_cmd, 0, NULL },
+    { "import", import_cmd, 0, NULL }
+};
+
+static const CommandInfo unknown_command = { "", unknown_cmd, 0, packed_always };
+
+static const CommandInfo* command_find(const char* name) {
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        if (strcmp(commands[i].name, name) == 0) return &commands[i];
     }
-    strcpy(args_copy, args);
+    return &unknown_command;
+}
 
-    char* p = args_copy;
-    while (*p == ' ' || *p == '\t') p++;
+// Выполняет одну строку команды (без перевода строки и концевых пробелов)
+// Временная память команды откатывается после ее выполнения
+// Обслуживание таблицы после пишущей команды. Фильтр Блума достраивается здесь, а не
+// при первой проверке pid=X: тогда читающие команды не выделяют память
+static void table_settle(int sync_replica) {
+    // Реплика - до сжатия: новые строки еще лежат в конце списка и дописываются в сегмент
+    if (sync_replica) replica_sync();
+    if (compress_mode) packed_compact();
+    bloom_ensure();
+}
 
-    char* end = p;
-    while (*end && !isspace((unsigned char)*end)) end++;
+static void execute_line(const char* line, FILE* output) {
+    ScratchMark mark = scratch_mark();
+    char* line_copy = (char*)scratch_alloc(strlen(line) + 1);
+    if (!line_copy) return;
+    strcpy(line_copy, line);
 
-    if (end == p) {
-        my_free(args_copy);
-        print_incorrect(output, full_command);
+    char* save = NULL;
+    char* cmd = strtok_r(line_copy, " \t", &save);
+    if (!cmd) {
+        scratch_reset(mark);
         return;
     }
 
-    char* updates_str = (char*)my_malloc(end - p + 1);
-    strncpy(updates_str, p, end - p);
-    updates_str[end - p] = '\0';
+    const char* args = line;
+    while (*args && !isspace((unsigned char)*args)) args++;
+    while (*args == ' ' || *args == '\t') args++;
 
-    char* cond_str = end;
-    while (*cond_str == ' ' || *cond_str == '\t') cond_str++;
-    if (*cond_str == '\0') cond_str = NULL;
+    const CommandInfo* command = command_find(cmd);
+    CommandFunc func = command->func;
+    int is_read = (command->flags & CMD_READ) != 0;
 
-    char* updates_copy = (char*)my_malloc(strlen(updates_str) + 1);
-    if (!updates_copy) {
-        my_free(updates_str);
-        my_free(args_copy);
-        print_incorrect(output, full_command);
+    // Команды, которые работают только со списком, получают таблицу целиком
+    if (packed_row_count() > 0 && (!command->packed_native || !command->packed_native(args)) && !packed_expand_in_budget()) {
+        print_incorrect(output, line);
+        scratch_reset(mark);
         return;
     }
-    strcpy(updates_copy, updates_str);
 
-    char update_fields[10][50];
-    char update_values[10][256];
-    int update_count = 0;
+    // Выделения памяти во время читающих команд - для memstat
+    long before = atomic_load(&malloc_count) + atomic_load(&calloc_count) + atomic_load(&realloc_count);
+    run_command(func, is_read, args, line, output);
+    if (is_read) {
+        read_allocs += atomic_load(&malloc_count) + atomic_load(&calloc_count) + atomic_load(&realloc_count) - before;
+    }
+    // После читающих команд таблица не меняется: строки, выданные ldb_step, остаются на месте
+    else {
+        table_settle(!(command->flags & CMD_KEEP_REPLICA));
+    }
 
-    char* token = strtok(updates_copy, ",");
-    while (token) {
-        while (*token == ' ') token++;
+    scratch_reset(mark);
+}
 
-        char* eq = strchr(token, '=');
-        if (!eq) {
-            my_free(updates_copy);
-            my_free(updates_str);
-            my_free(args_copy);
-            print_incorrect(output, full_command);
-            return;
-        }
+// Останавливает потоки шардов и освобождает таблицу и все буферы
+static void engine_shutdown() {
+    sched_stop();
+    shards_stop();
+    clear_allproc();
+    sort_state_reset();
+    my_free(sorted_rows);
+    sorted_rows = NULL;
+    sorted_rows_capacity = 0;
+    my_free(zone_blocks);
+    zone_blocks = NULL;
+    zone_block_capacity = 0;
+    name_index_free();
+    bloom_free();
+    replica_stop();
+    packed_clear();
+    row_pools_release();
+    pool_stop();
+    scratch_release();
+}
 
-        *eq = '\0';
-        char* field = token;
-        char* value = eq + 1;
+// ===== ВСТРАИВАЕМЫЙ ИНТЕРФЕЙС (lab_db.h) =====
 
-        char* end_f = field + strlen(field) - 1;
-        while (end_f > field && (*end_f == ' ' || *end_f == '\t')) *end_f-- = '\0';
-        while (*value == ' ' || *value == '\t') value++;
+// Дескриптор один: таблица и все служебные структуры глобальны
+struct LdbDatabase {
+    int is_open;
+    int is_replica;     // ldb_attach: только чтение реплики другого процесса
+};
 
-        for (int i = 0; i < update_count; i++) {
-            if (strcmp(update_fields[i], field) == 0) {
-                my_free(updates_copy);
-                my_free(updates_str);
-                my_free(args_copy);
-                print_incorrect(output, full_command);
-                return;
-            }
-        }
+static LdbDatabase ldb_instance = { 0 };
+
+static void ingest_init();
+static void ingest_discard();
+
+typedef enum { STMT_INSERT, STMT_SELECT, STMT_UPDATE, STMT_DELETE, STMT_COUNT } StatementKind;
+
+#define MAX_STMT_PARAMS 100
+
+struct LdbStatement {
+    StatementKind kind;
+    FieldValue values[7];
+    int value_count;
+    Condition* conditions;
+    int cond_count;
+    int param_count;
+    int param_target[MAX_STMT_PARAMS];  // >= 0 - номер условия, < 0 - присваивание -(i + 1)
+    int param_bound[MAX_STMT_PARAMS];
+    unsigned int field_mask;            // select: LDB_FIELD_* из списка полей
+    // Результат select для ldb_step
+    Process** rows;
+    int row_count;
+    int row_capacity;
+    int row_pos;
+    int executed;
+};
 
-        strcpy(update_fields[update_count], field);
-        strcpy(update_values[update_count], value);
-        update_count++;
-        token = strtok(NULL, ",");
-    }
+LdbDatabase* ldb_open(void) {
+    if (ldb_instance.is_open) return NULL;
+    ldb_instance.is_open = 1;
+    ingest_init();
+    scratch_warm();
+    return &ldb_instance;
+}
 
-    my_free(updates_copy);
-    my_free(updates_str);
+LdbDatabase* ldb_attach(const char* name) {
+    if (ldb_instance.is_open || name == NULL || !replica_attach(name)) return NULL;
+    ldb_instance.is_open = 1;
+    ldb_instance.is_replica = 1;
+    scratch_warm();
+    return &ldb_instance;
+}
 
-    if (update_count == 0) {
-        my_free(args_copy);
-        print_incorrect(output, full_command);
-        return;
+void ldb_close(LdbDatabase* db) {
+    if (db == NULL || !db->is_open) return;
+    if (db->is_replica) {
+        replica_detach();
+        scratch_release();
+    }
+    else {
+        ingest_discard();
+        engine_shutdown();
     }
+    db->is_open = 0;
+    db->is_replica = 0;
+}
 
-    // ИСПРАВЛЕНО: динамическое выделение вместо стека
-    Condition* conditions = (Condition*)my_malloc(100 * sizeof(Condition));
-    if (!conditions) {
-        my_free(args_copy);
-        print_incorrect(output, full_command);
-        return;
+LdbResult ldb_exec(LdbDatabase* db, const char* command, FILE* output) {
+    if (db == NULL || !db->is_open || command == NULL || output == NULL) return LDB_ERROR;
+    ScratchMark mark = scratch_mark();
+    char* line = (char*)scratch_alloc(strlen(command) + 1);
+    if (!line) return LDB_ERROR;
+    strcpy(line, command);
+    size_t len = strlen(line);
+    while (len > 0 && isspace((unsigned char)line[len - 1])) line[--len] = '\0';
+    if (line[0] != '\0') {
+        if (db->is_replica) replica_exec(line, output);
+        else execute_line(line, output);
     }
+    // Отложенные читатели дописывают вывод до возврата: подготовленные запросы
+    // всегда видят таблицу без закрепленных снимков
+    pending_flush(output);
+    scratch_reset(mark);
+    return LDB_OK;
+}
 
-    int cond_count = 0;
-    int error = 0;
+static int stmt_add_param(LdbStatement* stmt, int target) {
+    if (stmt->param_count == MAX_STMT_PARAMS) return 0;
+    stmt->param_target[stmt->param_count] = target;
+    stmt->param_bound[stmt->param_count] = 0;
+    stmt->param_count++;
+    return 1;
+}
 
-    if (cond_str) {
-        char* cond_copy = (char*)my_malloc(strlen(cond_str) + 1);
-        if (!cond_copy) {
-            my_free(conditions);
-            my_free(args_copy);
-            print_incorrect(output, full_command);
-            return;
+// Список поле=значение через запятую; значения в кавычках могут содержать запятые
+static int stmt_parse_values(LdbStatement* stmt, const char* p) {
+    while (*p == ' ') p++;
+    while (*p) {
+        if (stmt->value_count == 7) return 0;
+        FieldValue* value = &stmt->values[stmt->value_count];
+        int i = 0;
+        while (*p && *p != '=' && i < 49) value->field[i++] = *p++;
+        if (*p != '=') return 0;
+        while (i > 0 && (value->field[i - 1] == ' ' || value->field[i - 1] == '\t')) i--;
+        value->field[i] = '\0';
+        if (!is_known_field(value->field)) return 0;
+        for (int j = 0; j < stmt->value_count; j++) {
+            if (strcmp(stmt->values[j].field, value->field) == 0) return 0;
         }
-        strcpy(cond_copy, cond_str);
+        stmt->value_count++;
+        p++;
+        while (*p == ' ') p++;
 
-        token = strtok(cond_copy, " \t");
-        while (token) {
-            if (!parse_condition(token, &conditions[cond_count])) {
-                error = 1;
-                break;
+        const char* value_start = p;
+        if (*p == '"') {
+            p++;
+            while (*p) {
+                if (*p == '\\') {
+                    if (p[1] == '\0') break;
+                    p += 2;
+                    continue;
+                }
+                if (*p++ == '"') break;
             }
-            cond_count++;
-            token = strtok(NULL, " \t");
         }
-        my_free(cond_copy);
-    }
+        else if (*p == '\'') {
+            p++;
+            while (*p && *p != '\'') p++;
+            if (*p == '\'') p++;
+        }
+        else {
+            while (*p && *p != ',') p++;
+        }
+        int value_len = (int)(p - value_start);
+        while (value_len > 0 && value_start[value_len - 1] == ' ') value_len--;
+        if (value_len <= 0 || value_len >= 255) return 0;
 
-    if (error) {
-        my_free(conditions);
-        my_free(args_copy);
-        print_incorrect(output, full_command);
-        return;
+        if (value_len == 1 && *value_start == '?') {
+            if (!stmt_add_param(stmt, -stmt->value_count)) return 0;
+        }
+        else {
+            char text[256];
+            strncpy(text, value_start, value_len);
+            text[value_len] = '\0';
+            if (!field_value_parse(value, text)) return 0;
+        }
+
+        while (*p == ' ') p++;
+        if (*p == ',') {
+            p++;
+            while (*p == ' ') p++;
+        }
+        else if (*p != '\0') return 0;
     }
+    return stmt->value_count > 0;
+}
 
-    int updated = 0;
-    Process* curr = head;
-    while (curr) {
-        if (check_all_conditions(curr, conditions, cond_count)) {
-            for (int i = 0; i < update_count; i++) {
-                update_field(curr, update_fields[i], update_values[i]);
-            }
-            updated++;
+// Условия через пробел; значение ? становится параметром
+static int stmt_parse_conditions(LdbStatement* stmt, const char* str) {
+    char* copy = (char*)scratch_alloc(strlen(str) + 1);
+    if (!copy) return 0;
+    strcpy(copy, str);
+    int ok = 1;
+    char* save = NULL;
+    char* token = strtok_r(copy, " \t", &save);
+    while (token && ok) {
+        if (stmt->cond_count == 100) return 0;
+        Condition* cond = &stmt->conditions[stmt->cond_count];
+        if (!parse_condition(token, cond) || !is_known_field(cond->field_name)) ok = 0;
+        else if (strcmp(cond->value_str, "?") == 0) {
+            ok = is_compare_oper(cond->oper) && stmt_add_param(stmt, stmt->cond_count);
         }
-        curr = curr->next;
+        else if (cond->set) {
+            // Множество из памяти разбора переносится в память запроса
+            cond->set = value_set_persist(cond->set);
+            ok = cond->set != NULL;
+        }
+        if (!ok) cond->set = NULL;
+        stmt->cond_count++;
+        token = strtok_r(NULL, " \t", &save);
     }
+    return ok;
+}
 
-    my_free(conditions);
-    my_free(args_copy);
-    fprintf(output, "update:%d\n", updated);
+// Отделяет первое слово нулем и возвращает начало следующего
+static char* split_first_word(char* p) {
+    while (*p && !isspace((unsigned char)*p)) p++;
+    if (*p) *p++ = '\0';
+    while (*p == ' ' || *p == '\t') p++;
+    return p;
 }
 
-// ===== UNIQ =====
+void ldb_finalize(LdbStatement* stmt) {
+    if (stmt == NULL) return;
+    field_values_release(stmt->values, stmt->value_count);
+    for (int i = 0; i < stmt->cond_count; i++) my_free(stmt->conditions[i].set);
+    my_free(stmt->conditions);
+    my_free(stmt->rows);
+    my_free(stmt);
+}
 
-int compare_processes(Process* a, Process* b, char** fields, int count) {
-    if (!a || !b || !fields || count == 0) return 0;
-    for (int i = 0; i < count; i++) {
-        if (strcmp(fields[i], "pid") == 0) {
-            if (a->pid != b->pid) return 0;
-        }
-        else if (strcmp(fields[i], "name") == 0) {
-            if (!a->name && !b->name) continue;
-            if (!a->name || !b->name) return 0;
-            if (strcmp(a->name, b->name) != 0) return 0;
-        }
-        else if (strcmp(fields[i], "priority") == 0) {
-            if (a->priority != b->priority) return 0;
-        }
-        else if (strcmp(fields[i], "kern_tm") == 0) {
-            if (compare_time(a->kern_tm, b->kern_tm) != 0) return 0;
-        }
-        else if (strcmp(fields[i], "file_tm") == 0) {
-            if (compare_time(a->file_tm, b->file_tm) != 0) return 0;
-        }
-        else if (strcmp(fields[i], "cpu_usage") == 0) {
-            if (a->cpu_usage != b->cpu_usage) return 0;
-        }
-        else if (strcmp(fields[i], "status") == 0) {
-            if (a->status != b->status) return 0;
+LdbResult ldb_prepare(LdbDatabase* db, const char* command, LdbStatement** out) {
+    if (out) *out = NULL;
+    if (db == NULL || !db->is_open || db->is_replica || command == NULL || out == NULL) return LDB_ERROR;
+
+    ScratchMark mark = scratch_mark();
+    LdbStatement* stmt = (LdbStatement*)my_calloc(1, sizeof(LdbStatement));
+    char* copy = (char*)scratch_alloc(strlen(command) + 1);
+    if (stmt) stmt->conditions = (Condition*)my_malloc(100 * sizeof(Condition));
+    if (!stmt || !copy || !stmt->conditions) {
+        ldb_finalize(stmt);
+        scratch_reset(mark);
+        return LDB_ERROR;
+    }
+    strcpy(copy, command);
+
+    char* cmd = copy;
+    while (*cmd == ' ' || *cmd == '\t') cmd++;
+    char* p = split_first_word(cmd);
+    size_t len = strlen(p);
+    while (len > 0 && isspace((unsigned char)p[len - 1])) p[--len] = '\0';
+
+    int ok = 1;
+    if (strcmp(cmd, "insert") == 0) {
+        stmt->kind = STMT_INSERT;
+        ok = stmt_parse_values(stmt, p) && stmt->value_count == 7;
+    }
+    else if (strcmp(cmd, "select") == 0) {
+        stmt->kind = STMT_SELECT;
+        // Строка результата заполняет только поля из списка (LdbRow.fields)
+        char* rest = split_first_word(p);
+        int field_count;
+        char** field_list = parse_field_list(p, &field_count);
+        ok = field_list != NULL && field_count > 0 && stmt_parse_conditions(stmt, rest);
+        for (int i = 0; ok && i < field_count; i++) {
+            int field = lex_field(field_list[i], strlen(field_list[i]));
+            if (field < 0) ok = 0;
+            else stmt->field_mask |= 1u << field;
         }
     }
+    else if (strcmp(cmd, "update") == 0) {
+        stmt->kind = STMT_UPDATE;
+        char* rest = split_first_word(p);
+        ok = *p && stmt_parse_values(stmt, p) && stmt_parse_conditions(stmt, rest);
+    }
+    else if (strcmp(cmd, "delete") == 0) {
+        stmt->kind = STMT_DELETE;
+        ok = stmt_parse_conditions(stmt, p);
+    }
+    else if (strcmp(cmd, "count") == 0) {
+        stmt->kind = STMT_COUNT;
+        ok = stmt_parse_conditions(stmt, p);
+    }
+    else ok = 0;
+
+    scratch_reset(mark);
+    if (!ok) {
+        ldb_finalize(stmt);
+        return LDB_ERROR;
+    }
+    *out = stmt;
+    return LDB_OK;
+}
+
+// Проверяет номер параметра и поле, к которому он относится
+static int stmt_param_field(LdbStatement* stmt, int index, const char** field) {
+    if (stmt == NULL || index < 1 || index > stmt->param_count) return 0;
+    int target = stmt->param_target[index - 1];
+    *field = target >= 0 ? stmt->conditions[target].field_name : stmt->values[-target - 1].field;
     return 1;
 }
 
-void uniq_cmd(const char* args, const char* full_command, FILE* output) {
-    if (!args || !*args) {
-        print_incorrect(output, full_command);
-        return;
-    }
+// Отмечает параметр привязанным. У условия кроме типизированного значения обновляется
+// и value_str: его читают бинарный поиск, карты зон и счетчики
+static void stmt_mark_bound(LdbStatement* stmt, int index, const char* text) {
+    int target = stmt->param_target[index - 1];
+    stmt->param_bound[index - 1] = 1;
+    stmt->executed = 0;
+    if (target < 0) return;
+    Condition* cond = &stmt->conditions[target];
+    strcpy(cond->value_str, text);
+    cond->typed = 1;
+}
 
-    char* args_copy = (char*)my_malloc(strlen(args) + 1);
-    if (!args_copy) {
-        print_incorrect(output, full_command);
-        return;
-    }
-    strcpy(args_copy, args);
+LdbResult ldb_bind_int(LdbStatement* stmt, int index, int value) {
+    const char* field;
+    if (!stmt_param_field(stmt, index, &field)) return LDB_ERROR;
+    if (strcmp(field, "pid") != 0 && strcmp(field, "priority") != 0) return LDB_ERROR;
+    int target = stmt->param_target[index - 1];
+    if (target >= 0) stmt->conditions[target].int_value = value;
+    else stmt->values[-target - 1].int_value = value;
+    char text[32];
+    sprintf(text, "%d", value);
+    stmt_mark_bound(stmt, index, text);
+    return LDB_OK;
+}
 
-    while (*args_copy == ' ' || *args_copy == '\t') args_copy++;
-    char* end = args_copy + strlen(args_copy) - 1;
-    while (end > args_copy && (*end == ' ' || *end == '\t')) *end-- = '\0';
+LdbResult ldb_bind_decimal(LdbStatement* stmt, int index, int hundredths) {
+    const char* field;
+    if (!stmt_param_field(stmt, index, &field) || strcmp(field, "cpu_usage") != 0) return LDB_ERROR;
+    int target = stmt->param_target[index - 1];
+    if (target >= 0) stmt->conditions[target].int_value = hundredths;
+    else stmt->values[-target - 1].int_value = hundredths;
+    // Текст как в команде: знак отдельно, иначе -1.25 превратилось бы в "-1.-25"
+    long long magnitude = hundredths < 0 ? -(long long)hundredths : hundredths;
+    char text[32];
+    sprintf(text, "%s%lld.%02lld", hundredths < 0 ? "-" : "", magnitude / 100, magnitude % 100);
+    stmt_mark_bound(stmt, index, text);
+    return LDB_OK;
+}
 
-    int field_count;
-    char** field_list = parse_field_list(args_copy, &field_count);
+LdbResult ldb_bind_time(LdbStatement* stmt, int index, LdbTime value) {
+    const char* field;
+    if (!stmt_param_field(stmt, index, &field)) return LDB_ERROR;
+    if (strcmp(field, "kern_tm") != 0 && strcmp(field, "file_tm") != 0) return LDB_ERROR;
+    if (value.hour > 23 || value.minute > 59 || value.second > 59) return LDB_ERROR;
+    Time t;
+    t.hour = value.hour;
+    t.minute = value.minute;
+    t.second = value.second;
+    int target = stmt->param_target[index - 1];
+    if (target >= 0) stmt->conditions[target].time_value = t;
+    else stmt->values[-target - 1].time_value = t;
+    char text[32];
+    sprintf(text, "'%02d:%02d:%02d'", t.hour, t.minute, t.second);
+    stmt_mark_bound(stmt, index, text);
+    return LDB_OK;
+}
 
-    if (!field_list || field_count == 0) {
-        if (field_list) free_field_list(field_list, field_count);
-        my_free(args_copy);
-        print_incorrect(output, full_command);
-        return;
+LdbResult ldb_bind_status(LdbStatement* stmt, int index, LdbStatus value) {
+    const char* field;
+    if (!stmt_param_field(stmt, index, &field) || strcmp(field, "status") != 0) return LDB_ERROR;
+    if ((int)value < 0 || (int)value > SLEEPING) return LDB_ERROR;
+    int target = stmt->param_target[index - 1];
+    if (target >= 0) stmt->conditions[target].int_value = (int)value;
+    else stmt->values[-target - 1].int_value = (int)value;
+    char text[32];
+    sprintf(text, "'%s'", status_names[value]);
+    stmt_mark_bound(stmt, index, text);
+    return LDB_OK;
+}
+
+LdbResult ldb_bind_text(LdbStatement* stmt, int index, const char* value) {
+    const char* field;
+    if (value == NULL || !stmt_param_field(stmt, index, &field) || strcmp(field, "name") != 0) return LDB_ERROR;
+    int target = stmt->param_target[index - 1];
+    if (target < 0) {
+        FieldValue* v = &stmt->values[-target - 1];
+        char* name = name_new(value, strlen(value));
+        if (!name) return LDB_ERROR;
+        name_release(v->str_value);
+        v->str_value = name;
+        stmt_mark_bound(stmt, index, "");
+        return LDB_OK;
+    }
+    // Текст в кавычках с экранированием, как его разбирает pars_str
+    char text[256];
+    int n = 0;
+    text[n++] = '"';
+    for (const char* s = value; *s; s++) {
+        if (n > 252) return LDB_ERROR;
+        if (*s == '"' || *s == '\\') text[n++] = '\\';
+        text[n++] = *s;
     }
+    text[n++] = '"';
+    text[n] = '\0';
+    strcpy(stmt->conditions[target].str_value, value);
+    stmt_mark_bound(stmt, index, text);
+    return LDB_OK;
+}
 
-    for (int i = 0; i < field_count; i++) {
-        for (int j = i + 1; j < field_count; j++) {
-            if (strcmp(field_list[i], field_list[j]) == 0) {
-                free_field_list(field_list, field_count);
-                my_free(args_copy);
-                print_incorrect(output, full_command);
-                return;
-            }
-        }
+// Заполняет поля из fields (биты LDB_FIELD_* в порядке InsertField), остальные обнуляет
+static void stmt_fill_row(LdbRow* row, Process* proc, unsigned int fields) {
+    memset(row, 0, sizeof(LdbRow));
+    row->fields = fields;
+    if (fields & (1u << INSERT_PID)) row->pid = proc->pid;
+    if (fields & (1u << INSERT_NAME)) row->name = name_text(&proc->name);
+    if (fields & (1u << INSERT_PRIORITY)) row->priority = proc->priority;
+    if (fields & (1u << INSERT_KERN_TM)) {
+        row->kern_tm.hour = proc->kern_tm.hour;
+        row->kern_tm.minute = proc->kern_tm.minute;
+        row->kern_tm.second = proc->kern_tm.second;
+    }
+    if (fields & (1u << INSERT_FILE_TM)) {
+        row->file_tm.hour = proc->file_tm.hour;
+        row->file_tm.minute = proc->file_tm.minute;
+        row->file_tm.second = proc->file_tm.second;
+    }
+    if (fields & (1u << INSERT_CPU_USAGE)) row->cpu_usage = proc->cpu_usage;
+    if (fields & (1u << INSERT_STATUS)) row->status = (LdbStatus)proc->status;
+}
+
+static int stmt_push_row(LdbStatement* stmt, Process* proc) {
+    if (stmt->row_count == stmt->row_capacity) {
+        int new_capacity = stmt->row_capacity ? stmt->row_capacity * 2 : 64;
+        Process** rows = (Process**)my_realloc(stmt->rows, new_capacity * sizeof(Process*));
+        if (rows == NULL) return 0;
+        stmt->rows = rows;
+        stmt->row_capacity = new_capacity;
     }
+    stmt->rows[stmt->row_count++] = proc;
+    return 1;
+}
 
-    int* to_delete = (int*)my_malloc(process_count * sizeof(int));
-    if (!to_delete) {
-        free_field_list(field_list, field_count);
-        my_free(args_copy);
-        print_incorrect(output, full_command);
-        return;
+// Отбирает подходящие строки в stmt->rows в порядке таблицы
+static int stmt_collect(LdbStatement* stmt) {
+    stmt->row_count = 0;
+    stmt->row_pos = 0;
+    if (shards_match(stmt->conditions, stmt->cond_count)) {
+        ShardMerge merge;
+        merge_begin(&merge);
+        Process* proc;
+        while ((proc = merge_next(&merge)) != NULL) {
+            if (!stmt_push_row(stmt, proc)) return 0;
+        }
+        return 1;
+    }
+    TableScan scan;
+    scan_begin(&scan, stmt->conditions, stmt->cond_count);
+    Process* proc;
+    while ((proc = scan_next(&scan)) != NULL) {
+        if (!stmt_push_row(stmt, proc)) return 0;
     }
+    return 1;
+}
 
-    for (int i = 0; i < process_count; i++) to_delete[i] = 0;
+static int stmt_execute_delete(LdbStatement* stmt, int* deleted) {
+    int packed = packed_rewrite(NULL, 0, stmt->conditions, stmt->cond_count);
+    if (packed < 0) return 0;
+    ScratchMark mark = scratch_mark();
+    int* indices = (int*)scratch_alloc((process_count + 1) * sizeof(int));
+    if (!indices) return 0;
+    int del_count = 0;
+    TableScan scan;
+    scan_begin(&scan, stmt->conditions, stmt->cond_count);
+    while (scan_next(&scan) != NULL) indices[del_count++] = scan.row;
+    for (int i = del_count - 1; i >= 0; i--) delete_process(indices[i]);
+    scratch_reset(mark);
+    *deleted = packed + del_count;
+    return 1;
+}
 
-    for (int i = process_count - 1; i >= 0; i--) {
-        if (to_delete[i]) continue;
-        Process* curr = get_process_index(i);
-        for (int j = i - 1; j >= 0; j--) {
-            if (to_delete[j]) continue;
-            Process* other = get_process_index(j);
-            if (compare_processes(curr, other, field_list, field_count)) {
-                to_delete[j] = 1;
-            }
+static int stmt_execute_insert(LdbStatement* stmt) {
+    Process parsed;
+    memset(&parsed, 0, sizeof(Process));
+    parsed.status = RUNNING;
+    Process* proc = &parsed;
+    for (int i = 0; i < stmt->value_count; i++) {
+        field_value_assign(&stmt->values[i], &proc, 1);
+    }
+    if (proc->name.kind == NAME_NONE) return 0;
+    proc = row_store(&parsed);
+    if (!proc) {
+        name_clear(&parsed.name);
+        return 0;
+    }
+    add_process(proc);
+    return 1;
+}
+
+LdbResult ldb_execute(LdbStatement* stmt, LdbRowCallback callback, void* ctx, int* affected) {
+    if (affected) *affected = 0;
+    if (stmt == NULL || snapshots != NULL) return LDB_ERROR;
+    for (int i = 0; i < stmt->param_count; i++) {
+        if (!stmt->param_bound[i]) return LDB_ERROR;
+    }
+    // select и вставка с sorted_insert работают со списком; delete и update переписывают блоки
+    int native = stmt->kind != STMT_SELECT &&
+        (stmt->kind != STMT_INSERT || !sorted_insert_mode || sort_state_count == 0);
+    if (!native && !packed_expand_in_budget()) return LDB_ERROR;
+    int count = 0;
+    // Проход по индексу берет позиции из памяти команды
+    ScratchMark mark = scratch_mark();
+    LdbResult result = LDB_OK;
+    switch (stmt->kind) {
+    case STMT_INSERT:
+        if (!stmt_execute_insert(stmt)) result = LDB_ERROR;
+        else count = 1;
+        break;
+    case STMT_SELECT:
+        if (!stmt_collect(stmt)) {
+            result = LDB_ERROR;
+            break;
+        }
+        count = stmt->row_count;
+        for (int i = 0; i < stmt->row_count && callback; i++) {
+            LdbRow row;
+            stmt_fill_row(&row, stmt->rows[i], stmt->field_mask);
+            if (callback(&row, ctx)) break;
+        }
+        stmt->row_pos = stmt->row_count;
+        stmt->executed = 1;
+        break;
+    case STMT_COUNT: {
+        PackedScan packed;
+        packed_scan_begin(&packed, stmt->conditions, stmt->cond_count);
+        while (packed_scan_next(&packed) != NULL) count++;
+        TableScan scan;
+        scan_begin(&scan, stmt->conditions, stmt->cond_count);
+        while (scan_next(&scan) != NULL) count++;
+        break;
+    }
+    case STMT_UPDATE:
+        count = update_table(stmt->values, stmt->value_count, stmt->conditions, stmt->cond_count);
+        if (count < 0) {
+            count = 0;
+            result = LDB_ERROR;
         }
+        break;
+    case STMT_DELETE:
+        if (!stmt_execute_delete(stmt, &count)) result = LDB_ERROR;
+        break;
     }
+    if (stmt->kind != STMT_SELECT && stmt->kind != STMT_COUNT) table_settle(1);
+    scratch_reset(mark);
+    if (affected) *affected = count;
+    return result;
+}
 
-    int del_count = 0;
-    for (int i = 0; i < process_count; i++) if (to_delete[i]) del_count++;
-
-    for (int i = process_count - 1; i >= 0; i--) {
-        if (to_delete[i]) delete_process(i);
+LdbResult ldb_step(LdbStatement* stmt, LdbRow* row) {
+    if (stmt == NULL || row == NULL) return LDB_ERROR;
+    if (stmt->kind != STMT_SELECT) {
+        if (stmt->executed) return LDB_DONE;
+        LdbResult result = ldb_execute(stmt, NULL, NULL, NULL);
+        stmt->executed = 1;
+        return result == LDB_OK ? LDB_DONE : result;
+    }
+    if (!stmt->executed) {
+        // Как в ldb_execute: пока читатели держат снимки, список не разворачивается
+        if (snapshots != NULL) return LDB_ERROR;
+        for (int i = 0; i < stmt->param_count; i++) {
+            if (!stmt->param_bound[i]) return LDB_ERROR;
+        }
+        if (!packed_expand_in_budget()) return LDB_ERROR;
+        ScratchMark mark = scratch_mark();
+        int collected = stmt_collect(stmt);
+        scratch_reset(mark);
+        if (!collected) return LDB_ERROR;
+        stmt->executed = 1;
     }
+    if (stmt->row_pos >= stmt->row_count) return LDB_DONE;
+    stmt_fill_row(row, stmt->rows[stmt->row_pos++], stmt->field_mask);
+    return LDB_ROW;
+}
 
-    my_free(to_delete);
-    free_field_list(field_list, field_count);
-    my_free(args_copy);
-    fprintf(output, "uniq:%d\n", del_count);
+LdbResult ldb_reset(LdbStatement* stmt) {
+    if (stmt == NULL) return LDB_ERROR;
+    stmt->executed = 0;
+    stmt->row_count = 0;
+    stmt->row_pos = 0;
+    return LDB_OK;
 }
 
-// ===== SORT =====
+// --- прием строк из нескольких потоков ---
+
+// Производитель сам собирает записи Process в цепочку (свой буфер) и, когда пачка
+// заполнится, ставит ее в общую очередь MPSC без блокировок (очередь Вьюкова: вставка -
+// один обмен указателя хвоста). Поток-владелец дескриптора забирает пачки в порядке
+// постановки и дописывает их в конец таблицы, проходя список только один раз на drain.
+// Порядок пачек в очереди - порядок обменов хвоста, внутри пачки - порядок ldb_produce.
+// Пропускную способность для 1-16 производителей меряет ingest_bench.c.
+
+#define INGEST_BATCH_ROWS 256
+
+typedef struct IngestBatch {
+    struct IngestBatch* volatile next;
+    Process* first;
+    Process* last;
+    int count;
+} IngestBatch;
 
 typedef struct {
-    char field_name[50];
-    int order; // 0 - asc, 1 - desc
-} SortField;
+    IngestBatch* volatile tail;     // сюда вставляют производители
+    IngestBatch* head;              // отсюда забирает только владелец
+    IngestBatch stub;
+} IngestQueue;
 
-int compare_for_sort(Process* a, Process* b, SortField* fields, int count) {
-    if (!a || !b || !fields || count == 0) return 0;
+struct LdbProducer {
+    IngestBatch* batch;             // заполняемая пачка, NULL - еще не начата
+};
 
-    for (int i = 0; i < count; i++) {
-        int cmp = 0;
+static IngestQueue ingest_queue = { 0 };
+static long ingest_batches = 0;
 
-        if (strcmp(fields[i].field_name, "pid") == 0) {
-            cmp = compare_int(a->pid, b->pid);
-        }
-        else if (strcmp(fields[i].field_name, "name") == 0) {
-            cmp = compare_str(a->name, b->name);
-        }
-        else if (strcmp(fields[i].field_name, "priority") == 0) {
-            cmp = compare_int(a->priority, b->priority);
-        }
-        else if (strcmp(fields[i].field_name, "kern_tm") == 0) {
-            cmp = compare_time(a->kern_tm, b->kern_tm);
-        }
-        else if (strcmp(fields[i].field_name, "file_tm") == 0) {
-            cmp = compare_time(a->file_tm, b->file_tm);
-        }
-        else if (strcmp(fields[i].field_name, "cpu_usage") == 0) {
-            cmp = compare_decimal(a->cpu_usage, b->cpu_usage);
-        }
-        else if (strcmp(fields[i].field_name, "status") == 0) {
-            cmp = compare_status(a->status, b->status);
-        }
+static void ingest_push(IngestQueue* queue, IngestBatch* batch) {
+    batch->next = NULL;
+    IngestBatch* prev = (IngestBatch*)atomic_exchange_ptr((void* volatile*)&queue->tail, batch);
+    // До этой записи пачка уже в хвосте, но недоступна из head: ingest_pop подождет
+    atomic_exchange_ptr((void* volatile*)&prev->next, batch);
+}
 
-        if (cmp != 0) {
-            return fields[i].order == 0 ? cmp : -cmp;
-        }
+// NULL - очередь пуста или производитель еще не дописал ссылку на свою пачку
+static IngestBatch* ingest_pop(IngestQueue* queue) {
+    IngestBatch* head = queue->head;
+    IngestBatch* next = (IngestBatch*)atomic_load_ptr((void* volatile*)&head->next);
+    if (head == &queue->stub) {
+        if (next == NULL) return NULL;
+        queue->head = next;
+        head = next;
+        next = (IngestBatch*)atomic_load_ptr((void* volatile*)&next->next);
     }
-
-    return 0;
+    if (next != NULL) {
+        queue->head = next;
+        return head;
+    }
+    if (atomic_load_ptr((void* volatile*)&queue->tail) != head) return NULL;
+    ingest_push(queue, &queue->stub);
+    next = (IngestBatch*)atomic_load_ptr((void* volatile*)&head->next);
+    if (next == NULL) return NULL;
+    queue->head = next;
+    return head;
 }
 
-int parse_sort_fields(const char* str, SortField* fields, int* count) {
-    if (!str || !*str || !fields || !count) return 0;
+static void ingest_init() {
+    memset(&ingest_queue, 0, sizeof(ingest_queue));
+    ingest_queue.tail = &ingest_queue.stub;
+    ingest_queue.head = &ingest_queue.stub;
+}
 
-    char* temp = (char*)my_malloc(strlen(str) + 1);
-    if (!temp) return 0;
-    strcpy(temp, str);
+static void ingest_batch_free(IngestBatch* batch) {
+    while (batch->first) {
+        Process* next = batch->first->next;
+        free_process(batch->first);
+        batch->first = next;
+    }
+    my_free(batch);
+}
 
-    *count = 0;
-    int error = 0;
+// Недобранные пачки при закрытии дескриптора выбрасываются
+static void ingest_discard() {
+    if (ingest_queue.head == NULL) return;
+    IngestBatch* batch;
+    while ((batch = ingest_pop(&ingest_queue)) != NULL) ingest_batch_free(batch);
+}
 
-    char* token = strtok(temp, ",");
-    while (token && *count < 100) {
-        while (*token == ' ') token++;
+LdbProducer* ldb_producer_open(LdbDatabase* db) {
+    if (db == NULL || !db->is_open || db->is_replica) return NULL;
+    return (LdbProducer*)my_calloc(1, sizeof(LdbProducer));
+}
 
-        char* eq = strchr(token, '=');
-        if (!eq) { error = 1; break; }
+// Отдает неполную пачку в очередь
+LdbResult ldb_producer_flush(LdbProducer* producer) {
+    if (producer == NULL) return LDB_ERROR;
+    if (producer->batch) {
+        ingest_push(&ingest_queue, producer->batch);
+        producer->batch = NULL;
+    }
+    return LDB_OK;
+}
 
-        *eq = '\0';
-        char* name = token;
-        char* order = eq + 1;
+LdbResult ldb_produce(LdbProducer* producer, const LdbRow* row) {
+    if (producer == NULL || row == NULL || row->name == NULL || row->cpu_usage < 0 ||
+        (int)row->status < 0 || (int)row->status > SLEEPING ||
+        row->kern_tm.hour > 23 || row->kern_tm.minute > 59 || row->kern_tm.second > 59 ||
+        row->file_tm.hour > 23 || row->file_tm.minute > 59 || row->file_tm.second > 59) {
+        return LDB_ERROR;
+    }
+    Process* proc = creation_process();
+    if (proc == NULL) return LDB_ERROR;
+    if (!name_assign(&proc->name, row->name, strlen(row->name))) {
+        free_process(proc);
+        return LDB_ERROR;
+    }
+    proc->pid = row->pid;
+    proc->priority = row->priority;
+    proc->kern_tm.hour = row->kern_tm.hour;
+    proc->kern_tm.minute = row->kern_tm.minute;
+    proc->kern_tm.second = row->kern_tm.second;
+    proc->file_tm.hour = row->file_tm.hour;
+    proc->file_tm.minute = row->file_tm.minute;
+    proc->file_tm.second = row->file_tm.second;
+    proc->cpu_usage = row->cpu_usage;
+    proc->status = (Status)row->status;
+
+    IngestBatch* batch = producer->batch;
+    if (batch == NULL) {
+        batch = (IngestBatch*)my_calloc(1, sizeof(IngestBatch));
+        if (batch == NULL) {
+            free_process(proc);
+            return LDB_ERROR;
+        }
+        producer->batch = batch;
+    }
+    if (batch->last) batch->last->next = proc;
+    else batch->first = proc;
+    batch->last = proc;
+    if (++batch->count == INGEST_BATCH_ROWS) return ldb_producer_flush(producer);
+    return LDB_OK;
+}
 
-        char* end = name + strlen(name) - 1;
-        while (end > name && (*end == ' ' || *end == '\t')) *end-- = '\0';
-        while (*order == ' ' || *order == '\t') order++;
-        end = order + strlen(order) - 1;
-        while (end > order && (*end == ' ' || *end == '\t')) *end-- = '\0';
+void ldb_producer_close(LdbProducer* producer) {
+    if (producer == NULL) return;
+    ldb_producer_flush(producer);
+    my_free(producer);
+}
 
-        // Проверка на дубликаты полей
-        for (int i = 0; i < *count; i++) {
-            if (strcmp(fields[i].field_name, name) == 0) { error = 1; break; }
-        }
-        if (error) break;
+LdbResult ldb_ingest_drain(LdbDatabase* db, int* inserted) {
+    if (inserted) *inserted = 0;
+    if (db == NULL || !db->is_open || db->is_replica || snapshots != NULL) return LDB_ERROR;
+    int sorted = sorted_insert_mode && sort_state_count > 0;
+    if (sorted && !packed_expand_in_budget()) return LDB_ERROR;
 
-        strcpy(fields[*count].field_name, name);
-        if (strcmp(order, "asc") == 0) {
-            fields[*count].order = 0;
-        }
-        else if (strcmp(order, "desc") == 0) {
-            fields[*count].order = 1;
+    int count = 0;
+    Process* tail = NULL;
+    IngestBatch* batch;
+    while ((batch = ingest_pop(&ingest_queue)) != NULL) {
+        if (tail == NULL && !sorted) {
+            tail = head;
+            while (tail && tail->next) tail = tail->next;
         }
-        else {
-            error = 1;
-            break;
+        Process* proc = batch->first;
+        while (proc) {
+            Process* next = proc->next;
+            proc->next = NULL;
+            if (sorted) add_process(proc);
+            else {
+                append_process_after(tail, proc);
+                tail = proc;
+            }
+            proc = next;
+            count++;
         }
+        batch->first = NULL;
+        ingest_batch_free(batch);
+        ingest_batches++;
+    }
+    if (count > 0) table_settle(1);
+    if (inserted) *inserted = count;
+    return LDB_OK;
+}
 
-        (*count)++;
-        token = strtok(NULL, ",");
+// Протокол и main - только в исполняемом файле: библиотека дает ldb_* (lab_db.h)
+#ifndef LAB_DB_LIBRARY
+
+// ===== БИНАРНЫЙ ПРОТОКОЛ =====
+
+// Если input.txt начинается с BIN_MAGIC, поток читается как последовательность кадров,
+// а output.txt пишется кадрами результата (тоже начиная с BIN_MAGIC). Все числа - little
+// endian. Кадр: u32 длина содержимого, затем содержимое.
+//
+// Запрос: u8 операция (BinOp). Для BIN_TEXT дальше идет строка команды в текстовом
+// синтаксисе (для всего, что не выражается кадром: sort, aggregate, order_by, /in/ ...).
+// Иначе: u8 число присваиваний, u8 число условий, присваивания (u8 поле, операнд),
+// условия (u8 поле, u8 оператор BinOper, операнд). Операнд зависит от поля: pid,
+// priority, status - i32, cpu_usage - i32 в сотых долях, kern_tm и file_tm - u32 секунд
+// от полуночи, name - u16 длина и байты имени.
+//
+// Ответ на BIN_TEXT - один кадр BIN_RESULT_TEXT с текстовым выводом команды. На остальные -
+// по кадру BIN_RESULT_ROW на каждую строку select (все поля: i32 pid, priority, cpu_usage,
+// status, u32 kern_tm, file_tm, u16 длина имени, 0xFFFF - без имени, байты имени) и
+// завершающий BIN_RESULT_DONE: u8 0 - успешно, 1 - ошибка; i32 число затронутых строк.
+//
+// Кадры разбираются прямо в подготовленный запрос (LdbStatement) и выполняются через
+// ldb_execute без разбора текста. "lab_db convert <текст> <кадры>" переводит текстовый
+// input в бинарный.
+
+#define BIN_MAGIC "LDB1"
+#define BIN_MAGIC_SIZE 4
+#define BIN_NO_NAME 0xFFFF
+#define BIN_MAX_FRAME (64 * 1024 * 1024)
+
+typedef enum { BIN_INSERT = 1, BIN_SELECT, BIN_UPDATE, BIN_DELETE, BIN_COUNT, BIN_TEXT } BinOp;
+typedef enum { BIN_EQ, BIN_NE, BIN_LT, BIN_GT, BIN_LE, BIN_GE, BIN_PREFIX, BIN_OPERS } BinOper;
+typedef enum { BIN_RESULT_ROW = 1, BIN_RESULT_DONE, BIN_RESULT_TEXT } BinResult;
+
+// Номер поля в кадре
+static const char* bin_fields[] = { "pid", "name", "priority", "kern_tm", "file_tm", "cpu_usage", "status" };
+static const char* bin_opers[] = { "=", "!=", "<", ">", "<=", ">=", "prefix" };
+
+#define BIN_FIELDS 7
+
+static int bin_field_id(const char* field) {
+    for (int i = 0; i < BIN_FIELDS; i++) {
+        if (strcmp(field, bin_fields[i]) == 0) return i;
     }
+    return -1;
+}
 
-    my_free(temp);
-    return !error && *count > 0;
+static void bin_store_u16(unsigned char* p, unsigned int value) {
+    p[0] = (unsigned char)value;
+    p[1] = (unsigned char)(value >> 8);
 }
 
-// Структура для сортировки
-typedef struct {
-    Process* proc;
-    int index;
-} SortItem;
+static void bin_store_u32(unsigned char* p, unsigned int value) {
+    p[0] = (unsigned char)value;
+    p[1] = (unsigned char)(value >> 8);
+    p[2] = (unsigned char)(value >> 16);
+    p[3] = (unsigned char)(value >> 24);
+}
 
-// Функция сравнения с учетом индекса
-int compare_for_sort_stable(SortItem* a, SortItem* b, SortField* fields, int count) {
-    for (int i = 0; i < count; i++) {
-        int cmp = 0;
+static unsigned int bin_load_u32(const unsigned char* p) {
+    return p[0] | (unsigned int)p[1] << 8 | (unsigned int)p[2] << 16 | (unsigned int)p[3] << 24;
+}
 
-        if (strcmp(fields[i].field_name, "pid") == 0) {
-            cmp = compare_int(a->proc->pid, b->proc->pid);
-        }
-        else if (strcmp(fields[i].field_name, "name") == 0) {
-            cmp = compare_str(a->proc->name, b->proc->name);
-        }
-        else if (strcmp(fields[i].field_name, "priority") == 0) {
-            cmp = compare_int(a->proc->priority, b->proc->priority);
-        }
-        else if (strcmp(fields[i].field_name, "kern_tm") == 0) {
-            cmp = compare_time(a->proc->kern_tm, b->proc->kern_tm);
-        }
-        else if (strcmp(fields[i].field_name, "file_tm") == 0) {
-            cmp = compare_time(a->proc->file_tm, b->proc->file_tm);
-        }
-        else if (strcmp(fields[i].field_name, "cpu_usage") == 0) {
-            cmp = compare_decimal(a->proc->cpu_usage, b->proc->cpu_usage);
-        }
-        else if (strcmp(fields[i].field_name, "status") == 0) {
-            cmp = compare_status(a->proc->status, b->proc->status);
-        }
+static int time_seconds(Time t) {
+    return t.hour * 3600 + t.minute * 60 + t.second;
+}
 
-        if (cmp != 0) {
-            return fields[i].order == 0 ? cmp : -cmp;
-        }
+// --- чтение кадра ---
+
+typedef struct {
+    const unsigned char* p;
+    const unsigned char* end;
+    int failed;
+} BinReader;
+
+static unsigned int bin_get(BinReader* r, int size) {
+    if (r->failed || r->end - r->p < size) {
+        r->failed = 1;
+        return 0;
     }
+    unsigned int value = r->p[0];
+    if (size >= 2) value |= (unsigned int)r->p[1] << 8;
+    if (size == 4) value |= (unsigned int)r->p[2] << 16 | (unsigned int)r->p[3] << 24;
+    r->p += size;
+    return value;
+}
 
-    // Ключи равны - сравниваем по исходному индексу для стабильности
-    return compare_int(a->index, b->index);
+// Имя операнда: указатель внутрь кадра, не заканчивается нулем
+static const char* bin_get_name(BinReader* r, size_t* len) {
+    *len = bin_get(r, 2);
+    if (r->failed || (size_t)(r->end - r->p) < *len) {
+        r->failed = 1;
+        return NULL;
+    }
+    const char* name = (const char*)r->p;
+    r->p += *len;
+    return name;
 }
 
-// Быстрая сортировка для SortItem
-void quicksort_stable(SortItem* arr, int left, int right, SortField* fields, int count) {
-    if (left >= right) return;
+// Операнд поля field; 0 - кадр испорчен или значение вне диапазона
+static int bin_get_operand(BinReader* r, int field, int* int_value, Time* time_value, const char** name, size_t* name_len) {
+    if (field == 1) {
+        *name = bin_get_name(r, name_len);
+        return !r->failed;
+    }
+    unsigned int raw = bin_get(r, 4);
+    if (r->failed) return 0;
+    if (field == 3 || field == 4) {
+        if (raw >= 24 * 3600) return 0;
+        time_value->hour = (unsigned short)(raw / 3600);
+        time_value->minute = (unsigned short)(raw / 60 % 60);
+        time_value->second = (unsigned short)(raw % 60);
+        return 1;
+    }
+    *int_value = (int)raw;
+    if (field == 5) return *int_value >= 0;
+    if (field == 6) return *int_value >= 0 && *int_value <= SLEEPING;
+    return 1;
+}
 
-    int i = left;
-    int j = right;
-    SortItem pivot = arr[left + (right - left) / 2];
+// Текст условия для value_str: его читают бинарный поиск, карты зон и счетчики
+static void bin_condition_text(Condition* cond, int field) {
+    switch (field) {
+    case 0:
+    case 2: sprintf(cond->value_str, "%d", cond->int_value); break;
+    case 5: sprintf(cond->value_str, "%d.%02d", cond->int_value / 100, cond->int_value % 100); break;
+    case 6: sprintf(cond->value_str, "'%s'", status_names[cond->int_value]); break;
+    case 1: {
+        int n = 0;
+        cond->value_str[n++] = '"';
+        for (const char* s = cond->str_value; *s; s++) {
+            if (*s == '"' || *s == '\\') cond->value_str[n++] = '\\';
+            cond->value_str[n++] = *s;
+        }
+        cond->value_str[n++] = '"';
+        cond->value_str[n] = '\0';
+        break;
+    }
+    default:
+        sprintf(cond->value_str, "'%02d:%02d:%02d'", cond->time_value.hour, cond->time_value.minute,
+            cond->time_value.second);
+    }
+}
 
-    while (i <= j) {
-        while (compare_for_sort_stable(&arr[i], &pivot, fields, count) < 0) i++;
-        while (compare_for_sort_stable(&arr[j], &pivot, fields, count) > 0) j--;
+static void bin_stmt_clear(LdbStatement* stmt) {
+    field_values_release(stmt->values, stmt->value_count);
+    stmt->value_count = 0;
+    stmt->cond_count = 0;
+    stmt->param_count = 0;
+    stmt->row_count = 0;
+    stmt->row_pos = 0;
+    stmt->executed = 0;
+}
 
-        if (i <= j) {
-            SortItem temp = arr[i];
-            arr[i] = arr[j];
-            arr[j] = temp;
-            i++;
-            j--;
+// Заполняет stmt по кадру (после байта операции); 0 - кадр некорректен
+static int bin_decode(BinReader* r, BinOp op, LdbStatement* stmt) {
+    static const StatementKind kinds[] = { STMT_INSERT, STMT_SELECT, STMT_UPDATE, STMT_DELETE, STMT_COUNT };
+    stmt->kind = kinds[op - BIN_INSERT];
+    // Кадр строки результата всегда несет все поля
+    stmt->field_mask = LDB_FIELD_ALL;
+    int value_count = (int)bin_get(r, 1);
+    int cond_count = (int)bin_get(r, 1);
+    if (r->failed || value_count > 7 || cond_count > 100) return 0;
+    if (op == BIN_INSERT ? value_count != 7 : op == BIN_UPDATE ? value_count == 0 : value_count != 0) return 0;
+
+    int seen = 0;
+    for (int i = 0; i < value_count; i++) {
+        int field = (int)bin_get(r, 1);
+        if (r->failed || field >= BIN_FIELDS || (seen & (1 << field))) return 0;
+        seen |= 1 << field;
+        FieldValue* value = &stmt->values[stmt->value_count];
+        memset(value, 0, sizeof(FieldValue));
+        strcpy(value->field, bin_fields[field]);
+        const char* name = NULL;
+        size_t name_len = 0;
+        if (!bin_get_operand(r, field, &value->int_value, &value->time_value, &name, &name_len)) return 0;
+        if (name) {
+            value->str_value = name_new(name, name_len);
+            if (value->str_value == NULL) return 0;
         }
+        stmt->value_count++;
     }
 
-    if (left < j) quicksort_stable(arr, left, j, fields, count);
-    if (i < right) quicksort_stable(arr, i, right, fields, count);
+    for (int i = 0; i < cond_count; i++) {
+        int field = (int)bin_get(r, 1);
+        int oper = (int)bin_get(r, 1);
+        if (r->failed || field >= BIN_FIELDS || oper >= BIN_OPERS) return 0;
+        if (oper == BIN_PREFIX ? field != 1 : field == 6 && oper > BIN_NE) return 0;
+        Condition* cond = &stmt->conditions[stmt->cond_count];
+        strcpy(cond->field_name, bin_fields[field]);
+        strcpy(cond->oper, bin_opers[oper]);
+        cond->set = NULL;
+        cond->typed = 1;
+        const char* name = NULL;
+        size_t name_len = 0;
+        if (!bin_get_operand(r, field, &cond->int_value, &cond->time_value, &name, &name_len)) return 0;
+        if (name) {
+            // value_str с кавычками и экранированием должен поместиться в 256 байт
+            if (name_len > 126 || memchr(name, '\0', name_len)) return 0;
+            memcpy(cond->str_value, name, name_len);
+            cond->str_value[name_len] = '\0';
+        }
+        bin_condition_text(cond, field);
+        stmt->cond_count++;
+    }
+    return r->p == r->end;
 }
 
-void sort_cmd(const char* args, const char* full_command, FILE* output) {
-    if (!args || !*args) {
-        print_incorrect(output, full_command);
-        return;
+// --- кадры результата ---
+
+static void bin_frame_header(OutBuffer* out, unsigned int length, BinResult type) {
+    unsigned char header[5];
+    bin_store_u32(header, length);
+    header[4] = (unsigned char)type;
+    out_write(out, (const char*)header, sizeof(header));
+}
+
+static int bin_row_callback(const LdbRow* row, void* ctx) {
+    OutBuffer* out = (OutBuffer*)ctx;
+    size_t name_len = row->name ? strlen(row->name) : 0;
+    if (name_len >= BIN_NO_NAME) name_len = BIN_NO_NAME - 1;
+    unsigned char fields[26];
+    bin_store_u32(fields, (unsigned int)row->pid);
+    bin_store_u32(fields + 4, (unsigned int)row->priority);
+    bin_store_u32(fields + 8, (unsigned int)row->cpu_usage);
+    bin_store_u32(fields + 12, (unsigned int)row->status);
+    bin_store_u32(fields + 16, row->kern_tm.hour * 3600u + row->kern_tm.minute * 60u + row->kern_tm.second);
+    bin_store_u32(fields + 20, row->file_tm.hour * 3600u + row->file_tm.minute * 60u + row->file_tm.second);
+    bin_store_u16(fields + 24, row->name ? (unsigned int)name_len : BIN_NO_NAME);
+    bin_frame_header(out, (unsigned int)(1 + sizeof(fields) + name_len), BIN_RESULT_ROW);
+    out_write(out, (const char*)fields, sizeof(fields));
+    if (name_len > 0) out_write(out, row->name, name_len);
+    return 0;
+}
+
+static void bin_done(OutBuffer* out, int ok, int affected) {
+    unsigned char body[5];
+    body[0] = ok ? 0 : 1;
+    bin_store_u32(body + 1, (unsigned int)affected);
+    bin_frame_header(out, 1 + sizeof(body), BIN_RESULT_DONE);
+    out_write(out, (const char*)body, sizeof(body));
+}
+
+// 1 - поток начинается с BIN_MAGIC (он пропускается); иначе поток перемотан в начало
+static int bin_detect(FILE* input) {
+    char magic[BIN_MAGIC_SIZE];
+    if (fread(magic, 1, BIN_MAGIC_SIZE, input) == BIN_MAGIC_SIZE && memcmp(magic, BIN_MAGIC, BIN_MAGIC_SIZE) == 0) {
+        return 1;
     }
+    rewind(input);
+    return 0;
+}
 
-    char* args_copy = (char*)my_malloc(strlen(args) + 1);
-    if (!args_copy) {
-        print_incorrect(output, full_command);
+// Выполняет все кадры input; текстовые команды идут через execute_line
+static void bin_session(FILE* input, FILE* output) {
+    fwrite(BIN_MAGIC, 1, BIN_MAGIC_SIZE, output);
+    LdbStatement* stmt = (LdbStatement*)my_calloc(1, sizeof(LdbStatement));
+    if (stmt) stmt->conditions = (Condition*)my_malloc(100 * sizeof(Condition));
+    OutBuffer* out = out_begin(output);
+    FILE* text_out = tmpfile();
+    size_t capacity = 4096;
+    unsigned char* frame = (unsigned char*)my_malloc(capacity);
+    if (stmt == NULL || stmt->conditions == NULL || out == NULL || text_out == NULL || frame == NULL) {
+        ldb_finalize(stmt);
+        if (text_out) fclose(text_out);
+        my_free(frame);
         return;
     }
-    strcpy(args_copy, args);
 
-    while (*args_copy == ' ' || *args_copy == '\t') args_copy++;
-    char* end = args_copy + strlen(args_copy) - 1;
-    while (end > args_copy && (*end == ' ' || *end == '\t')) *end-- = '\0';
+    unsigned char header[4];
+    while (fread(header, 1, sizeof(header), input) == sizeof(header)) {
+        unsigned int length = bin_load_u32(header);
+        if (length == 0 || length > BIN_MAX_FRAME) break;
+        if (length + 1 > capacity) {
+            unsigned char* grown = (unsigned char*)my_realloc(frame, length + 1);
+            if (grown == NULL) break;
+            frame = grown;
+            capacity = length + 1;
+        }
+        if (fread(frame, 1, length, input) != length) break;
+
+        ScratchMark mark = scratch_mark();
+        BinOp op = (BinOp)frame[0];
+        if (op == BIN_TEXT) {
+            frame[length] = '\0';
+            const char* line = (const char*)frame + 1;
+            rewind(text_out);
+            if (line[0] != '\0') execute_line(line, text_out);
+            pending_flush(text_out);
+            long text_len = ftell(text_out);
+            bin_frame_header(out, (unsigned int)(1 + text_len), BIN_RESULT_TEXT);
+            out_flush(out);
+            copy_prefix(text_out, text_len, output);
+        }
+        else {
+            BinReader reader = { frame + 1, frame + length, 0 };
+            int affected = 0;
+            int ok = op >= BIN_INSERT && op < BIN_TEXT && bin_decode(&reader, op, stmt) &&
+                ldb_execute(stmt, bin_row_callback, out, &affected) == LDB_OK;
+            bin_done(out, ok, affected);
+            bin_stmt_clear(stmt);
+        }
+        scratch_reset(mark);
+    }
+    out_flush(out);
+    fclose(text_out);
+    my_free(frame);
+    ldb_finalize(stmt);
+}
 
-    SortField fields[100];
-    int count = 0;
+// ===== MAIN =====
 
-    if (!parse_sort_fields(args_copy, fields, &count)) {
-        my_free(args_copy);
-        print_incorrect(output, full_command);
-        return;
+// Читает строку любой длины (например, с длинным списком /in/) в *buf,
+// увеличивая буфер по мере надобности. 0 - конец файла или нет памяти
+static int read_line(FILE* input, char** buf, size_t* capacity) {
+    size_t len = 0;
+    for (;;) {
+        if (*capacity - len < 2) {
+            size_t new_capacity = *capacity * 2;
+            char* grown = (char*)my_realloc(*buf, new_capacity);
+            if (grown == NULL) return 0;
+            *buf = grown;
+            *capacity = new_capacity;
+        }
+        if (!fgets(*buf + len, (int)(*capacity - len), input)) return len > 0;
+        len += strlen(*buf + len);
+        if (len > 0 && (*buf)[len - 1] == '\n') return 1;
     }
+}
 
-    if (count == 0) {
-        my_free(args_copy);
-        print_incorrect(output, full_command);
-        return;
-    }
+// --- преобразование текстового input ---
 
-    if (process_count == 0) {
-        my_free(args_copy);
-        fprintf(output, "sort:0\n");
-        return;
+typedef struct {
+    unsigned char* data;
+    size_t len;
+    size_t capacity;
+    int failed;
+} BinBuilder;
+
+static void bin_put(BinBuilder* b, const void* bytes, size_t n) {
+    if (b->failed) return;
+    if (b->len + n > b->capacity) {
+        size_t new_capacity = b->capacity ? b->capacity * 2 : 256;
+        while (new_capacity < b->len + n) new_capacity *= 2;
+        unsigned char* grown = (unsigned char*)my_realloc(b->data, new_capacity);
+        if (grown == NULL) {
+            b->failed = 1;
+            return;
+        }
+        b->data = grown;
+        b->capacity = new_capacity;
     }
+    memcpy(b->data + b->len, bytes, n);
+    b->len += n;
+}
 
-    // Создаем массив SortItem с индексами
-    SortItem* items = (SortItem*)my_malloc(process_count * sizeof(SortItem));
-    if (!items) {
-        my_free(args_copy);
-        print_incorrect(output, full_command);
-        return;
+static void bin_put_u8(BinBuilder* b, unsigned int value) {
+    unsigned char byte = (unsigned char)value;
+    bin_put(b, &byte, 1);
+}
+
+static void bin_put_u32(BinBuilder* b, unsigned int value) {
+    unsigned char bytes[4];
+    bin_store_u32(bytes, value);
+    bin_put(b, bytes, 4);
+}
+
+static void bin_put_operand(BinBuilder* b, int field, int int_value, Time time_value, const char* name) {
+    if (field == 1) {
+        size_t len = strlen(name);
+        unsigned char bytes[2];
+        bin_store_u16(bytes, (unsigned int)len);
+        bin_put(b, bytes, 2);
+        bin_put(b, name, len);
     }
+    else if (field == 3 || field == 4) bin_put_u32(b, (unsigned int)time_seconds(time_value));
+    else bin_put_u32(b, (unsigned int)int_value);
+}
 
-    Process* curr = head;
-    for (int i = 0; i < process_count; i++) {
-        items[i].proc = curr;
-        items[i].index = i;  // Сохраняем исходный индекс
-        curr = curr->next;
+// Кадр запроса по разобранной команде; 0 - команду можно передать только текстом
+static int bin_encode(BinBuilder* b, LdbStatement* stmt) {
+    static const BinOp ops[] = { BIN_INSERT, BIN_SELECT, BIN_UPDATE, BIN_DELETE, BIN_COUNT };
+    if (stmt->param_count > 0) return 0;
+    for (int i = 0; i < stmt->value_count; i++) {
+        const char* name = stmt->values[i].str_value;
+        if (strcmp(stmt->values[i].field, "name") == 0 && (name == NULL || strlen(name) >= BIN_NO_NAME)) return 0;
+    }
+    int opers[100];
+    for (int i = 0; i < stmt->cond_count; i++) {
+        Condition* cond = &stmt->conditions[i];
+        opers[i] = -1;
+        for (int o = 0; o < BIN_OPERS; o++) {
+            if (strcmp(cond->oper, bin_opers[o]) == 0) opers[i] = o;
+        }
+        if (opers[i] < 0 || cond->set || !cond->typed || strlen(cond->str_value) > 126) return 0;
     }
 
-    // Сортируем
-    quicksort_stable(items, 0, process_count - 1, fields, count);
+    bin_put_u8(b, ops[stmt->kind]);
+    bin_put_u8(b, (unsigned int)stmt->value_count);
+    bin_put_u8(b, (unsigned int)stmt->cond_count);
+    for (int i = 0; i < stmt->value_count; i++) {
+        FieldValue* value = &stmt->values[i];
+        int field = bin_field_id(value->field);
+        bin_put_u8(b, (unsigned int)field);
+        bin_put_operand(b, field, value->int_value, value->time_value, value->str_value);
+    }
+    for (int i = 0; i < stmt->cond_count; i++) {
+        Condition* cond = &stmt->conditions[i];
+        int field = bin_field_id(cond->field_name);
+        bin_put_u8(b, (unsigned int)field);
+        bin_put_u8(b, (unsigned int)opers[i]);
+        bin_put_operand(b, field, cond->int_value, cond->time_value, cond->str_value);
+    }
+    return 1;
+}
 
-    // Перестраиваем список
-    head = items[0].proc;
-    for (int i = 0; i < process_count - 1; i++) {
-        items[i].proc->next = items[i + 1].proc;
+// Переводит текстовый файл команд в кадры; 0 - ошибка ввода-вывода
+static int bin_convert(const char* text_path, const char* bin_path, int* framed, int* texts) {
+    FILE* input = fopen(text_path, "rb");
+    FILE* output = input ? fopen(bin_path, "wb") : NULL;
+    LdbDatabase* db = output ? ldb_open() : NULL;
+    size_t capacity = 10000;
+    char* line = db ? (char*)my_malloc(capacity) : NULL;
+    BinBuilder frame = { NULL, 0, 0, 0 };
+    *framed = *texts = 0;
+    if (line) fwrite(BIN_MAGIC, 1, BIN_MAGIC_SIZE, output);
+
+    while (line && !frame.failed && read_line(input, &line, &capacity)) {
+        size_t len = strcspn(line, "\r\n");
+        while (len > 0 && isspace((unsigned char)line[len - 1])) len--;
+        line[len] = '\0';
+        if (len == 0) continue;
+
+        frame.len = 0;
+        LdbStatement* stmt = NULL;
+        if (ldb_prepare(db, line, &stmt) == LDB_OK && bin_encode(&frame, stmt)) (*framed)++;
+        else {
+            frame.len = 0;
+            bin_put_u8(&frame, BIN_TEXT);
+            bin_put(&frame, line, len);
+            (*texts)++;
+        }
+        ldb_finalize(stmt);
+        unsigned char header[4];
+        bin_store_u32(header, (unsigned int)frame.len);
+        fwrite(header, 1, sizeof(header), output);
+        fwrite(frame.data, 1, frame.len, output);
     }
-    items[process_count - 1].proc->next = NULL;
 
-    my_free(items);
-    my_free(args_copy);
-    fprintf(output, "sort:%d\n", process_count);
+    int ok = line != NULL && !frame.failed && !ferror(output);
+    my_free(frame.data);
+    my_free(line);
+    ldb_close(db);
+    if (output) fclose(output);
+    if (input) fclose(input);
+    return ok;
 }
 
-// ===== MAIN =====
+int main(int argc, char** argv) {
+    // lab_db convert <текст> <кадры>: подготовка бинарного input из текстового
+    if (argc == 4 && strcmp(argv[1], "convert") == 0) {
+        int framed, texts;
+        if (!bin_convert(argv[2], argv[3], &framed, &texts)) return 1;
+        printf("frames:%d text:%d\n", framed, texts);
+        return 0;
+    }
 
-int main() {
-    FILE* input = fopen("input.txt", "r");
-    FILE* output = fopen("output.txt", "w");
+    FILE* input = fopen("input.txt", "rb");
+    int binary = input && bin_detect(input);
+    FILE* output = fopen("output.txt", binary ? "wb" : "w");
 
     if (!output) {
         if (input) fclose(input);
         return 1;
     }
 
-    char line[10000];
+    size_t line_capacity = 10000;
+    char* line = (char*)my_malloc(line_capacity);
+    scratch_warm();
 
-    if (input) {
-        while (fgets(line, sizeof(line), input)) {
+    if (binary && line) bin_session(input, output);
+    else if (input && line) {
+        while (read_line(input, &line, &line_capacity)) {
             line[strcspn(line, "\n")] = '\0';
             char* cr = strchr(line, '\r');
             if (cr) *cr = '\0';
@@ -1585,60 +9013,42 @@ int main() {
 
             if (line[0] == '\0') continue;
 
-            char* line_copy = (char*)my_malloc(strlen(line) + 1);
-            if (!line_copy) continue;
-            strcpy(line_copy, line);
-
-            char* cmd = strtok(line_copy, " \t");
-            if (!cmd) {
-                my_free(line_copy);
-                continue;
-            }
-
-            char* args = line;
-            while (*args && !isspace((unsigned char)*args)) args++;
-            while (*args == ' ' || *args == '\t') args++;
-
-            if (strcmp(cmd, "insert") == 0) {
-                insert(args, line, output);
-            }
-            else if (strcmp(cmd, "select") == 0) {
-                select_cmd(args, line, output);
-            }
-            else if (strcmp(cmd, "delete") == 0) {
-                delete_cmd(args, line, output);
-            }
-            else if (strcmp(cmd, "update") == 0) {
-                update_cmd(args, line, output);
-            }
-            else if (strcmp(cmd, "uniq") == 0) {
-                uniq_cmd(args, line, output);
-            }
-            else if (strcmp(cmd, "sort") == 0) {
-                sort_cmd(args, line, output);
-            }
-            else {
-                print_incorrect(output, line);
-            }
-
-            my_free(line_copy);
+            execute_line(line, output);
         }
-        fclose(input);
     }
+    if (input) fclose(input);
+    my_free(line);
 
+    pending_flush(output);
     fclose(output);
-    clear_allproc();
+    engine_shutdown();
 
+    // memstat.txt в репозитории получен запуском на memstat_input.txt (как input.txt)
     FILE* memstat = fopen("memstat.txt", "w");
     if (memstat) {
-        fprintf(memstat, "malloc:%d\n", malloc_count);
-        fprintf(memstat, "calloc:%d\n", calloc_count);
-        fprintf(memstat, "realloc:%d\n", realloc_count);
-        fprintf(memstat, "free:%d\n", free_count);
+        fprintf(memstat, "malloc:%ld\n", malloc_count);
+        fprintf(memstat, "calloc:%ld\n", calloc_count);
+        fprintf(memstat, "realloc:%ld\n", realloc_count);
+        fprintf(memstat, "free:%ld\n", free_count);
+        fprintf(memstat, "blocks_skipped:%d\n", blocks_skipped);
+        fprintf(memstat, "pool_hits:%ld\n", pool_hits);
+        fprintf(memstat, "pool_misses:%ld\n", pool_misses);
+        fprintf(memstat, "pool_evictions:%ld\n", pool_evictions);
+        fprintf(memstat, "sort_runs:%ld\n", sort_runs);
+        fprintf(memstat, "bloom_checks:%ld\n", bloom_checks);
+        fprintf(memstat, "bloom_skips:%ld\n", bloom_skips);
+        fprintf(memstat, "bloom_fpr:%.6f\n", bloom_fpr);
+        fprintf(memstat, "replica_publishes:%ld\n", replica_publishes);
+        fprintf(memstat, "replica_appends:%ld\n", replica_appends);
+        fprintf(memstat, "sched_batches:%ld\n", sched_batches);
+        fprintf(memstat, "sched_steals:%ld\n", sched_steals);
+        fprintf(memstat, "read_allocs:%ld\n", read_allocs);
         fclose(memstat);
     }
 
     
 
     return 0;
-}
\ No newline at end of file
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,112 @@
+﻿#ifndef LAB_DB_H
+#define LAB_DB_H
+
+#include <stdio.h>
+
+// ===== ВСТРАИВАЕМЫЙ ИНТЕРФЕЙС =====
+//
+// Библиотека собирается из lab_db.c с определенным LAB_DB_LIBRARY (проект lab_db_lib).
+// Таблица одна на процесс, поэтому одновременно открыт может быть только один дескриптор.
+// Наружу видны только функции ldb_*: все остальное в lab_db.c объявлено static.
+//
+// Подготовленный запрос пишется тем же текстом, что и команда, но вместо значений
+// можно ставить ?, например "select pid,name priority>? status=?" или
+// "insert pid=?, name=?, priority=?, kern_tm=?, file_tm=?, cpu_usage=?, status=?".
+// Поддерживаются insert, select, update, delete и count. Текст разбирается один раз
+// в ldb_prepare; ldb_bind_* подставляют типизированные значения (номера с 1),
+// ldb_execute / ldb_step выполняют запрос без повторного разбора.
+//
+// Реплика: команда "replica <имя>" публикует таблицу в разделяемую память и обновляет
+// ее после каждого изменения. Другой процесс подключается к ней через ldb_attach и
+// выполняет select, count и aggregate без копирования таблицы и не мешая писателю.
+
+typedef enum {
+    LDB_OK,
+    LDB_ROW,        // ldb_step вернул строку
+    LDB_DONE,       // строк больше нет
+    LDB_ERROR
+} LdbResult;
+
+typedef enum {
+    LDB_RUNNING,
+    LDB_READY,
+    LDB_PAUSED,
+    LDB_BLOCKED,
+    LDB_DYING,
+    LDB_SLEEPING
+} LdbStatus;
+
+typedef struct {
+    unsigned short hour;
+    unsigned short minute;
+    unsigned short second;
+} LdbTime;
+
+// Биты LdbRow.fields в порядке полей
+#define LDB_FIELD_PID        0x01
+#define LDB_FIELD_NAME       0x02
+#define LDB_FIELD_PRIORITY   0x04
+#define LDB_FIELD_KERN_TM    0x08
+#define LDB_FIELD_FILE_TM    0x10
+#define LDB_FIELD_CPU_USAGE  0x20
+#define LDB_FIELD_STATUS     0x40
+#define LDB_FIELD_ALL        0x7F
+
+// Строка результата; name принадлежит таблице и действует до следующего изменения
+typedef struct {
+    int pid;
+    const char* name;
+    int priority;
+    LdbTime kern_tm;
+    LdbTime file_tm;
+    int cpu_usage;      // в сотых долях
+    LdbStatus status;
+    unsigned int fields;    // LDB_FIELD_*: поля из списка select, остальные нулевые (name - NULL)
+} LdbRow;
+
+typedef struct LdbDatabase LdbDatabase;
+typedef struct LdbStatement LdbStatement;
+
+// Ненулевой результат останавливает перебор
+typedef int (*LdbRowCallback)(const LdbRow* row, void* ctx);
+
+LdbDatabase* ldb_open(void);
+// Только для чтения: реплика, опубликованная другим процессом; NULL - реплики нет
+LdbDatabase* ldb_attach(const char* name);
+void ldb_close(LdbDatabase* db);
+
+// Текстовая команда, как строка input.txt; вывод пишется в output
+LdbResult ldb_exec(LdbDatabase* db, const char* command, FILE* output);
+
+LdbResult ldb_prepare(LdbDatabase* db, const char* command, LdbStatement** stmt);
+void ldb_finalize(LdbStatement* stmt);
+
+LdbResult ldb_bind_int(LdbStatement* stmt, int index, int value);               // pid, priority
+LdbResult ldb_bind_text(LdbStatement* stmt, int index, const char* value);      // name
+LdbResult ldb_bind_time(LdbStatement* stmt, int index, LdbTime value);          // kern_tm, file_tm
+LdbResult ldb_bind_decimal(LdbStatement* stmt, int index, int hundredths);      // cpu_usage
+LdbResult ldb_bind_status(LdbStatement* stmt, int index, LdbStatus value);      // status
+
+// Выполняет запрос; для select и count каждая строка передается в callback (может быть NULL).
+// affected - число вставленных, найденных, измененных или удаленных строк (может быть NULL)
+LdbResult ldb_execute(LdbStatement* stmt, LdbRowCallback callback, void* ctx, int* affected);
+
+// Курсор по результату select: первый вызов выполняет запрос, следующие выдают строки.
+// Пока курсор не дошел до LDB_DONE или не сброшен, таблицу менять нельзя
+LdbResult ldb_step(LdbStatement* stmt, LdbRow* row);
+LdbResult ldb_reset(LdbStatement* stmt);
+
+// Прием строк из нескольких потоков. У каждого потока-производителя свой LdbProducer:
+// ldb_produce копит строки в его буфере и пачками отдает в общую очередь без блокировок.
+// Поток, открывший таблицу, вызывает ldb_ingest_drain - накопленные пачки вставляются
+// в конец таблицы в порядке постановки в очередь, строки одного производителя - в порядке
+// ldb_produce. Производители закрываются до ldb_close; непринятые строки выбрасываются
+typedef struct LdbProducer LdbProducer;
+
+LdbProducer* ldb_producer_open(LdbDatabase* db);
+LdbResult ldb_produce(LdbProducer* producer, const LdbRow* row);
+LdbResult ldb_producer_flush(LdbProducer* producer);    // отдать неполную пачку
+void ldb_producer_close(LdbProducer* producer);         // с flush
+LdbResult ldb_ingest_drain(LdbDatabase* db, int* inserted);
+
+#endif